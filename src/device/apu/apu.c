@@ -0,0 +1,915 @@
+#include "apu.h"
+
+#include "blip.h"
+#include "output_filter.h"
+#include "device/cpu.h"
+#include "device/device.h"
+#include "device/memory_map.h"
+#include "helpers.h"
+
+#include "log.h"
+
+#include <string.h>
+
+#define REG_PULSE1_CTRL     0x4000
+#define REG_PULSE1_SWEEP    0x4001
+#define REG_PULSE1_TIMER_LO 0x4002
+#define REG_PULSE1_TIMER_HI 0x4003
+#define REG_PULSE2_CTRL     0x4004
+#define REG_PULSE2_SWEEP    0x4005
+#define REG_PULSE2_TIMER_LO 0x4006
+#define REG_PULSE2_TIMER_HI 0x4007
+#define REG_TRIANGLE_CTRL   0x4008
+#define REG_TRIANGLE_UNUSED 0x4009
+#define REG_TRIANGLE_LO     0x400A
+#define REG_TRIANGLE_HI     0x400B
+#define REG_NOISE_CTRL      0x400C
+#define REG_NOISE_UNUSED    0x400D
+#define REG_NOISE_PERIOD    0x400E
+#define REG_NOISE_LENGTH    0x400F
+#define REG_DMC_CTRL        0x4010
+#define REG_DMC_LEVEL       0x4011
+#define REG_DMC_ADDR        0x4012
+#define REG_DMC_LENGTH      0x4013
+#define REG_STATUS          0x4015
+#define REG_FRAME_COUNTER   0x4017
+
+typedef enum {
+    kAPUSTATUS_PULSE1       = 0,
+    kAPUSTATUS_PULSE2       = 1,
+    kAPUSTATUS_TRIANGLE     = 2,
+    kAPUSTATUS_NOISE        = 3,
+    kAPUSTATUS_DMC          = 4,
+    kAPUSTATUS_FRAME_IRQ    = 6,
+    kAPUSTATUS_DMC_IRQ      = 7,
+} APUStatusFlag;
+
+typedef enum {
+    kAPUCHANNEL_PULSE1 = 0,
+    kAPUCHANNEL_PULSE2,
+    kAPUCHANNEL_TRIANGLE,
+    kAPUCHANNEL_NOISE,
+    kAPUCHANNEL_DMC,
+
+    kAPUCHANNEL_COUNT,
+} APUChannel;
+
+// what each frame counter step clocks. see https://www.nesdev.org/wiki/APU_Frame_Counter
+typedef enum {
+    kFRAMESTEP_QUARTER  = 1 << 0, // envelopes and the triangle's linear counter
+    kFRAMESTEP_HALF     = 1 << 1, // length counters and sweeps
+    kFRAMESTEP_IRQ      = 1 << 2,
+    kFRAMESTEP_WRAP     = 1 << 3,
+} FrameStepAction;
+
+typedef struct {
+    uint32_t    cycle;
+    uint8_t     actions;
+} FrameStep;
+
+#define FRAME_STEP_COUNT 6
+
+// in cpu cycles since the sequence started. the 4 step sequence has one step
+// fewer, so its last is padded out with a repeat of the wrap
+static const FrameStep s_frame_steps[2][FRAME_STEP_COUNT] = {
+    {
+        {  7457, kFRAMESTEP_QUARTER },
+        { 14913, kFRAMESTEP_QUARTER | kFRAMESTEP_HALF },
+        { 22371, kFRAMESTEP_QUARTER },
+        { 29829, kFRAMESTEP_QUARTER | kFRAMESTEP_HALF | kFRAMESTEP_IRQ },
+        { 29830, kFRAMESTEP_WRAP },
+        { 29830, kFRAMESTEP_WRAP },
+    },
+    {
+        {  7457, kFRAMESTEP_QUARTER },
+        { 14913, kFRAMESTEP_QUARTER | kFRAMESTEP_HALF },
+        { 22371, kFRAMESTEP_QUARTER },
+        { 29829, 0 },
+        { 37281, kFRAMESTEP_QUARTER | kFRAMESTEP_HALF },
+        { 37282, kFRAMESTEP_WRAP },
+    },
+};
+
+static const uint8_t s_length_table[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const uint8_t s_pulse_duties[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+static const uint8_t s_triangle_sequence[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+};
+
+// periods in cpu cycles
+static const uint16_t s_noise_periods[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+static const uint16_t s_dmc_periods[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+// linear approximation of the mixer, scaled so everything at full volume
+// fits in 16 bits. see https://www.nesdev.org/wiki/APU_Mixer
+static const int32_t s_channel_volumes[kAPUCHANNEL_COUNT] = { 246, 246, 279, 162, 110 };
+
+// how long output can go between being moved into the ring, in cpu cycles.
+// frame counter steps are never further apart than this either, which keeps
+// the blip buffer from filling at any sample rate up to APU_MAX_SAMPLE_RATE
+#define FLUSH_CYCLES 8192
+
+// cpu cycles a dmc fetch takes the bus for. it's 3 when the cpu happens to be
+// writing, or less alongside oam dma, but where the cpu is in its instruction
+// isn't known here. see https://www.nesdev.org/wiki/APU_DMC#Memory_reader
+#define DMC_STALL_CYCLES 4
+
+typedef struct {
+    uint8_t     start;
+    uint8_t     loop;       // also halts the length counter
+    uint8_t     constant;
+    uint8_t     volume;     // the constant volume, or the divider's period
+    uint8_t     divider;
+    uint8_t     decay;
+} Envelope;
+
+typedef struct {
+    Envelope    envelope;
+    uint8_t     duty;
+    uint8_t     step;
+    uint8_t     length;
+    uint8_t     sweep_enabled;
+    uint8_t     sweep_period;
+    uint8_t     sweep_negate;
+    uint8_t     sweep_shift;
+    uint8_t     sweep_reload;
+    uint8_t     sweep_divider;
+    uint16_t    period;
+    uint32_t    timer;      // cpu cycles until the sequencer next steps
+} Pulse;
+
+typedef struct {
+    uint8_t     control;    // also halts the length counter
+    uint8_t     linear_period;
+    uint8_t     linear;
+    uint8_t     linear_reload;
+    uint8_t     length;
+    uint8_t     step;
+    uint16_t    period;
+    uint32_t    timer;
+} Triangle;
+
+typedef struct {
+    Envelope    envelope;
+    uint8_t     mode;
+    uint8_t     length;
+    uint8_t     period_idx;
+    uint16_t    shift;
+    uint32_t    timer;
+} Noise;
+
+typedef struct {
+    uint8_t     irq_enabled;
+    uint8_t     loop;
+    uint8_t     period_idx;
+    uint8_t     level;
+    uint8_t     buffer;
+    uint8_t     buffer_empty;
+    uint8_t     shift;
+    uint8_t     bits;
+    uint8_t     silence;
+    uint8_t     irq;
+    uint16_t    sample_addr;
+    uint16_t    sample_length;
+    uint16_t    addr;
+    uint16_t    bytes_remaining;
+    uint32_t    timer;
+} DMC;
+
+typedef struct {
+    uint8_t     five_step;
+    uint8_t     irq_inhibit;
+    uint8_t     irq;
+    uint8_t     step;
+    uint32_t    cycle;      // cpu cycles since the sequence started
+} FrameCounter;
+
+static _Thread_local struct {
+    Pulse           pulses[2];
+    Triangle        triangle;
+    Noise           noise;
+    DMC             dmc;
+    FrameCounter    frame_counter;
+    uint8_t         enabled;    // channel enable bits, as written to $4015
+    uint32_t        pending;    // cycles run which the channels haven't caught up on
+    uint32_t        next_event; // pending cycles at which the cpu could next see a change
+    uint32_t        stall;      // cycles dmc fetches have taken from the cpu, not yet handed over
+} s_apu;
+
+// none of this is machine state, so it isn't saved or restored
+static _Thread_local struct {
+    int             enabled;
+    double          sample_rate;
+    uint32_t        cycle;      // cpu cycles since the blip buffer's frame started
+    uint8_t         levels[kAPUCHANNEL_COUNT];
+    Blip            blip;
+    OutputFilter    filter;
+    SampleRing      ring;
+} s_output = { .enabled = 1, .sample_rate = APU_DEFAULT_SAMPLE_RATE };
+
+static inline void _catch_up(void);
+static inline void _schedule(void);
+static inline void _update_irq(void);
+static inline void _run_channels(uint32_t cycles);
+static inline void _run_pulse(APUChannel channel, uint32_t cycles);
+static inline void _run_triangle(uint32_t cycles);
+static inline void _run_noise(uint32_t cycles);
+static inline void _run_dmc(uint32_t cycles);
+static inline void _dmc_fetch(void);
+static inline void _dmc_restart(void);
+static inline void _step_frame_counter(void);
+static inline void _clock_quarter_frame(void);
+static inline void _clock_half_frame(void);
+static inline void _clock_envelope(Envelope* envelope);
+static inline void _clock_sweep(APUChannel channel);
+static inline uint16_t _get_sweep_target(APUChannel channel);
+static inline uint8_t _get_pulse_volume(APUChannel channel);
+static inline uint8_t _get_pulse_level(APUChannel channel);
+static inline uint8_t _get_triangle_level(void);
+static inline uint8_t _get_noise_volume(void);
+static inline uint8_t _get_noise_level(void);
+static inline void _set_level(APUChannel channel, uint8_t level, uint32_t offset);
+static inline void _update_levels(void);
+static inline void _flush(void);
+
+void apu_init(void) {
+    memset(&s_apu, 0, sizeof(s_apu));
+
+    s_apu.pulses[0].timer   = 2;
+    s_apu.pulses[1].timer   = 2;
+    s_apu.triangle.timer    = 1;
+    s_apu.noise.shift       = 1;
+    s_apu.noise.timer       = s_noise_periods[0];
+    s_apu.dmc.timer         = s_dmc_periods[0];
+    s_apu.dmc.bits          = 8;
+    s_apu.dmc.buffer_empty  = 1;
+    s_apu.dmc.silence       = 1;
+    s_apu.dmc.sample_addr   = 0xC000;
+    s_apu.dmc.sample_length = 1;
+
+    s_output.cycle = 0;
+    memset(s_output.levels, 0, sizeof(s_output.levels));
+    blip_clear(&s_output.blip);
+    blip_set_rates(&s_output.blip, APU_CLOCK_RATE, s_output.sample_rate);
+    output_filter_init(&s_output.filter, s_output.sample_rate);
+}
+
+void apu_reset(void) {
+    _catch_up();
+
+    // reset silences everything and restarts the frame counter, but leaves
+    // the rest alone. see https://www.nesdev.org/wiki/CPU_power_up_state
+    const uint8_t silence = 0;
+    apu_reg_write8(REG_STATUS, &silence);
+
+    s_apu.frame_counter.irq     = 0;
+    s_apu.frame_counter.step    = 0;
+    s_apu.frame_counter.cycle   = 0;
+    s_apu.dmc.level            &= 1;
+
+    _update_levels();
+    _schedule();
+    _update_irq();
+}
+
+void apu_run(uint32_t cycles) {
+    s_apu.pending += cycles;
+    if (s_apu.pending >= s_apu.next_event)
+        _catch_up();
+}
+
+void apu_end_frame(void) {
+    _catch_up();
+    _flush();
+}
+
+void apu_set_output_enabled(int enabled) {
+    if (enabled == s_output.enabled)
+        return;
+
+    // the levels are left where the output stopped, so turning it back on
+    // steps straight to wherever the channels are now. after running ahead
+    // and restoring, that's exactly where they were, so there's no seam
+    _catch_up();
+    _flush();
+    s_output.cycle      = 0;
+    s_output.enabled    = enabled;
+    _update_levels();
+}
+
+void apu_set_sample_rate(double rate) {
+    if (rate <= 0 || rate > APU_MAX_SAMPLE_RATE) {
+        log_error("invalid sample rate %.1fHz", rate);
+        return;
+    }
+
+    // rates only change between blip frames, so flush up to here first
+    _catch_up();
+    _flush();
+
+    s_output.sample_rate = rate;
+    blip_set_rates(&s_output.blip, APU_CLOCK_RATE, rate);
+    output_filter_init(&s_output.filter, rate);
+}
+
+double apu_get_sample_rate(void) {
+    return s_output.sample_rate;
+}
+
+uint32_t apu_take_stall_cycles(void) {
+    const uint32_t stall = s_apu.stall;
+    s_apu.stall = 0;
+
+    return stall;
+}
+
+SampleRing* apu_get_sample_ring(void) {
+    return &s_output.ring;
+}
+
+int apu_reg_read8(uint16_t addr, uint8_t* out) {
+    if (addr != REG_STATUS) {
+        log_warn("attempted to read APU register 0x%04X, which is write only", addr);
+        return 0;
+    }
+
+    _catch_up();
+
+    *out = 0;
+    write_bit(out, kAPUSTATUS_PULSE1,       s_apu.pulses[0].length > 0);
+    write_bit(out, kAPUSTATUS_PULSE2,       s_apu.pulses[1].length > 0);
+    write_bit(out, kAPUSTATUS_TRIANGLE,     s_apu.triangle.length > 0);
+    write_bit(out, kAPUSTATUS_NOISE,        s_apu.noise.length > 0);
+    write_bit(out, kAPUSTATUS_DMC,          s_apu.dmc.bytes_remaining > 0);
+    write_bit(out, kAPUSTATUS_FRAME_IRQ,    s_apu.frame_counter.irq);
+    write_bit(out, kAPUSTATUS_DMC_IRQ,      s_apu.dmc.irq);
+
+    s_apu.frame_counter.irq = 0;
+    _update_irq();
+
+    return 1;
+}
+
+int apu_reg_write8(uint16_t addr, const uint8_t* in) {
+    _catch_up();
+
+    const uint8_t data = *in;
+    switch (addr) {
+        case REG_PULSE1_CTRL:
+        case REG_PULSE2_CTRL:
+        {
+            Pulse* pulse = &s_apu.pulses[addr == REG_PULSE2_CTRL];
+            pulse->duty                 = data >> 6;
+            pulse->envelope.loop        = read_bit(data, 5);
+            pulse->envelope.constant    = read_bit(data, 4);
+            pulse->envelope.volume      = data & 0x0F;
+            break;
+        }
+        case REG_PULSE1_SWEEP:
+        case REG_PULSE2_SWEEP:
+        {
+            Pulse* pulse = &s_apu.pulses[addr == REG_PULSE2_SWEEP];
+            pulse->sweep_enabled    = read_bit(data, 7);
+            pulse->sweep_period     = (data >> 4) & 0x07;
+            pulse->sweep_negate     = read_bit(data, 3);
+            pulse->sweep_shift      = data & 0x07;
+            pulse->sweep_reload     = 1;
+            break;
+        }
+        case REG_PULSE1_TIMER_LO:
+        case REG_PULSE2_TIMER_LO:
+        {
+            Pulse* pulse = &s_apu.pulses[addr == REG_PULSE2_TIMER_LO];
+            pulse->period = (pulse->period & 0x0700) | data;
+            break;
+        }
+        case REG_PULSE1_TIMER_HI:
+        case REG_PULSE2_TIMER_HI:
+        {
+            const APUChannel channel = addr == REG_PULSE2_TIMER_HI ? kAPUCHANNEL_PULSE2 : kAPUCHANNEL_PULSE1;
+            Pulse* pulse = &s_apu.pulses[channel];
+            pulse->period           = (pulse->period & 0x00FF) | ((data & 0x07) << 8);
+            pulse->step             = 0;
+            pulse->envelope.start   = 1;
+            if (read_bit(s_apu.enabled, channel))
+                pulse->length = s_length_table[data >> 3];
+            break;
+        }
+        case REG_TRIANGLE_CTRL:
+            s_apu.triangle.control          = read_bit(data, 7);
+            s_apu.triangle.linear_period    = data & 0x7F;
+            break;
+        case REG_TRIANGLE_LO:
+            s_apu.triangle.period = (s_apu.triangle.period & 0x0700) | data;
+            break;
+        case REG_TRIANGLE_HI:
+            s_apu.triangle.period           = (s_apu.triangle.period & 0x00FF) | ((data & 0x07) << 8);
+            s_apu.triangle.linear_reload    = 1;
+            if (read_bit(s_apu.enabled, kAPUCHANNEL_TRIANGLE))
+                s_apu.triangle.length = s_length_table[data >> 3];
+            break;
+        case REG_NOISE_CTRL:
+            s_apu.noise.envelope.loop       = read_bit(data, 5);
+            s_apu.noise.envelope.constant   = read_bit(data, 4);
+            s_apu.noise.envelope.volume     = data & 0x0F;
+            break;
+        case REG_NOISE_PERIOD:
+            s_apu.noise.mode        = read_bit(data, 7);
+            s_apu.noise.period_idx  = data & 0x0F;
+            break;
+        case REG_NOISE_LENGTH:
+            s_apu.noise.envelope.start = 1;
+            if (read_bit(s_apu.enabled, kAPUCHANNEL_NOISE))
+                s_apu.noise.length = s_length_table[data >> 3];
+            break;
+        case REG_DMC_CTRL:
+            s_apu.dmc.irq_enabled   = read_bit(data, 7);
+            s_apu.dmc.loop          = read_bit(data, 6);
+            s_apu.dmc.period_idx    = data & 0x0F;
+            if (! s_apu.dmc.irq_enabled)
+                s_apu.dmc.irq = 0;
+            break;
+        case REG_DMC_LEVEL:
+            s_apu.dmc.level = data & 0x7F;
+            break;
+        case REG_DMC_ADDR:
+            s_apu.dmc.sample_addr = 0xC000 + data*64;
+            break;
+        case REG_DMC_LENGTH:
+            s_apu.dmc.sample_length = data*16 + 1;
+            break;
+        case REG_STATUS:
+            s_apu.enabled = data & 0x1F;
+            if (! read_bit(data, kAPUSTATUS_PULSE1))
+                s_apu.pulses[0].length = 0;
+            if (! read_bit(data, kAPUSTATUS_PULSE2))
+                s_apu.pulses[1].length = 0;
+            if (! read_bit(data, kAPUSTATUS_TRIANGLE))
+                s_apu.triangle.length = 0;
+            if (! read_bit(data, kAPUSTATUS_NOISE))
+                s_apu.noise.length = 0;
+
+            if (! read_bit(data, kAPUSTATUS_DMC)) {
+                s_apu.dmc.bytes_remaining = 0;
+            } else if (s_apu.dmc.bytes_remaining == 0) {
+                _dmc_restart();
+                _dmc_fetch();
+            }
+            s_apu.dmc.irq = 0;
+            break;
+        case REG_FRAME_COUNTER:
+            s_apu.frame_counter.five_step   = read_bit(data, 7);
+            s_apu.frame_counter.irq_inhibit = read_bit(data, 6);
+            s_apu.frame_counter.step        = 0;
+            s_apu.frame_counter.cycle       = 0;
+            if (s_apu.frame_counter.irq_inhibit)
+                s_apu.frame_counter.irq = 0;
+
+            // the 5 step sequence clocks a quarter and a half frame straight
+            // away, levels are updated below
+            if (s_apu.frame_counter.five_step) {
+                _clock_quarter_frame();
+                _clock_half_frame();
+            }
+            break;
+
+        case REG_TRIANGLE_UNUSED:
+        case REG_NOISE_UNUSED:
+            break;
+
+        default:
+            log_error("attempted to write to APU register 0x%04X, which doesn't exist", addr);
+            return 0;
+    }
+
+    _update_levels();
+    _schedule();
+    _update_irq();
+    return 1;
+}
+
+int apu_get_irq(void) {
+    return s_apu.frame_counter.irq || s_apu.dmc.irq;
+}
+
+void* apu_get_state(size_t* size) {
+    *size = sizeof(s_apu);
+    return &s_apu;
+}
+
+static inline void _catch_up(void) {
+    while (s_apu.pending > 0) {
+        FrameCounter* fc        = &s_apu.frame_counter;
+        const uint32_t until    = s_frame_steps[fc->five_step][fc->step].cycle - fc->cycle;
+        const uint32_t cycles   = s_apu.pending < until ? s_apu.pending : until;
+
+        _run_channels(cycles);
+
+        fc->cycle       += cycles;
+        s_apu.pending   -= cycles;
+        if (s_output.enabled)
+            s_output.cycle += cycles;
+
+        if (cycles == until)
+            _step_frame_counter();
+    }
+
+    if (s_output.cycle >= FLUSH_CYCLES)
+        _flush();
+
+    _schedule();
+    _update_irq();
+}
+
+// nothing the cpu can see changes until the frame counter next steps or the
+// dmc next fetches, so the channels needn't catch up before then
+static inline void _schedule(void) {
+    const FrameCounter* fc  = &s_apu.frame_counter;
+    uint32_t until          = s_frame_steps[fc->five_step][fc->step].cycle - fc->cycle;
+
+    // the buffer empties into the shift register as its last bit is clocked
+    // out, which is when the next byte gets fetched
+    const DMC* dmc = &s_apu.dmc;
+    if (dmc->bytes_remaining > 0) {
+        const uint32_t fetch = dmc->timer + (dmc->bits - 1)*(uint32_t)s_dmc_periods[dmc->period_idx];
+        if (fetch < until)
+            until = fetch;
+    }
+
+    s_apu.next_event = until;
+}
+
+// both irqs are only ever raised while catching up, and only cleared through
+// registers, so the lines are brought up to date at the end of each
+static inline void _update_irq(void) {
+    cpu_set_irq_line(kCPUIRQSOURCE_APU_FRAME, s_apu.frame_counter.irq);
+    cpu_set_irq_line(kCPUIRQSOURCE_APU_DMC, s_apu.dmc.irq);
+}
+
+static inline void _run_channels(uint32_t cycles) {
+    _run_pulse(kAPUCHANNEL_PULSE1, cycles);
+    _run_pulse(kAPUCHANNEL_PULSE2, cycles);
+    _run_triangle(cycles);
+    _run_noise(cycles);
+    _run_dmc(cycles);
+}
+
+// each channel's timer is stepped from one clock to the next rather than
+// cycle by cycle, and only when the output is heard does each step cost more
+// than a little arithmetic
+static inline void _run_pulse(APUChannel channel, uint32_t cycles) {
+    Pulse* pulse = &s_apu.pulses[channel];
+    if (pulse->timer > cycles) {
+        pulse->timer -= cycles;
+        return;
+    }
+
+    const uint32_t period = (pulse->period + 1) * 2;
+
+    // when nothing can be heard, only where the sequencer ends up matters
+    if (! s_output.enabled || (_get_pulse_volume(channel) == 0 && s_output.levels[channel] == 0)) {
+        const uint32_t after = cycles - pulse->timer;
+        pulse->step     = (pulse->step + 1 + after/period) & 0x07;
+        pulse->timer    = period - after%period;
+        return;
+    }
+
+    uint32_t t = pulse->timer;
+    for (; t <= cycles; t += period) {
+        pulse->step = (pulse->step + 1) & 0x07;
+        _set_level(channel, _get_pulse_level(channel), t);
+    }
+    pulse->timer = t - cycles;
+}
+
+static inline void _run_triangle(uint32_t cycles) {
+    Triangle* tri = &s_apu.triangle;
+    if (tri->timer > cycles) {
+        tri->timer -= cycles;
+        return;
+    }
+
+    const uint32_t period   = tri->period + 1;
+    const uint32_t after    = cycles - tri->timer;
+    const uint32_t steps    = 1 + after/period;
+
+    // the sequencer only moves while both counters are running. ultrasonic
+    // periods are held still instead, like most emulators, as they'd only
+    // alias into a whine
+    if (tri->length == 0 || tri->linear == 0 || tri->period < 2) {
+        tri->timer = period - after%period;
+        return;
+    }
+
+    if (! s_output.enabled) {
+        tri->step   = (tri->step + steps) & 0x1F;
+        tri->timer  = period - after%period;
+        return;
+    }
+
+    uint32_t t = tri->timer;
+    for (; t <= cycles; t += period) {
+        tri->step = (tri->step + 1) & 0x1F;
+        _set_level(kAPUCHANNEL_TRIANGLE, s_triangle_sequence[tri->step], t);
+    }
+    tri->timer = t - cycles;
+}
+
+static inline void _run_noise(uint32_t cycles) {
+    Noise* noise = &s_apu.noise;
+    if (noise->timer > cycles) {
+        noise->timer -= cycles;
+        return;
+    }
+
+    const uint32_t period   = s_noise_periods[noise->period_idx];
+    const uint8_t tap       = noise->mode ? 6 : 1;
+
+    // the shift register has to be stepped either way, but when it can't be
+    // heard, it's stepped as many bits at a time as only depend on bits already
+    // in the register: 15 - tap
+    if (! s_output.enabled || (_get_noise_volume() == 0 && s_output.levels[kAPUCHANNEL_NOISE] == 0)) {
+        const uint32_t after    = cycles - noise->timer;
+        const uint8_t block     = 15 - tap;
+        uint32_t steps          = 1 + after/period;
+
+        for (; steps >= block; steps -= block) {
+            const uint16_t feedback = (noise->shift ^ (noise->shift >> tap)) & ((1 << block) - 1);
+            noise->shift = (noise->shift >> block) | (feedback << tap);
+        }
+        for (; steps > 0; --steps) {
+            const uint16_t feedback = (noise->shift ^ (noise->shift >> tap)) & 0x01;
+            noise->shift = (noise->shift >> 1) | (feedback << 14);
+        }
+
+        noise->timer = period - after%period;
+        return;
+    }
+
+    uint32_t t = noise->timer;
+    for (; t <= cycles; t += period) {
+        const uint16_t feedback = (noise->shift ^ (noise->shift >> tap)) & 0x01;
+        noise->shift = (noise->shift >> 1) | (feedback << 14);
+
+        _set_level(kAPUCHANNEL_NOISE, _get_noise_level(), t);
+    }
+    noise->timer = t - cycles;
+}
+
+static inline void _run_dmc(uint32_t cycles) {
+    DMC* dmc = &s_apu.dmc;
+    if (dmc->timer > cycles) {
+        dmc->timer -= cycles;
+        return;
+    }
+
+    const uint32_t period   = s_dmc_periods[dmc->period_idx];
+    const uint32_t after    = cycles - dmc->timer;
+
+    // with no sample playing, the output unit just counts out empty bytes
+    if (dmc->silence && dmc->buffer_empty && dmc->bytes_remaining == 0) {
+        const uint32_t steps = 1 + after/period;
+        dmc->shift  = steps >= 8 ? 0 : dmc->shift >> steps;
+        dmc->bits   = 8 - (8 - dmc->bits + steps) % 8;
+        dmc->timer  = period - after%period;
+        return;
+    }
+
+    uint32_t t = dmc->timer;
+    for (; t <= cycles; t += period) {
+        if (! dmc->silence) {
+            if (dmc->shift & 0x01) {
+                if (dmc->level <= 125)
+                    dmc->level += 2;
+            } else if (dmc->level >= 2) {
+                dmc->level -= 2;
+            }
+
+            _set_level(kAPUCHANNEL_DMC, dmc->level, t);
+        }
+
+        dmc->shift >>= 1;
+        if (--dmc->bits == 0) {
+            dmc->bits = 8;
+            if (dmc->buffer_empty) {
+                dmc->silence = 1;
+            } else {
+                dmc->silence        = 0;
+                dmc->shift          = dmc->buffer;
+                dmc->buffer_empty   = 1;
+                _dmc_fetch();
+            }
+        }
+    }
+    dmc->timer = t - cycles;
+}
+
+static inline void _dmc_fetch(void) {
+    DMC* dmc = &s_apu.dmc;
+    if (! dmc->buffer_empty || dmc->bytes_remaining == 0)
+        return;
+
+    // samples only ever come from PRG ROM, so the fetch skips the bus and
+    // reads straight from the page it's in
+    Cart* cart          = g_device.cart;
+    const uint8_t* page = cart != NULL ? cart->prg_pages[(dmc->addr - CART_ROM_BANK_START) >> CART_PRG_PAGE_SHIFT] : NULL;
+    if (page != NULL)
+        dmc->buffer = page[dmc->addr & (CART_PRG_PAGE_SIZE - 1)];
+    else if (cart == NULL || ! cart_read8(cart, dmc->addr, &dmc->buffer))
+        dmc->buffer = 0;
+
+    s_apu.stall        += DMC_STALL_CYCLES;
+    dmc->buffer_empty   = 0;
+    dmc->addr           = dmc->addr == 0xFFFF ? 0x8000 : dmc->addr + 1;
+
+    if (--dmc->bytes_remaining == 0) {
+        if (dmc->loop)
+            _dmc_restart();
+        else if (dmc->irq_enabled)
+            dmc->irq = 1;
+    }
+}
+
+static inline void _dmc_restart(void) {
+    s_apu.dmc.addr              = s_apu.dmc.sample_addr;
+    s_apu.dmc.bytes_remaining   = s_apu.dmc.sample_length;
+}
+
+static inline void _step_frame_counter(void) {
+    FrameCounter* fc        = &s_apu.frame_counter;
+    const uint8_t actions   = s_frame_steps[fc->five_step][fc->step].actions;
+
+    if (actions & kFRAMESTEP_QUARTER)
+        _clock_quarter_frame();
+    if (actions & kFRAMESTEP_HALF)
+        _clock_half_frame();
+
+    if ((actions & kFRAMESTEP_IRQ) && ! fc->irq_inhibit)
+        fc->irq = 1;
+
+    if (actions & kFRAMESTEP_WRAP) {
+        fc->step    = 0;
+        fc->cycle   = 0;
+    } else {
+        ++fc->step;
+    }
+
+    _update_levels();
+}
+
+// envelopes and the triangle's linear counter
+static inline void _clock_quarter_frame(void) {
+    _clock_envelope(&s_apu.pulses[0].envelope);
+    _clock_envelope(&s_apu.pulses[1].envelope);
+    _clock_envelope(&s_apu.noise.envelope);
+
+    Triangle* tri = &s_apu.triangle;
+    if (tri->linear_reload)
+        tri->linear = tri->linear_period;
+    else if (tri->linear > 0)
+        --tri->linear;
+
+    if (! tri->control)
+        tri->linear_reload = 0;
+}
+
+// length counters and sweeps
+static inline void _clock_half_frame(void) {
+    for (uint8_t i = 0; i < 2; ++i) {
+        Pulse* pulse = &s_apu.pulses[i];
+        if (! pulse->envelope.loop && pulse->length > 0)
+            --pulse->length;
+    }
+
+    if (! s_apu.triangle.control && s_apu.triangle.length > 0)
+        --s_apu.triangle.length;
+    if (! s_apu.noise.envelope.loop && s_apu.noise.length > 0)
+        --s_apu.noise.length;
+
+    _clock_sweep(kAPUCHANNEL_PULSE1);
+    _clock_sweep(kAPUCHANNEL_PULSE2);
+}
+
+static inline void _clock_envelope(Envelope* envelope) {
+    if (envelope->start) {
+        envelope->start     = 0;
+        envelope->decay     = 15;
+        envelope->divider   = envelope->volume;
+        return;
+    }
+
+    if (envelope->divider > 0) {
+        --envelope->divider;
+        return;
+    }
+
+    envelope->divider = envelope->volume;
+    if (envelope->decay > 0)
+        --envelope->decay;
+    else if (envelope->loop)
+        envelope->decay = 15;
+}
+
+static inline void _clock_sweep(APUChannel channel) {
+    Pulse* pulse            = &s_apu.pulses[channel];
+    const uint16_t target   = _get_sweep_target(channel);
+
+    if (pulse->sweep_divider == 0 && pulse->sweep_enabled && pulse->sweep_shift > 0 && pulse->period >= 8 && target <= 0x7FF)
+        pulse->period = target;
+
+    if (pulse->sweep_divider == 0 || pulse->sweep_reload) {
+        pulse->sweep_divider    = pulse->sweep_period;
+        pulse->sweep_reload     = 0;
+    } else {
+        --pulse->sweep_divider;
+    }
+}
+
+static inline uint16_t _get_sweep_target(APUChannel channel) {
+    const Pulse* pulse      = &s_apu.pulses[channel];
+    const uint16_t change   = pulse->period >> pulse->sweep_shift;
+    if (! pulse->sweep_negate)
+        return pulse->period + change;
+
+    // pulse 1 negates with one's complement, pulse 2 with two's
+    const uint16_t negated = change + (channel == kAPUCHANNEL_PULSE1);
+    return negated > pulse->period ? 0 : pulse->period - negated;
+}
+
+// the volume the channel plays at when its waveform is high
+static inline uint8_t _get_pulse_volume(APUChannel channel) {
+    const Pulse* pulse = &s_apu.pulses[channel];
+    if (pulse->length == 0 || pulse->period < 8 || _get_sweep_target(channel) > 0x7FF)
+        return 0;
+
+    return pulse->envelope.constant ? pulse->envelope.volume : pulse->envelope.decay;
+}
+
+static inline uint8_t _get_pulse_level(APUChannel channel) {
+    const Pulse* pulse = &s_apu.pulses[channel];
+    return s_pulse_duties[pulse->duty][pulse->step] ? _get_pulse_volume(channel) : 0;
+}
+
+static inline uint8_t _get_triangle_level(void) {
+    return s_triangle_sequence[s_apu.triangle.step];
+}
+
+static inline uint8_t _get_noise_volume(void) {
+    const Noise* noise = &s_apu.noise;
+    if (noise->length == 0)
+        return 0;
+
+    return noise->envelope.constant ? noise->envelope.volume : noise->envelope.decay;
+}
+
+static inline uint8_t _get_noise_level(void) {
+    return (s_apu.noise.shift & 0x01) ? 0 : _get_noise_volume();
+}
+
+// offset is in cpu cycles from where the channels were last caught up to
+static inline void _set_level(APUChannel channel, uint8_t level, uint32_t offset) {
+    const int32_t delta = (int32_t)level - s_output.levels[channel];
+    if (delta == 0 || ! s_output.enabled)
+        return;
+
+    s_output.levels[channel] = level;
+    blip_add_delta(&s_output.blip, s_output.cycle + offset, delta * s_channel_volumes[channel]);
+}
+
+static inline void _update_levels(void) {
+    _set_level(kAPUCHANNEL_PULSE1,     _get_pulse_level(kAPUCHANNEL_PULSE1), 0);
+    _set_level(kAPUCHANNEL_PULSE2,     _get_pulse_level(kAPUCHANNEL_PULSE2), 0);
+    _set_level(kAPUCHANNEL_TRIANGLE,   _get_triangle_level(), 0);
+    _set_level(kAPUCHANNEL_NOISE,      _get_noise_level(), 0);
+    _set_level(kAPUCHANNEL_DMC,        s_apu.dmc.level, 0);
+}
+
+static inline void _flush(void) {
+    if (! s_output.enabled)
+        return;
+
+    blip_end_frame(&s_output.blip, s_output.cycle);
+    s_output.cycle = 0;
+
+    int16_t samples[BLIP_MAX_SAMPLES];
+    const size_t count = blip_read_samples(&s_output.blip, samples, BLIP_MAX_SAMPLES);
+    output_filter_apply(&s_output.filter, samples, count);
+
+    // if nobody's reading, the newest samples are dropped
+    sample_ring_write(&s_output.ring, samples, count);
+}
@@ -0,0 +1,47 @@
+#ifndef APU_H
+#define APU_H
+
+#include "sample_ring.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// the apu is clocked with the ntsc cpu
+#define APU_CLOCK_RATE 1789773.0
+// synthesis runs at a fixed rate comfortably above any host's, which leaves the
+// final conversion to a resampler with room to filter properly
+#define APU_DEFAULT_SAMPLE_RATE 96000.0
+#define APU_MAX_SAMPLE_RATE 192000.0
+
+void apu_init(void);
+void apu_reset(void);
+// advances the apu by a number of cpu cycles. this only counts them, and the
+// channels are caught up in one go whenever a register is touched, the frame
+// counter steps, the dmc fetches or the frame ends
+void apu_run(uint32_t cycles);
+// cycles the dmc has stalled the cpu for since the last call, which the cpu
+// owes the rest of the machine
+uint32_t apu_take_stall_cycles(void);
+// catches the channels up and moves the samples made so far into the ring
+void apu_end_frame(void);
+
+// sample synthesis, on by default. turning it off keeps channel and irq timing
+void apu_set_output_enabled(int enabled);
+// resets the output filters, so best left alone once running. fine grained
+// rate control belongs in the resampler after the ring
+void apu_set_sample_rate(double rate);
+double apu_get_sample_rate(void);
+// where finished samples go. the ring belongs to the calling thread's apu, but
+// can be read from any one other thread
+SampleRing* apu_get_sample_ring(void);
+
+int apu_reg_read8(uint16_t addr, uint8_t* out);
+int apu_reg_write8(uint16_t addr, const uint8_t* in);
+
+// level of the apu's irq line, raised by the frame counter or the dmc
+int apu_get_irq(void);
+
+// raw state for snapshotting
+void* apu_get_state(size_t* size);
+
+#endif
@@ -0,0 +1,114 @@
+#include "blip.h"
+
+#include <string.h>
+
+#define BLIP_FRAC_BITS 32
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASE_COUNT (1 << BLIP_PHASE_BITS)
+// kernels each sum to 1 << BLIP_KERNEL_BITS, so a delta keeps its size
+#define BLIP_KERNEL_BITS 12
+// the integrator leaks a little each sample, which takes out any dc offset
+#define BLIP_BASS_SHIFT 9
+
+// the change a unit step makes to each of the samples around it, for steps
+// landing at each 1/32nd of the way between two samples. blackman windowed
+// sinc, cut off at 90% of nyquist
+static const int16_t s_kernels[BLIP_PHASE_COUNT][BLIP_KERNEL_WIDTH] = {
+    {     1,    -4,     9,    -4,   -31,   139,  -423,  2360,  2362,  -423,   139,   -31,    -4,     9,    -4,     1 },
+    {     1,    -4,     7,     0,   -40,   154,  -442,  2257,  2463,  -400,   123,   -21,    -9,    11,    -5,     1 },
+    {     1,    -3,     5,     5,   -48,   166,  -456,  2149,  2560,  -371,   105,   -11,   -14,    12,    -5,     1 },
+    {     1,    -3,     3,     9,   -56,   177,  -465,  2038,  2654,  -337,    85,     0,   -19,    14,    -6,     1 },
+    {     0,    -2,     2,    12,   -63,   186,  -470,  1925,  2742,  -298,    64,    12,   -25,    16,    -6,     1 },
+    {     0,    -2,     0,    16,   -68,   192,  -470,  1810,  2825,  -253,    40,    24,   -30,    18,    -7,     1 },
+    {     0,    -2,    -1,    19,   -73,   197,  -467,  1694,  2902,  -204,    16,    36,   -35,    20,    -7,     1 },
+    {     0,    -1,    -2,    22,   -78,   200,  -460,  1578,  2972,  -148,   -10,    49,   -41,    22,    -8,     1 },
+    {     0,    -1,    -3,    24,   -81,   202,  -449,  1461,  3035,   -88,   -37,    62,   -46,    24,    -8,     1 },
+    {     0,     0,    -5,    26,   -83,   201,  -435,  1344,  3093,   -22,   -65,    75,   -51,    25,    -8,     1 },
+    {     0,     0,    -5,    28,   -85,   199,  -418,  1229,  3141,    50,   -94,    88,   -56,    27,    -9,     1 },
+    {     0,     0,    -6,    30,   -86,   196,  -399,  1114,  3186,   126,  -124,   100,   -61,    28,    -9,     1 },
+    {     0,     0,    -7,    31,   -86,   191,  -377,  1001,  3222,   207,  -154,   113,   -66,    29,    -9,     1 },
+    {     0,     1,    -8,    31,   -86,   184,  -353,   891,  3251,   292,  -184,   125,   -70,    30,    -9,     1 },
+    {     0,     1,    -8,    32,   -85,   177,  -328,   783,  3269,   383,  -214,   137,   -74,    31,    -9,     1 },
+    {     0,     1,    -9,    32,   -83,   168,  -301,   677,  3283,   477,  -244,   148,   -77,    32,    -9,     1 },
+    {     0,     1,    -9,    32,   -80,   159,  -273,   575,  3286,   575,  -273,   159,   -80,    32,    -9,     1 },
+    {     0,     1,    -9,    32,   -77,   148,  -244,   477,  3283,   677,  -301,   168,   -83,    32,    -9,     1 },
+    {     0,     1,    -9,    31,   -74,   137,  -214,   383,  3269,   783,  -328,   177,   -85,    32,    -8,     1 },
+    {     0,     1,    -9,    30,   -70,   125,  -184,   292,  3251,   891,  -353,   184,   -86,    31,    -8,     1 },
+    {     0,     1,    -9,    29,   -66,   113,  -154,   207,  3222,  1001,  -377,   191,   -86,    31,    -7,     0 },
+    {     0,     1,    -9,    28,   -61,   100,  -124,   126,  3186,  1114,  -399,   196,   -86,    30,    -6,     0 },
+    {     0,     1,    -9,    27,   -56,    88,   -94,    50,  3141,  1229,  -418,   199,   -85,    28,    -5,     0 },
+    {     0,     1,    -8,    25,   -51,    75,   -65,   -22,  3093,  1344,  -435,   201,   -83,    26,    -5,     0 },
+    {     0,     1,    -8,    24,   -46,    62,   -37,   -88,  3035,  1461,  -449,   202,   -81,    24,    -3,    -1 },
+    {     0,     1,    -8,    22,   -41,    49,   -10,  -148,  2972,  1578,  -460,   200,   -78,    22,    -2,    -1 },
+    {     0,     1,    -7,    20,   -35,    36,    16,  -204,  2902,  1694,  -467,   197,   -73,    19,    -1,    -2 },
+    {     0,     1,    -7,    18,   -30,    24,    40,  -253,  2825,  1810,  -470,   192,   -68,    16,     0,    -2 },
+    {     0,     1,    -6,    16,   -25,    12,    64,  -298,  2742,  1925,  -470,   186,   -63,    12,     2,    -2 },
+    {     0,     1,    -6,    14,   -19,     0,    85,  -337,  2655,  2038,  -465,   177,   -56,     9,     3,    -3 },
+    {     0,     1,    -5,    12,   -14,   -11,   105,  -371,  2561,  2149,  -456,   166,   -48,     5,     5,    -3 },
+    {     0,     1,    -5,    11,    -9,   -21,   123,  -400,  2464,  2257,  -442,   154,   -40,     0,     7,    -4 },
+};
+
+void blip_clear(Blip* blip) {
+    blip->offset        = 0;
+    blip->integrator    = 0;
+    memset(blip->samples, 0, sizeof(blip->samples));
+}
+
+void blip_set_rates(Blip* blip, double clock_rate, double sample_rate) {
+    blip->factor = (uint64_t)(sample_rate / clock_rate * (double)((uint64_t)1 << BLIP_FRAC_BITS));
+}
+
+void blip_add_delta(Blip* blip, uint32_t clock, int32_t delta) {
+    const uint64_t pos      = blip->offset + clock * blip->factor;
+    const size_t idx        = pos >> BLIP_FRAC_BITS;
+    const uint32_t phase    = (pos >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASE_COUNT - 1);
+
+    // the caller ends frames often enough that this never happens
+    if (idx >= BLIP_MAX_SAMPLES)
+        return;
+
+    const int16_t* kernel   = s_kernels[phase];
+    int32_t* out            = blip->samples + idx;
+    for (size_t i = 0; i < BLIP_KERNEL_WIDTH; ++i)
+        out[i] += kernel[i] * delta;
+}
+
+void blip_end_frame(Blip* blip, uint32_t clocks) {
+    blip->offset += clocks * blip->factor;
+}
+
+size_t blip_get_samples_avail(const Blip* blip) {
+    const size_t avail = blip->offset >> BLIP_FRAC_BITS;
+    return avail < BLIP_MAX_SAMPLES ? avail : BLIP_MAX_SAMPLES;
+}
+
+size_t blip_read_samples(Blip* blip, int16_t* out, size_t max) {
+    const size_t avail  = blip_get_samples_avail(blip);
+    size_t count        = avail;
+    if (count > max)
+        count = max;
+
+    int32_t sum = blip->integrator;
+    for (size_t i = 0; i < count; ++i) {
+        sum += blip->samples[i];
+
+        int32_t s = sum >> BLIP_KERNEL_BITS;
+        if (s > INT16_MAX)
+            s = INT16_MAX;
+        else if (s < INT16_MIN)
+            s = INT16_MIN;
+        out[i] = (int16_t)s;
+
+        sum -= s * (1 << (BLIP_KERNEL_BITS - BLIP_BASS_SHIFT));
+    }
+    blip->integrator = sum;
+
+    // shift what's left, including the tails of kernels past the end, down to
+    // the start. nothing past those tails has been touched
+    const size_t remaining = avail + BLIP_KERNEL_WIDTH - count;
+    memmove(blip->samples, blip->samples + count, remaining * sizeof(*blip->samples));
+    memset(blip->samples + remaining, 0, count * sizeof(*blip->samples));
+    blip->offset -= (uint64_t)count << BLIP_FRAC_BITS;
+
+    return count;
+}
@@ -0,0 +1,36 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// band-limited step synthesis, after blargg's blip_buf. rather than making a
+// sample every clock, callers add the change in amplitude whenever their output
+// steps, and each step is drawn into the output as a band-limited kernel. the
+// cost scales with how often the output changes, not with the clock rate
+
+// most samples that can be made between reads
+#define BLIP_MAX_SAMPLES 4096
+#define BLIP_KERNEL_WIDTH 16
+
+typedef struct {
+    uint64_t    factor;     // output samples per clock, 32.32 fixed point
+    uint64_t    offset;     // where clock 0 of the current frame lands, 32.32 fixed point samples
+    int32_t     integrator;
+    int32_t     samples[BLIP_MAX_SAMPLES + BLIP_KERNEL_WIDTH];
+} Blip;
+
+void blip_clear(Blip* blip);
+// rates can be changed between frames, eg. for rate control
+void blip_set_rates(Blip* blip, double clock_rate, double sample_rate);
+
+// adds a step of delta in amplitude at clock, relative to the start of the frame
+void blip_add_delta(Blip* blip, uint32_t clock, int32_t delta);
+// ends the frame clocks after it started, making its samples available
+void blip_end_frame(Blip* blip, uint32_t clocks);
+
+size_t blip_get_samples_avail(const Blip* blip);
+// moves up to max samples into out, returning how many
+size_t blip_read_samples(Blip* blip, int16_t* out, size_t max);
+
+#endif
@@ -0,0 +1,47 @@
+#include "output_filter.h"
+
+#include <math.h>
+#include <string.h>
+
+static inline float _high_pass_k(double cutoff, double sample_rate);
+static inline float _low_pass_k(double cutoff, double sample_rate);
+
+void output_filter_init(OutputFilter* filter, double sample_rate) {
+    memset(filter, 0, sizeof(*filter));
+
+    filter->high_pass_90_k  = _high_pass_k(90, sample_rate);
+    filter->high_pass_440_k = _high_pass_k(440, sample_rate);
+    filter->low_pass_k      = _low_pass_k(14000, sample_rate);
+}
+
+void output_filter_apply(OutputFilter* filter, int16_t* samples, size_t count) {
+    OutputFilter f = *filter;
+
+    for (size_t i = 0; i < count; ++i) {
+        const float in = samples[i];
+
+        f.high_pass_90_out  = f.high_pass_90_k * (f.high_pass_90_out + in - f.high_pass_90_in);
+        f.high_pass_90_in   = in;
+
+        f.high_pass_440_out = f.high_pass_440_k * (f.high_pass_440_out + f.high_pass_90_out - f.high_pass_440_in);
+        f.high_pass_440_in  = f.high_pass_90_out;
+
+        f.low_pass_out     += f.low_pass_k * (f.high_pass_440_out - f.low_pass_out);
+
+        const float out = f.low_pass_out;
+        samples[i] = out >= INT16_MAX ? INT16_MAX : out <= INT16_MIN ? INT16_MIN : (int16_t)lrintf(out);
+    }
+
+    *filter = f;
+}
+
+static inline float _high_pass_k(double cutoff, double sample_rate) {
+    const double rc = 1.0 / (2*M_PI*cutoff);
+    return (float)(rc / (rc + 1.0/sample_rate));
+}
+
+static inline float _low_pass_k(double cutoff, double sample_rate) {
+    const double rc = 1.0 / (2*M_PI*cutoff);
+    const double dt = 1.0 / sample_rate;
+    return (float)(dt / (rc + dt));
+}
@@ -0,0 +1,25 @@
+#ifndef OUTPUT_FILTER_H
+#define OUTPUT_FILTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// the first order filters the NES puts its audio through on the way out: two
+// high-passes at 90Hz and 440Hz, then a low-pass at 14kHz.
+// see https://www.nesdev.org/wiki/APU_Mixer
+typedef struct {
+    float   high_pass_90_k;
+    float   high_pass_440_k;
+    float   low_pass_k;
+    float   high_pass_90_in;
+    float   high_pass_90_out;
+    float   high_pass_440_in;
+    float   high_pass_440_out;
+    float   low_pass_out;
+} OutputFilter;
+
+void output_filter_init(OutputFilter* filter, double sample_rate);
+// filters samples in place
+void output_filter_apply(OutputFilter* filter, int16_t* samples, size_t count);
+
+#endif
@@ -0,0 +1,164 @@
+#include "resampler.h"
+
+#include "log.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// kernels sit at the centre of the taps, which reach this far back
+#define RESAMPLER_HALF (RESAMPLER_TAPS/2 - 1)
+// where the passband ends, as a fraction of the lower of the two nyquist rates
+#define RESAMPLER_CUTOFF 0.85
+
+static inline float _dot(const float* x, const float* kernel);
+
+int resampler_init(Resampler* resampler, double in_rate, double out_rate) {
+    if (in_rate <= 0 || out_rate <= 0) {
+        log_error("invalid resampler rates %.1fHz -> %.1fHz", in_rate, out_rate);
+        return 0;
+    }
+
+    resampler->nominal_step = in_rate / out_rate;
+    resampler->step         = resampler->nominal_step;
+
+    // blackman windowed sinc, cut off below whichever nyquist rate is lower so
+    // downsampling doesn't alias
+    const double cutoff = 0.5 * RESAMPLER_CUTOFF * (out_rate < in_rate ? out_rate / in_rate : 1.0);
+    const double half   = RESAMPLER_TAPS / 2.0;
+    for (size_t p = 0; p <= RESAMPLER_PHASES; ++p) {
+        float* kernel = resampler->kernels[p];
+
+        double sum = 0;
+        for (size_t k = 0; k < RESAMPLER_TAPS; ++k) {
+            const double x      = (double)k - RESAMPLER_HALF - (double)p / RESAMPLER_PHASES;
+            const double sinc   = x == 0 ? 2*cutoff : sin(2*M_PI*cutoff*x) / (M_PI*x);
+            const double window = fabs(x) >= half ? 0 : 0.42 + 0.5*cos(M_PI*x/half) + 0.08*cos(2*M_PI*x/half);
+
+            kernel[k]   = (float)(sinc * window);
+            sum        += kernel[k];
+        }
+
+        // unity gain at dc for every phase, so nothing wobbles between them
+        for (size_t k = 0; k < RESAMPLER_TAPS; ++k)
+            kernel[k] = (float)(kernel[k] / sum);
+    }
+
+    resampler_clear(resampler);
+    return 1;
+}
+
+void resampler_clear(Resampler* resampler) {
+    // start with enough silence behind the first sample to centre on it
+    memset(resampler->buffer, 0, sizeof(resampler->buffer));
+    resampler->buffered = RESAMPLER_HALF;
+    resampler->pos      = RESAMPLER_HALF;
+}
+
+void resampler_set_ratio(Resampler* resampler, double ratio) {
+    if (ratio <= 0) {
+        log_error("invalid resampler ratio %f", ratio);
+        return;
+    }
+
+    resampler->step = resampler->nominal_step / ratio;
+}
+
+size_t resampler_get_max_output(const Resampler* resampler, size_t count) {
+    return (size_t)((count + RESAMPLER_TAPS) / resampler->step) + 1;
+}
+
+size_t resampler_process(Resampler* resampler, const int16_t* in, size_t count, int16_t* out) {
+    size_t written = 0;
+    while (count > 0) {
+        const size_t space  = RESAMPLER_BUFFER_SIZE - resampler->buffered;
+        const size_t n      = count < space ? count : space;
+        for (size_t i = 0; i < n; ++i)
+            resampler->buffer[resampler->buffered + i] = in[i];
+
+        resampler->buffered += n;
+        in                  += n;
+        count               -= n;
+
+        // every output whose taps are all in the buffer
+        for (;;) {
+            const size_t idx    = (size_t)resampler->pos;
+            const float* x      = resampler->buffer + idx - RESAMPLER_HALF;
+            if (idx - RESAMPLER_HALF + RESAMPLER_TAPS > resampler->buffered)
+                break;
+
+            const double phase  = (resampler->pos - idx) * RESAMPLER_PHASES;
+            const size_t p      = (size_t)phase;
+            const float t       = (float)(phase - p);
+            const float a       = _dot(x, resampler->kernels[p]);
+            const float b       = _dot(x, resampler->kernels[p + 1]);
+
+            const float y = a + (b - a)*t;
+            out[written++] = y >= INT16_MAX ? INT16_MAX : y <= INT16_MIN ? INT16_MIN : (int16_t)lrintf(y);
+
+            resampler->pos += resampler->step;
+        }
+
+        // drop whatever input the next output no longer reaches
+        size_t drop = (size_t)resampler->pos - RESAMPLER_HALF;
+        if (drop > resampler->buffered)
+            drop = resampler->buffered;
+
+        memmove(resampler->buffer, resampler->buffer + drop, (resampler->buffered - drop) * sizeof(*resampler->buffer));
+        resampler->buffered -= drop;
+        resampler->pos      -= drop;
+    }
+
+    return written;
+}
+
+// kernels are aligned, the input isn't
+static inline float _dot(const float* x, const float* kernel) {
+#if defined(__AVX__)
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < RESAMPLER_TAPS; i += 8)
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_load_ps(kernel + i)));
+
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+    return _mm_cvtss_f32(half);
+#elif defined(__SSE__)
+    __m128 sum = _mm_setzero_ps();
+    for (size_t i = 0; i < RESAMPLER_TAPS; i += 4)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_load_ps(kernel + i)));
+
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#elif defined(__ARM_NEON)
+    float32x4_t sum = vdupq_n_f32(0);
+    for (size_t i = 0; i < RESAMPLER_TAPS; i += 4)
+        sum = vmlaq_f32(sum, vld1q_f32(x + i), vld1q_f32(kernel + i));
+
+#if defined(__aarch64__)
+    return vaddvq_f32(sum);
+#else
+    const float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+#else
+    // four running sums, so the compiler can keep them in flight at once
+    float sums[4] = { 0 };
+    for (size_t i = 0; i < RESAMPLER_TAPS; i += 4) {
+        sums[0] += x[i+0] * kernel[i+0];
+        sums[1] += x[i+1] * kernel[i+1];
+        sums[2] += x[i+2] * kernel[i+2];
+        sums[3] += x[i+3] * kernel[i+3];
+    }
+
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+#endif
+}
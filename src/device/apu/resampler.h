@@ -0,0 +1,38 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// taps per output sample, a multiple of 8 so the simd kernels need no tail
+#define RESAMPLER_TAPS 48
+#define RESAMPLER_PHASES 64
+#define RESAMPLER_BUFFER_SIZE 4096
+
+// polyphase fir resampler, for taking the apu's output to whatever rate the
+// host plays at. each output sample is a windowed sinc over the input around
+// it, interpolated between the two nearest of RESAMPLER_PHASES precomputed
+// kernels, so the ratio between the rates can be any fraction and can change
+// from one call to the next, eg. for rate control
+typedef struct {
+    _Alignas(32) float  kernels[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];
+    _Alignas(32) float  buffer[RESAMPLER_BUFFER_SIZE];
+    size_t              buffered;
+    double              pos;            // where the next output lands in buffer
+    double              step;           // input samples per output sample
+    double              nominal_step;
+} Resampler;
+
+int resampler_init(Resampler* resampler, double in_rate, double out_rate);
+void resampler_clear(Resampler* resampler);
+// scales the output rate, eg. by a little either side of 1 for rate control
+void resampler_set_ratio(Resampler* resampler, double ratio);
+
+// most samples resampler_process can write for count input samples
+size_t resampler_get_max_output(const Resampler* resampler, size_t count);
+// takes all count input samples, writing the output samples they complete to
+// out, which must have room for resampler_get_max_output(count). returns how
+// many were written
+size_t resampler_process(Resampler* resampler, const int16_t* in, size_t count, int16_t* out);
+
+#endif
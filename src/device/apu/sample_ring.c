@@ -0,0 +1,49 @@
+#include "sample_ring.h"
+
+#include <string.h>
+
+#define SAMPLE_RING_MASK (SAMPLE_RING_SIZE - 1)
+
+void sample_ring_clear(SampleRing* ring) {
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+}
+
+size_t sample_ring_write(SampleRing* ring, const int16_t* samples, size_t count) {
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    const size_t space = SAMPLE_RING_SIZE - (head - tail);
+    if (count > space)
+        count = space;
+
+    // the indices only ever count up, so the copy may wrap around the end
+    const size_t start  = head & SAMPLE_RING_MASK;
+    const size_t first  = count < SAMPLE_RING_SIZE - start ? count : SAMPLE_RING_SIZE - start;
+    memcpy(ring->samples + start, samples, first * sizeof(*samples));
+    memcpy(ring->samples, samples + first, (count - first) * sizeof(*samples));
+
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    return count;
+}
+
+size_t sample_ring_read(SampleRing* ring, int16_t* out, size_t max) {
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    size_t count = head - tail;
+    if (count > max)
+        count = max;
+
+    const size_t start  = tail & SAMPLE_RING_MASK;
+    const size_t first  = count < SAMPLE_RING_SIZE - start ? count : SAMPLE_RING_SIZE - start;
+    memcpy(out, ring->samples + start, first * sizeof(*out));
+    memcpy(out + first, ring->samples, (count - first) * sizeof(*out));
+
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    return count;
+}
+
+size_t sample_ring_get_count(SampleRing* ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
@@ -0,0 +1,28 @@
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// must be a power of 2
+#define SAMPLE_RING_SIZE 16384
+
+// lock-free queue of samples from one producer thread to one consumer thread,
+// eg. from the apu to an audio callback
+typedef struct {
+    int16_t         samples[SAMPLE_RING_SIZE];
+    atomic_size_t   head;   // written by the producer
+    atomic_size_t   tail;   // written by the consumer
+} SampleRing;
+
+void sample_ring_clear(SampleRing* ring);
+
+// producer: queues up to count samples, returning how many fit
+size_t sample_ring_write(SampleRing* ring, const int16_t* samples, size_t count);
+
+// consumer: dequeues up to max samples into out, returning how many
+size_t sample_ring_read(SampleRing* ring, int16_t* out, size_t max);
+size_t sample_ring_get_count(SampleRing* ring);
+
+#endif
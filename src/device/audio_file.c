@@ -0,0 +1,216 @@
+#include "audio_file.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+#define AUDIO_FILE_BLOCK_SAMPLES 16384
+#define AUDIO_FILE_BLOCK_COUNT 8
+#define WAV_HEADER_SIZE 44
+
+struct AudioFile {
+    FILE*               file;
+    AudioFileFormat     format;
+    uint32_t            sample_rate;
+    uint64_t            data_size;  // bytes written after the header
+
+    // blocks go round in a ring. the caller fills the one at head, and the
+    // writer empties full ones from tail
+    int16_t             blocks[AUDIO_FILE_BLOCK_COUNT][AUDIO_FILE_BLOCK_SAMPLES];
+    size_t              block_sizes[AUDIO_FILE_BLOCK_COUNT];
+    size_t              head;
+    size_t              tail;
+    size_t              full;       // blocks handed to the writer and not yet written
+    int                 closing;
+    int                 failed;
+
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+};
+
+static void* _writer(void* arg);
+static inline void _submit_block(AudioFile* file);
+static inline int _write_block(AudioFile* file, const int16_t* samples, size_t count);
+static inline int _write_wav_header(AudioFile* file);
+static inline void _put_le(uint8_t* out, uint32_t value, size_t size);
+
+AudioFile* audio_file_open(const char* path, AudioFileFormat format, uint32_t sample_rate) {
+    if (sample_rate == 0) {
+        log_error("audio file sample rate can't be 0");
+        return NULL;
+    }
+
+    AudioFile* file = calloc(1, sizeof(*file));
+    if (file == NULL) {
+        log_error("failed to allocate audio file");
+        return NULL;
+    }
+
+    file->file = fopen(path, "wb");
+    if (file->file == NULL) {
+        log_error("failed to open '%s' for audio output: %s", path, strerror(errno));
+        free(file);
+        return NULL;
+    }
+
+    file->format        = format;
+    file->sample_rate   = sample_rate;
+
+    // the sizes are filled in on close
+    if (format == kAUDIO_FILE_FORMAT_WAV && ! _write_wav_header(file)) {
+        fclose(file->file);
+        free(file);
+        return NULL;
+    }
+
+    pthread_mutex_init(&file->lock, NULL);
+    pthread_cond_init(&file->cond, NULL);
+    if (pthread_create(&file->thread, NULL, _writer, file) != 0) {
+        log_error("failed to start audio file writer");
+        pthread_cond_destroy(&file->cond);
+        pthread_mutex_destroy(&file->lock);
+        fclose(file->file);
+        free(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+int audio_file_close(AudioFile* file) {
+    if (file->block_sizes[file->head] > 0)
+        _submit_block(file);
+
+    pthread_mutex_lock(&file->lock);
+    file->closing = 1;
+    pthread_cond_broadcast(&file->cond);
+    pthread_mutex_unlock(&file->lock);
+    pthread_join(file->thread, NULL);
+
+    int success = ! file->failed;
+    if (success && file->format == kAUDIO_FILE_FORMAT_WAV)
+        success = fseek(file->file, 0, SEEK_SET) == 0 && _write_wav_header(file);
+    if (fclose(file->file) != 0)
+        success = 0;
+
+    if (! success)
+        log_error("failed to write audio output");
+
+    pthread_cond_destroy(&file->cond);
+    pthread_mutex_destroy(&file->lock);
+    free(file);
+
+    return success;
+}
+
+void audio_file_write(AudioFile* file, const int16_t* samples, size_t count) {
+    while (count > 0) {
+        size_t* size    = &file->block_sizes[file->head];
+        const size_t n  = AUDIO_FILE_BLOCK_SAMPLES - *size < count ? AUDIO_FILE_BLOCK_SAMPLES - *size : count;
+        memcpy(file->blocks[file->head] + *size, samples, n * sizeof(*samples));
+
+        *size   += n;
+        samples += n;
+        count   -= n;
+
+        if (*size == AUDIO_FILE_BLOCK_SAMPLES)
+            _submit_block(file);
+    }
+}
+
+static void* _writer(void* arg) {
+    AudioFile* file = arg;
+
+    pthread_mutex_lock(&file->lock);
+    for (;;) {
+        while (file->full == 0 && ! file->closing)
+            pthread_cond_wait(&file->cond, &file->lock);
+        if (file->full == 0)
+            break;
+
+        // the block is ours until it's handed back, so the disk is written
+        // without holding the lock
+        const size_t idx = file->tail;
+        pthread_mutex_unlock(&file->lock);
+
+        const int success = _write_block(file, file->blocks[idx], file->block_sizes[idx]);
+
+        pthread_mutex_lock(&file->lock);
+        file->failed           |= ! success;
+        file->block_sizes[idx]  = 0;
+        file->tail              = (idx + 1) % AUDIO_FILE_BLOCK_COUNT;
+        --file->full;
+        pthread_cond_broadcast(&file->cond);
+    }
+    pthread_mutex_unlock(&file->lock);
+
+    return NULL;
+}
+
+// hands the block at head to the writer. only waits if every other block is
+// still queued, rather than dropping samples
+static inline void _submit_block(AudioFile* file) {
+    pthread_mutex_lock(&file->lock);
+    ++file->full;
+    file->head = (file->head + 1) % AUDIO_FILE_BLOCK_COUNT;
+    pthread_cond_broadcast(&file->cond);
+
+    while (file->full == AUDIO_FILE_BLOCK_COUNT)
+        pthread_cond_wait(&file->cond, &file->lock);
+    pthread_mutex_unlock(&file->lock);
+}
+
+static inline int _write_block(AudioFile* file, const int16_t* samples, size_t count) {
+    uint8_t out[AUDIO_FILE_BLOCK_SAMPLES * sizeof(float)];
+    size_t sample_size;
+
+    // files are always little endian, whatever the host is
+    if (file->format == kAUDIO_FILE_FORMAT_RAW_F32) {
+        sample_size = sizeof(float);
+        for (size_t i = 0; i < count; ++i) {
+            const float value = samples[i] / 32768.0f;
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            _put_le(out + i*sample_size, bits, sample_size);
+        }
+    } else {
+        sample_size = sizeof(int16_t);
+        for (size_t i = 0; i < count; ++i)
+            _put_le(out + i*sample_size, (uint16_t)samples[i], sample_size);
+    }
+
+    const size_t size   = count * sample_size;
+    file->data_size    += size;
+
+    return fwrite(out, 1, size, file->file) == size;
+}
+
+static inline int _write_wav_header(AudioFile* file) {
+    // a wav file can't say it holds more than 4GB, so longer ones just claim the most it can
+    const uint32_t data_size = file->data_size > UINT32_MAX - WAV_HEADER_SIZE ? UINT32_MAX - WAV_HEADER_SIZE : (uint32_t)file->data_size;
+
+    uint8_t header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    _put_le(header + 4,     WAV_HEADER_SIZE - 8 + data_size, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    _put_le(header + 16,    16, 4);                         // fmt chunk size
+    _put_le(header + 20,    1, 2);                          // PCM
+    _put_le(header + 22,    1, 2);                          // channels
+    _put_le(header + 24,    file->sample_rate, 4);
+    _put_le(header + 28,    file->sample_rate * 2, 4);      // bytes per second
+    _put_le(header + 32,    2, 2);                          // bytes per frame
+    _put_le(header + 34,    16, 2);                         // bits per sample
+    memcpy(header + 36, "data", 4);
+    _put_le(header + 40,    data_size, 4);
+
+    return fwrite(header, 1, sizeof(header), file->file) == sizeof(header);
+}
+
+static inline void _put_le(uint8_t* out, uint32_t value, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        out[i] = (uint8_t)(value >> (8*i));
+}
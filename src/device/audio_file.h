@@ -0,0 +1,25 @@
+#ifndef AUDIO_FILE_H
+#define AUDIO_FILE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef enum {
+    kAUDIO_FILE_FORMAT_WAV = 0, // signed 16 bit mono PCM
+    kAUDIO_FILE_FORMAT_RAW_S16, // signed 16 bit mono, no header
+    kAUDIO_FILE_FORMAT_RAW_F32, // 32 bit float mono in [-1, 1), no header
+} AudioFileFormat;
+
+// writes mono samples out to a file. samples are gathered into blocks, which a
+// background thread converts and writes, so the caller never waits on the disk
+// unless it gets a whole queue of blocks ahead of it
+typedef struct AudioFile AudioFile;
+
+AudioFile* audio_file_open(const char* path, AudioFileFormat format, uint32_t sample_rate);
+// writes out everything queued, finishes the header and frees the file.
+// returns 0 if anything failed to write
+int audio_file_close(AudioFile* file);
+
+void audio_file_write(AudioFile* file, const int16_t* samples, size_t count);
+
+#endif
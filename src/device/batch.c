@@ -0,0 +1,424 @@
+#include "batch.h"
+
+#include "device.h"
+#include "savestate.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// consoles are handed out to workers a few at a time, so a slow console only
+// holds up the ones in its own chunk
+#define CHUNKS_PER_THREAD 4
+#define BYTES_PER_PIXEL 4
+
+// console state is split into pages shared between forks, and a page is only
+// copied once a console's state differs from it. small enough that a frame
+// only dirties a few, big enough that the page table stays small
+#define STATE_PAGE_SIZE 256
+
+typedef struct {
+    atomic_size_t   refs;
+    uint8_t         data[];
+} StatePage;
+
+// PRG RAM as it was when the console was created, which it powers on with
+// until it's been stepped. never written, so shared outright between forks
+typedef struct {
+    atomic_size_t   refs;
+    size_t          size;
+    uint8_t         data[];
+} InitialPRGRAM;
+
+struct BatchConsole {
+    const Cart*     cart;               // borrowed, only the rom is used
+    InitialPRGRAM*  initial_prg_ram;
+    StatePage**     pages;
+    size_t          page_count;
+    size_t          state_size;
+    int             has_state;
+    int             power_on_pending;
+};
+
+// a worker's machine, which consoles are swapped in and out of
+typedef struct {
+    Cart            cart;
+    uint8_t*        prg_ram;
+    size_t          prg_ram_capacity;
+    uint8_t*        state;
+    size_t          state_capacity;
+} BatchWorker;
+
+struct Batch {
+    pthread_t*          threads;
+    size_t              thread_count;
+
+    pthread_mutex_t     mutex;
+    pthread_cond_t      start_cond;
+    pthread_cond_t      done_cond;
+    uint64_t            generation;     // bumped to start a step
+    size_t              busy;           // workers yet to finish the step
+    int                 quit;
+
+    // the current step
+    BatchConsole**      consoles;
+    const InputFlags*   inputs;
+    size_t              count;
+    uint8_t*            frames;
+    BatchFrameOptions   options;
+    size_t              frame_size;
+    size_t              chunk_size;
+    atomic_size_t       next;
+    atomic_int          failed;
+};
+
+static void* _worker_main(void* arg);
+static inline int _step_console(Batch* batch, BatchWorker* worker, size_t idx);
+static inline void _gather_state(const BatchConsole* console, uint8_t* out);
+static inline void _scatter_state(BatchConsole* console, const uint8_t* in);
+static inline StatePage* _new_page(const uint8_t* data, size_t size);
+static inline void _release_page(StatePage* page);
+static inline void _write_frame(uint8_t* out, const BatchFrameOptions* options);
+
+size_t batch_get_frame_size(const BatchFrameOptions* options) {
+    const uint8_t step = options->downsample;
+    if (step != 1 && step != 2 && step != 4)
+        return 0;
+
+    const size_t pixels = (VIDEO_BUFFER_WIDTH / step) * (VIDEO_BUFFER_HEIGHT / step);
+    switch (options->format) {
+        case kBATCHFRAME_RGBA:      return pixels * BYTES_PER_PIXEL;
+        case kBATCHFRAME_GRAYSCALE: return pixels;
+
+        default:
+            return 0;
+    }
+}
+
+BatchConsole* batch_console_create(const Cart* cart) {
+    BatchConsole* console = calloc(1, sizeof(BatchConsole));
+    console->cart               = cart;
+    console->power_on_pending   = 1;
+
+    if (cart->prg_ram != NULL) {
+        console->initial_prg_ram = malloc(sizeof(InitialPRGRAM) + cart->prg_ram_size);
+        console->initial_prg_ram->size = cart->prg_ram_size;
+        atomic_init(&console->initial_prg_ram->refs, 1);
+        memcpy(console->initial_prg_ram->data, cart->prg_ram, cart->prg_ram_size);
+    }
+
+    // only the sizes of the regions are looked at, so borrowing this thread's
+    // machine to work out the state size doesn't disturb it
+    Cart* prev_cart     = g_device.cart;
+    g_device.cart       = (Cart*)cart;
+    console->state_size = savestate_get_size();
+    g_device.cart       = prev_cart;
+
+    console->page_count = (console->state_size + STATE_PAGE_SIZE - 1) / STATE_PAGE_SIZE;
+    console->pages      = calloc(console->page_count, sizeof(console->pages[0]));
+
+    return console;
+}
+
+BatchConsole* batch_console_fork(const BatchConsole* parent) {
+    BatchConsole* console = malloc(sizeof(BatchConsole));
+    *console        = *parent;
+    console->pages  = malloc(sizeof(console->pages[0]) * parent->page_count);
+
+    // everything is shared, and only copied once one side changes it
+    for (size_t i = 0; i < parent->page_count; ++i) {
+        console->pages[i] = parent->pages[i];
+        if (console->pages[i] != NULL)
+            atomic_fetch_add_explicit(&console->pages[i]->refs, 1, memory_order_relaxed);
+    }
+
+    if (console->initial_prg_ram != NULL)
+        atomic_fetch_add_explicit(&console->initial_prg_ram->refs, 1, memory_order_relaxed);
+
+    return console;
+}
+
+void batch_console_destroy(BatchConsole* console) {
+    if (console == NULL)
+        return;
+
+    for (size_t i = 0; i < console->page_count; ++i)
+        _release_page(console->pages[i]);
+
+    InitialPRGRAM* prg_ram = console->initial_prg_ram;
+    if (prg_ram != NULL && atomic_fetch_sub_explicit(&prg_ram->refs, 1, memory_order_acq_rel) == 1)
+        free(prg_ram);
+
+    free(console->pages);
+    free(console);
+}
+
+void batch_console_power_on(BatchConsole* console) {
+    console->power_on_pending = 1;
+}
+
+size_t batch_console_get_state_size(const BatchConsole* console) {
+    return console->state_size;
+}
+
+int batch_console_get_state(const BatchConsole* console, uint8_t* out, size_t size) {
+    if (! console->has_state || size != console->state_size)
+        return 0;
+
+    _gather_state(console, out);
+    return 1;
+}
+
+Batch* batch_create(size_t thread_count) {
+    if (thread_count == 0) {
+        log_error("failed to create batch (needs at least one thread)");
+        return NULL;
+    }
+
+    Batch* batch = calloc(1, sizeof(Batch));
+    batch->threads = malloc(sizeof(batch->threads[0]) * thread_count);
+
+    pthread_mutex_init(&batch->mutex, NULL);
+    pthread_cond_init(&batch->start_cond, NULL);
+    pthread_cond_init(&batch->done_cond, NULL);
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        if (pthread_create(&batch->threads[i], NULL, _worker_main, batch) != 0) {
+            log_error("failed to start batch worker %zu", i);
+            break;
+        }
+
+        ++batch->thread_count;
+    }
+
+    if (batch->thread_count == 0) {
+        batch_destroy(batch);
+        return NULL;
+    }
+
+    return batch;
+}
+
+void batch_destroy(Batch* batch) {
+    if (batch == NULL)
+        return;
+
+    pthread_mutex_lock(&batch->mutex);
+    batch->quit = 1;
+    pthread_cond_broadcast(&batch->start_cond);
+    pthread_mutex_unlock(&batch->mutex);
+
+    for (size_t i = 0; i < batch->thread_count; ++i)
+        pthread_join(batch->threads[i], NULL);
+
+    pthread_cond_destroy(&batch->done_cond);
+    pthread_cond_destroy(&batch->start_cond);
+    pthread_mutex_destroy(&batch->mutex);
+
+    free(batch->threads);
+    free(batch);
+}
+
+int batch_step(Batch* batch, BatchConsole** consoles, const InputFlags* inputs, size_t count, uint8_t* frames, const BatchFrameOptions* options) {
+    const int wants_frames  = options->format != kBATCHFRAME_NONE;
+    const size_t frame_size = wants_frames ? batch_get_frame_size(options) : 0;
+    if (wants_frames && (frame_size == 0 || frames == NULL)) {
+        log_error("failed to step batch (invalid frame options)");
+        return 0;
+    }
+
+    if (count == 0)
+        return 1;
+
+    const size_t chunk_size = count / (batch->thread_count * CHUNKS_PER_THREAD);
+
+    pthread_mutex_lock(&batch->mutex);
+
+    batch->consoles     = consoles;
+    batch->inputs       = inputs;
+    batch->count        = count;
+    batch->frames       = frames;
+    batch->options      = *options;
+    batch->frame_size   = frame_size;
+    batch->chunk_size   = chunk_size > 0 ? chunk_size : 1;
+    atomic_store(&batch->next, 0);
+    atomic_store(&batch->failed, 0);
+
+    ++batch->generation;
+    batch->busy = batch->thread_count;
+    pthread_cond_broadcast(&batch->start_cond);
+
+    while (batch->busy > 0)
+        pthread_cond_wait(&batch->done_cond, &batch->mutex);
+
+    pthread_mutex_unlock(&batch->mutex);
+
+    return ! atomic_load(&batch->failed);
+}
+
+static void* _worker_main(void* arg) {
+    Batch* batch = (Batch*)arg;
+
+    // every thread has a machine of its own to swap consoles into
+    device_init();
+    BatchWorker worker = { 0 };
+
+    uint64_t generation = 0;
+    pthread_mutex_lock(&batch->mutex);
+    for (;;) {
+        while (batch->generation == generation && ! batch->quit)
+            pthread_cond_wait(&batch->start_cond, &batch->mutex);
+
+        if (batch->quit)
+            break;
+
+        generation = batch->generation;
+        pthread_mutex_unlock(&batch->mutex);
+
+        size_t start;
+        while ((start = atomic_fetch_add_explicit(&batch->next, batch->chunk_size, memory_order_relaxed)) < batch->count) {
+            const size_t end = start + batch->chunk_size < batch->count ? start + batch->chunk_size : batch->count;
+            for (size_t i = start; i < end; ++i) {
+                if (! _step_console(batch, &worker, i))
+                    atomic_store(&batch->failed, 1);
+            }
+        }
+
+        pthread_mutex_lock(&batch->mutex);
+        if (--batch->busy == 0)
+            pthread_cond_signal(&batch->done_cond);
+    }
+    pthread_mutex_unlock(&batch->mutex);
+
+    free(worker.prg_ram);
+    free(worker.state);
+
+    return NULL;
+}
+
+static inline int _step_console(Batch* batch, BatchWorker* worker, size_t idx) {
+    BatchConsole* console   = batch->consoles[idx];
+    const size_t state_size = console->state_size;
+
+    // the rom is the console's, the PRG RAM is the worker's own scratch
+    const size_t prg_ram_size = console->cart->prg_ram_size;
+    if (prg_ram_size > worker->prg_ram_capacity) {
+        worker->prg_ram             = realloc(worker->prg_ram, prg_ram_size);
+        worker->prg_ram_capacity    = prg_ram_size;
+    }
+    if (state_size > worker->state_capacity) {
+        worker->state           = realloc(worker->state, state_size);
+        worker->state_capacity  = state_size;
+    }
+
+    worker->cart = *console->cart;
+    if (worker->cart.prg_ram != NULL)
+        worker->cart.prg_ram = worker->prg_ram;
+
+    int success     = 0;
+    g_device.cart   = &worker->cart;
+    if (console->has_state) {
+        _gather_state(console, worker->state);
+        if (! savestate_read(worker->state, state_size)) {
+            log_error("failed to restore batch console %zu", idx);
+            goto bail;
+        }
+    } else if (console->initial_prg_ram != NULL) {
+        memcpy(worker->cart.prg_ram, console->initial_prg_ram->data, prg_ram_size);
+    }
+
+    // PRG RAM survives a power cycle, so it's restored either way
+    if (console->power_on_pending) {
+        device_power_on();
+        console->power_on_pending = 0;
+    }
+
+    device_set_outputs(batch->options.format != kBATCHFRAME_NONE ? kDEVICE_OUTPUT_VIDEO : 0);
+    for (uint8_t port = 0; port < INPUT_PORT_COUNT; ++port)
+        device_set_inputs(port, batch->inputs != NULL ? batch->inputs[idx*INPUT_PORT_COUNT + port] : 0);
+
+    device_exec_frame();
+
+    if (! savestate_write(worker->state, state_size)) {
+        log_error("failed to save batch console %zu", idx);
+        goto bail;
+    }
+
+    _scatter_state(console, worker->state);
+    console->has_state = 1;
+
+    if (batch->options.format != kBATCHFRAME_NONE)
+        _write_frame(batch->frames + idx*batch->frame_size, &batch->options);
+
+    success = 1;
+
+bail:
+    g_device.cart = NULL;
+    return success;
+}
+
+static inline void _gather_state(const BatchConsole* console, uint8_t* out) {
+    for (size_t i = 0; i < console->page_count; ++i) {
+        const size_t offset = i*STATE_PAGE_SIZE;
+        const size_t size   = console->state_size - offset < STATE_PAGE_SIZE ? console->state_size - offset : STATE_PAGE_SIZE;
+        memcpy(out + offset, console->pages[i]->data, size);
+    }
+}
+
+static inline void _scatter_state(BatchConsole* console, const uint8_t* in) {
+    for (size_t i = 0; i < console->page_count; ++i) {
+        const size_t offset = i*STATE_PAGE_SIZE;
+        const size_t size   = console->state_size - offset < STATE_PAGE_SIZE ? console->state_size - offset : STATE_PAGE_SIZE;
+
+        StatePage* page = console->pages[i];
+        if (page != NULL && memcmp(page->data, in + offset, size) == 0)
+            continue;
+
+        // a page only this console holds can be written in place, otherwise
+        // the others keep the old one and this console gets a copy
+        if (page != NULL && atomic_load_explicit(&page->refs, memory_order_acquire) == 1) {
+            memcpy(page->data, in + offset, size);
+            continue;
+        }
+
+        console->pages[i] = _new_page(in + offset, size);
+        _release_page(page);
+    }
+}
+
+static inline StatePage* _new_page(const uint8_t* data, size_t size) {
+    StatePage* page = malloc(sizeof(StatePage) + STATE_PAGE_SIZE);
+    atomic_init(&page->refs, 1);
+    memcpy(page->data, data, size);
+
+    return page;
+}
+
+static inline void _release_page(StatePage* page) {
+    if (page != NULL && atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) == 1)
+        free(page);
+}
+
+static inline void _write_frame(uint8_t* out, const BatchFrameOptions* options) {
+    const uint8_t* pixels = (const uint8_t*)device_get_frame(NULL);
+    const uint8_t step    = options->downsample;
+
+    if (options->format == kBATCHFRAME_RGBA && step == 1) {
+        memcpy(out, pixels, VIDEO_BUFFER_WIDTH*VIDEO_BUFFER_HEIGHT*BYTES_PER_PIXEL);
+        return;
+    }
+
+    for (size_t y = 0; y < VIDEO_BUFFER_HEIGHT; y += step) {
+        for (size_t x = 0; x < VIDEO_BUFFER_WIDTH; x += step) {
+            const uint8_t* pixel = pixels + (y*VIDEO_BUFFER_WIDTH + x)*BYTES_PER_PIXEL;
+            if (options->format == kBATCHFRAME_RGBA) {
+                memcpy(out, pixel, BYTES_PER_PIXEL);
+                out += BYTES_PER_PIXEL;
+            } else {
+                // BT.601 luma in 8 bit fixed point
+                *out++ = (pixel[0]*77 + pixel[1]*150 + pixel[2]*29) >> 8;
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "cart/cart.h"
+#include "input.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// steps many consoles a frame at a time across a pool of threads, eg. for
+// training agents. each console is a save state, swapped into a worker's
+// (thread local) machine for the length of a step. other than copying the
+// pages forks share, nothing is allocated once the pool and consoles have
+// been created
+typedef struct BatchConsole BatchConsole;
+typedef struct Batch Batch;
+
+typedef enum {
+    kBATCHFRAME_NONE = 0,   // no frames, and video output is switched off
+    kBATCHFRAME_RGBA,       // 4 bytes per pixel, as the ppu outputs them
+    kBATCHFRAME_GRAYSCALE,  // 1 byte per pixel
+} BatchFrameFormat;
+
+typedef struct {
+    BatchFrameFormat    format;
+    uint8_t             downsample; // keeps every nth pixel in each direction. 1, 2 or 4
+} BatchFrameOptions;
+
+// size in bytes of one console's frame, 0 if the options are invalid
+size_t batch_get_frame_size(const BatchFrameOptions* options);
+
+// the cart's rom is shared, so it must outlive the console. PRG RAM starts as
+// a copy of the cart's
+BatchConsole* batch_console_create(const Cart* cart);
+// clones the console as of its last step, eg. for tree search. the state is
+// shared copy-on-write in small pages, so a fork costs about as much as
+// copying a page table, and each side only copies the pages it changes after.
+// must not be called while either console is being stepped
+BatchConsole* batch_console_fork(const BatchConsole* parent);
+void batch_console_destroy(BatchConsole* console);
+// power cycles the console at the start of its next step, eg. for a new
+// episode. consoles start powered off, and are powered on by their first step
+void batch_console_power_on(BatchConsole* console);
+
+// the console's machine state as of its last step, in save state format.
+// returns 0 if it hasn't been stepped yet
+size_t batch_console_get_state_size(const BatchConsole* console);
+int batch_console_get_state(const BatchConsole* console, uint8_t* out, size_t size);
+
+Batch* batch_create(size_t thread_count);
+void batch_destroy(Batch* batch);
+
+// steps each console one frame with its inputs, laid out as
+// inputs[i*INPUT_PORT_COUNT + port], or NULL for no input. frames are
+// written as one contiguous block of count*batch_get_frame_size() bytes, and
+// may be NULL with kBATCHFRAME_NONE. a console must appear at most once per
+// call. returns 0 if any console failed to step
+int batch_step(Batch* batch, BatchConsole** consoles, const InputFlags* inputs, size_t count, uint8_t* frames, const BatchFrameOptions* options);
+
+#endif
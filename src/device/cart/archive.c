@@ -0,0 +1,321 @@
+#include "archive.h"
+
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#include "log.h"
+
+// format references:
+// gzip: https://www.rfc-editor.org/rfc/rfc1952
+// zip: https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+#define GZIP_MIN_SIZE                   18
+
+#define ZIP_LOCAL_HEADER_SIG            0x04034B50
+#define ZIP_LOCAL_HEADER_SIZE           30
+#define ZIP_CENTRAL_HEADER_SIG          0x02014B50
+#define ZIP_CENTRAL_HEADER_SIZE         46
+#define ZIP_EOCD_SIG                    0x06054B50
+#define ZIP_EOCD_SIZE                   22
+#define ZIP_MAX_COMMENT_SIZE            0xFFFF
+#define ZIP_SIZE_ZIP64                  0xFFFFFFFF
+
+#define ZIP_METHOD_STORED               0
+#define ZIP_METHOD_DEFLATE              8
+
+#define ROM_FILE_EXT                    ".nes"
+
+typedef struct {
+    uint16_t        method;
+    uint32_t        crc;
+    uint32_t        compressed_size;
+    uint32_t        uncompressed_size;
+    uint32_t        local_header_offset;
+    const char*     name;
+    uint16_t        name_len;
+} ZipEntry;
+
+static inline int _gzip_get_rom_size(const uint8_t* data, size_t size, size_t* out_size);
+static inline int _gzip_extract_rom(const uint8_t* data, size_t size, uint8_t* out, size_t out_size);
+static inline int _zip_get_rom_size(const uint8_t* data, size_t size, size_t* out_size);
+static inline int _zip_extract_rom(const uint8_t* data, size_t size, uint8_t* out, size_t out_size);
+static inline int _inflate(const uint8_t* in, size_t in_size, int window_bits, uint8_t* out, size_t out_size);
+static inline int _find_zip_entry(const uint8_t* data, size_t size, ZipEntry* entry);
+static inline int _has_rom_ext(const char* name, size_t len);
+static inline uint16_t _read_le16(const uint8_t* p);
+static inline uint32_t _read_le32(const uint8_t* p);
+
+ArchiveType archive_get_type(const uint8_t* magic, size_t size) {
+    if (size >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+        return kARCHIVETYPE_GZIP;
+    if (size >= 4 && _read_le32(magic) == ZIP_LOCAL_HEADER_SIG)
+        return kARCHIVETYPE_ZIP;
+
+    return kARCHIVETYPE_NONE;
+}
+
+int archive_load(ArchiveType type, const uint8_t* data, size_t size, uint8_t** out, size_t* out_size) {
+    size_t rom_size;
+    if (! archive_get_rom_size(type, data, size, &rom_size))
+        return 0;
+
+    uint8_t* buffer = malloc(rom_size);
+    if (buffer == NULL) {
+        log_error("failed to allocate %zu bytes for the rom", rom_size);
+        return 0;
+    }
+
+    if (! archive_extract_rom(type, data, size, buffer, rom_size)) {
+        free(buffer);
+        return 0;
+    }
+
+    *out        = buffer;
+    *out_size   = rom_size;
+
+    return 1;
+}
+
+int archive_get_rom_size(ArchiveType type, const uint8_t* data, size_t size, size_t* out_size) {
+    int success;
+    switch (type) {
+        case kARCHIVETYPE_GZIP: success = _gzip_get_rom_size(data, size, out_size); break;
+        case kARCHIVETYPE_ZIP:  success = _zip_get_rom_size(data, size, out_size);  break;
+
+        default:
+            log_error("unknown archive type '%d'", type);
+            return 0;
+    }
+
+    if (success && *out_size > ARCHIVE_MAX_ROM_SIZE) {
+        log_error("failed to load archive (rom claims to be %zu bytes, over the %d byte limit)", *out_size, ARCHIVE_MAX_ROM_SIZE);
+        return 0;
+    }
+
+    return success;
+}
+
+int archive_extract_rom(ArchiveType type, const uint8_t* data, size_t size, uint8_t* out, size_t out_size) {
+    switch (type) {
+        case kARCHIVETYPE_GZIP: return _gzip_extract_rom(data, size, out, out_size);
+        case kARCHIVETYPE_ZIP:  return _zip_extract_rom(data, size, out, out_size);
+
+        default:
+            log_error("unknown archive type '%d'", type);
+            return 0;
+    }
+}
+
+static inline int _gzip_get_rom_size(const uint8_t* data, size_t size, size_t* out_size) {
+    log_info("ROM is gzip compressed");
+
+    if (size < GZIP_MIN_SIZE) {
+        log_error("failed to load gzip archive (file is too small)");
+        return 0;
+    }
+
+    // ISIZE in the trailer gives us the uncompressed size up front, so the
+    // whole stream can inflate into a single exact allocation
+    const size_t rom_size = _read_le32(data + size - 4);
+    if (rom_size == 0) {
+        log_error("failed to load gzip archive (archive is empty)");
+        return 0;
+    }
+
+    *out_size = rom_size;
+    return 1;
+}
+
+static inline int _gzip_extract_rom(const uint8_t* data, size_t size, uint8_t* out, size_t out_size) {
+    // +16 asks zlib to parse and verify the gzip header and trailer for us
+    return _inflate(data, size, MAX_WBITS + 16, out, out_size);
+}
+
+static inline int _zip_get_rom_size(const uint8_t* data, size_t size, size_t* out_size) {
+    log_info("ROM is zip compressed");
+
+    ZipEntry entry;
+    if (! _find_zip_entry(data, size, &entry))
+        return 0;
+
+    *out_size = entry.uncompressed_size;
+    return 1;
+}
+
+static inline int _zip_extract_rom(const uint8_t* data, size_t size, uint8_t* out, size_t out_size) {
+    ZipEntry entry;
+    if (! _find_zip_entry(data, size, &entry))
+        return 0;
+
+    log_info("loading zip member '%.*s'", entry.name_len, entry.name);
+
+    if (out_size != entry.uncompressed_size) {
+        log_error("failed to load zip archive (buffer size mismatch)");
+        return 0;
+    }
+
+    // the local header can carry a different extra field to the central one
+    const size_t header_offset  = entry.local_header_offset;
+    const uint8_t* header       = data + header_offset;
+    const size_t data_offset    = header_offset + ZIP_LOCAL_HEADER_SIZE + _read_le16(header + 26) + _read_le16(header + 28);
+    if (data_offset > size || entry.compressed_size > size - data_offset) {
+        log_error("failed to load zip archive (member data is out of bounds)");
+        return 0;
+    }
+
+    const uint8_t* member = data + data_offset;
+    switch (entry.method) {
+        case ZIP_METHOD_STORED:
+            if (entry.compressed_size != entry.uncompressed_size) {
+                log_error("failed to load zip archive (stored member size mismatch)");
+                return 0;
+            }
+
+            memcpy(out, member, out_size);
+            break;
+        case ZIP_METHOD_DEFLATE:
+            // negative window bits for a raw deflate stream with no zlib wrapper
+            if (! _inflate(member, entry.compressed_size, -MAX_WBITS, out, out_size))
+                return 0;
+            break;
+
+        default:
+            log_error("failed to load zip archive (unsupported compression method '%u')", entry.method);
+            return 0;
+    }
+
+    if (crc32(0, out, out_size) != entry.crc) {
+        log_error("failed to load zip archive (CRC mismatch)");
+        return 0;
+    }
+
+    return 1;
+}
+
+static inline int _inflate(const uint8_t* in, size_t in_size, int window_bits, uint8_t* out, size_t out_size) {
+    z_stream stream = {
+        .next_in    = (Bytef*)in,
+        .avail_in   = in_size,
+        .next_out   = out,
+        .avail_out  = out_size,
+    };
+
+    if (inflateInit2(&stream, window_bits) != Z_OK) {
+        log_error("failed to init inflate (%s)", stream.msg ? stream.msg : "unknown error");
+        return 0;
+    }
+
+    const int res = inflate(&stream, Z_FINISH);
+    const int success = res == Z_STREAM_END && stream.total_out == out_size;
+    if (! success) {
+        if (res == Z_STREAM_END || res == Z_BUF_ERROR)
+            log_error("failed to inflate (size mismatch)");
+        else
+            log_error("failed to inflate (%s)", stream.msg ? stream.msg : "unknown error");
+    }
+
+    inflateEnd(&stream);
+    return success;
+}
+
+static inline int _find_zip_entry(const uint8_t* data, size_t size, ZipEntry* entry) {
+    if (size < ZIP_EOCD_SIZE) {
+        log_error("failed to load zip archive (file is too small)");
+        return 0;
+    }
+
+    // the end of central directory record sits behind a variable length
+    // comment, so scan backwards for its signature
+    const size_t search_end = size > ZIP_EOCD_SIZE + ZIP_MAX_COMMENT_SIZE ? size - ZIP_EOCD_SIZE - ZIP_MAX_COMMENT_SIZE : 0;
+    const uint8_t* eocd     = NULL;
+    for (size_t i = size - ZIP_EOCD_SIZE + 1; i-- > search_end;) {
+        if (_read_le32(data + i) == ZIP_EOCD_SIG) {
+            eocd = data + i;
+            break;
+        }
+    }
+
+    if (eocd == NULL) {
+        log_error("failed to load zip archive (no central directory)");
+        return 0;
+    }
+
+    const uint16_t entry_count  = _read_le16(eocd + 10);
+    size_t offset               = _read_le32(eocd + 16);
+    int found                   = 0;
+
+    for (uint16_t i = 0; i < entry_count; ++i) {
+        if (offset + ZIP_CENTRAL_HEADER_SIZE > size || _read_le32(data + offset) != ZIP_CENTRAL_HEADER_SIG) {
+            log_error("failed to load zip archive (bad central directory)");
+            return 0;
+        }
+
+        const uint8_t* header   = data + offset;
+        const uint16_t name_len = _read_le16(header + 28);
+        const size_t next       = offset + ZIP_CENTRAL_HEADER_SIZE + name_len + _read_le16(header + 30) + _read_le16(header + 32);
+        if (next > size) {
+            log_error("failed to load zip archive (bad central directory)");
+            return 0;
+        }
+
+        const char* name        = (const char*)header + ZIP_CENTRAL_HEADER_SIZE;
+        const int is_dir        = name_len > 0 && name[name_len-1] == '/';
+        const int is_rom        = _has_rom_ext(name, name_len);
+
+        // prefer a .nes member, but settle for the first file we see
+        if (! is_dir && (is_rom || ! found)) {
+            *entry = (ZipEntry) {
+                .method                 = _read_le16(header + 10),
+                .crc                    = _read_le32(header + 16),
+                .compressed_size        = _read_le32(header + 20),
+                .uncompressed_size      = _read_le32(header + 24),
+                .local_header_offset    = _read_le32(header + 42),
+                .name                   = name,
+                .name_len               = name_len,
+            };
+            found = 1;
+
+            if (is_rom)
+                break;
+        }
+
+        offset = next;
+    }
+
+    if (! found) {
+        log_error("failed to load zip archive (no files in archive)");
+        return 0;
+    }
+
+    if (entry->compressed_size == ZIP_SIZE_ZIP64 || entry->uncompressed_size == ZIP_SIZE_ZIP64) {
+        log_error("failed to load zip archive (zip64 is not supported)");
+        return 0;
+    }
+
+    if (entry->uncompressed_size == 0) {
+        log_error("failed to load zip archive (member is empty)");
+        return 0;
+    }
+
+    const size_t header_offset = entry->local_header_offset;
+    if (header_offset + ZIP_LOCAL_HEADER_SIZE > size || _read_le32(data + header_offset) != ZIP_LOCAL_HEADER_SIG) {
+        log_error("failed to load zip archive (bad local header)");
+        return 0;
+    }
+
+    return 1;
+}
+
+static inline int _has_rom_ext(const char* name, size_t len) {
+    const size_t ext_len = sizeof(ROM_FILE_EXT)-1;
+    return len > ext_len && strncasecmp(name + len - ext_len, ROM_FILE_EXT, ext_len) == 0;
+}
+
+static inline uint16_t _read_le16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t _read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
@@ -0,0 +1,32 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+typedef enum {
+    kARCHIVETYPE_NONE = 0,
+    kARCHIVETYPE_GZIP,
+    kARCHIVETYPE_ZIP,
+} ArchiveType;
+
+#define ARCHIVE_MAGIC_SIZE 4
+// archives only state their uncompressed size, so anything claiming to hold
+// more than this is turned away rather than trusted with an allocation. the
+// largest real carts are a few megabytes
+#define ARCHIVE_MAX_ROM_SIZE (32*1024*1024)
+
+ArchiveType archive_get_type(const uint8_t* magic, size_t size);
+
+// inflates the rom held in the archive straight into a newly allocated buffer
+// of exactly the uncompressed size. for zip archives only the first member
+// with a .nes extension (or the first file, if there is none) is decompressed
+int archive_load(ArchiveType type, const uint8_t* data, size_t size, uint8_t** out, size_t* out_size);
+
+// the two halves of archive_load, for callers which manage their own buffers.
+// sizes over ARCHIVE_MAX_ROM_SIZE are rejected
+int archive_get_rom_size(ArchiveType type, const uint8_t* data, size_t size, size_t* out_size);
+int archive_extract_rom(ArchiveType type, const uint8_t* data, size_t size, uint8_t* out, size_t out_size);
+
+#endif
+
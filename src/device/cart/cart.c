@@ -4,12 +4,28 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
 #include "ines.h"
+#include "archive.h"
+#include "device/memory_map.h"
+#include "helpers.h"
 #include "log.h"
 
+#define DEFAULT_SAVE_SYNC_INTERVAL_MS 5000
+
+static uint32_t s_save_sync_interval_ms = DEFAULT_SAVE_SYNC_INTERVAL_MS;
+
+static inline int _read_raw(FILE* f, size_t size, Cart* cart);
+static inline int _read_archive(FILE* f, size_t size, ArchiveType type, Cart* cart);
+static inline int _parse(Cart* cart);
 static inline int _parse_ines(Cart* cart);
 static inline int _parse_ines20(Cart* cart);
+static inline void _map_prg_pages(Cart* cart);
 
 int cart_load(const char* path, Cart* cart) {
     log_info("loading cart from path '%s'...", path);
@@ -22,8 +38,9 @@ int cart_load(const char* path, Cart* cart) {
     }
 
     memset(cart, 0, sizeof(*cart));
+    cart->save_fd = -1;
 
-    FILE* f = fopen(path, "r");
+    FILE* f = fopen(path, "rb");
     if (f == NULL) {
         log_error("failed to load cart (%s)", strerror(errno));
         success = 0;
@@ -31,69 +48,286 @@ int cart_load(const char* path, Cart* cart) {
     }
 
     fseek(f, 0, SEEK_END);
-    cart->buffer_size = ftell(f);
+    const size_t file_size = ftell(f);
     rewind(f);
 
-    log_info("reading %zu bytes...", cart->buffer_size);
+    uint8_t magic[ARCHIVE_MAGIC_SIZE];
+    const size_t magic_size = fread(magic, sizeof(magic[0]), ARCHIVE_MAGIC_SIZE, f);
+    rewind(f);
 
-    cart->buffer = malloc(cart->buffer_size);
-    const size_t read_bytes = fread(cart->buffer, sizeof(cart->buffer[0]), cart->buffer_size, f);
-    if (cart->buffer_size != read_bytes) {
-        log_error("failed to load cart (expected %zu, got %zu)", cart->buffer_size, read_bytes);
-        success = 0;
+    const ArchiveType archive_type = archive_get_type(magic, magic_size);
+    if (archive_type != kARCHIVETYPE_NONE)
+        success = _read_archive(f, file_size, archive_type, cart);
+    else
+        success = _read_raw(f, file_size, cart);
+
+    if (! success)
         goto bail;
+
+    success = _parse(cart);
+    if (! success)
+        goto bail;
+
+    cart->prg_ram = calloc(cart->prg_ram_size, sizeof(cart->prg_ram[0]));
+
+    log_info("done!");
+
+bail:
+    if (f != NULL)
+        fclose(f);
+
+    // anything read or parsed before the failure is let go of
+    if (! success)
+        cart_unload(cart);
+
+    return success;
+}
+
+int cart_inspect(const uint8_t* data, size_t size, Cart* cart) {
+    if (cart == NULL) {
+        log_error("failed to inspect cart (cart cannot be NULL)");
+        return 0;
     }
 
-    const int ines_format = cart->buffer[0] == 'N' &&
-                            cart->buffer[1] == 'E' &&
-                            cart->buffer[2] == 'S' &&
-                            cart->buffer[3] == 26; // MS-DOS EOF
-    if (ines_format) {
-        const int ines20_format = (cart->buffer[7] & 0x0C) == 0x08;
-        if (ines20_format) {
-            success = _parse_ines20(cart);
-        } else {
-            success = _parse_ines(cart);
-        }
+    memset(cart, 0, sizeof(*cart));
+    cart->save_fd       = -1;
+    cart->buffer        = (uint8_t*)data;
+    cart->buffer_size   = size;
+
+    return _parse(cart);
+}
 
-        if (! success)
-            goto bail;
+void cart_unload(Cart* cart) {
+    if (cart->save_fd >= 0) {
+        log_info("flushing save file...");
+        msync(cart->prg_ram, cart->prg_ram_size, MS_SYNC);
+        munmap(cart->prg_ram, cart->prg_ram_size);
+        close(cart->save_fd);
     } else {
-        log_error("failed to load cart (unrecognised ROM format)");
+        free(cart->prg_ram);
+    }
+
+    ines_unload(cart->format_header);
+    if (cart->buffer_owned)
+        free(cart->buffer);
+
+    memset(cart, 0, sizeof(*cart));
+    cart->save_fd = -1;
+}
+
+int cart_clone(const Cart* cart, Cart* out) {
+    memset(out, 0, sizeof(*out));
+    out->save_fd = -1;
+
+    uint8_t* buffer         = malloc(cart->buffer_size);
+    uint8_t* prg_ram        = calloc(cart->prg_ram_size, sizeof(prg_ram[0]));
+    INESHeader* header      = buffer != NULL ? ines_load(cart->buffer, cart->buffer_size) : NULL;
+    if (buffer == NULL || (prg_ram == NULL && cart->prg_ram_size > 0) || header == NULL) {
+        log_error("failed to clone cart");
+        free(buffer);
+        free(prg_ram);
+        ines_unload(header);
+        return 0;
+    }
+
+    memcpy(buffer, cart->buffer, cart->buffer_size);
+    if (cart->prg_ram != NULL)
+        memcpy(prg_ram, cart->prg_ram, cart->prg_ram_size);
+
+    *out = *cart;
+    out->format_header  = header;
+    out->buffer         = buffer;
+    out->buffer_owned   = 1;
+    out->prg_ram        = prg_ram;
+    out->save_fd        = -1;
+    out->save_last_sync = 0;
+    _map_prg_pages(out);
+
+    return 1;
+}
+
+int cart_attach_save(Cart* cart, const char* path) {
+    if (! cart->prg_ram_battery) {
+        log_info("cart has no battery backed PRG RAM, not attaching save file");
+        return 0;
+    }
+
+    if (cart->save_fd >= 0) {
+        log_error("failed to attach save file (cart already has one attached)");
+        return 0;
+    }
+
+    log_info("attaching save file '%s'...", path);
+
+    int success = 1;
+
+    const int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log_error("failed to attach save file (%s)", strerror(errno));
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        log_error("failed to attach save file (%s)", strerror(errno));
+        success = 0;
+        goto bail;
+    }
+
+    // a fresh save file reads back as zeroed PRG RAM
+    if ((size_t)st.st_size < cart->prg_ram_size && ftruncate(fd, cart->prg_ram_size) != 0) {
+        log_error("failed to resize save file (%s)", strerror(errno));
+        success = 0;
+        goto bail;
+    }
+
+    // MAP_SHARED means writes go straight to the page cache, so progress
+    // survives the process dying. the msyncs only guard against the OS dying
+    uint8_t* mapping = mmap(NULL, cart->prg_ram_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        log_error("failed to map save file (%s)", strerror(errno));
         success = 0;
         goto bail;
     }
 
+    free(cart->prg_ram);
+    cart->prg_ram           = mapping;
+    cart->save_fd           = fd;
+    cart->save_last_sync    = get_time_ns();
+
     log_info("done!");
 
 bail:
-    fclose(f);
+    if (! success)
+        close(fd);
+
     return success;
 }
 
-void cart_unload(Cart* cart) {
-    free(cart->buffer);
-    memset(cart, 0, sizeof(*cart));
+void cart_update_save(Cart* cart) {
+    if (cart->save_fd < 0)
+        return;
+
+    const uint64_t now = get_time_ns();
+    if (now - cart->save_last_sync < (uint64_t)s_save_sync_interval_ms*1000000)
+        return;
+
+    msync(cart->prg_ram, cart->prg_ram_size, MS_ASYNC);
+    cart->save_last_sync = now;
 }
 
-int cart_read8(uint16_t addr, uint8_t* out) {
-    (void)addr;
-    (void)out;
+void cart_set_save_sync_interval(uint32_t interval_ms) {
+    s_save_sync_interval_ms = interval_ms;
+}
+
+int cart_read8(Cart* cart, uint16_t addr, uint8_t* out) {
+    if (cart == NULL)
+        return 0;
+
+    if (addr >= CART_PRG_RAM_START && addr <= CART_PRG_RAM_END) {
+        if (cart->prg_ram == NULL)
+            return 0;
+
+        *out = cart->prg_ram[(addr - CART_PRG_RAM_START) % cart->prg_ram_size];
+        return 1;
+    }
+
+    if (addr >= CART_ROM_BANK_START && cart->prg_rom_size != 0) {
+        const uint8_t* page = cart->prg_pages[(addr - CART_ROM_BANK_START) >> CART_PRG_PAGE_SHIFT];
+        if (page != NULL) {
+            *out = page[addr & (CART_PRG_PAGE_SIZE - 1)];
+            return 1;
+        }
+
+        *out = cart->buffer[cart->prg_rom_start + mapper_get_prg_rom_offset(cart->mapper, addr, cart->prg_rom_size)];
+        return 1;
+    }
 
-    // TODO
+    // TODO: expansion area ($4020-$5FFF)
     return 0;
 }
 
-int cart_write8(uint16_t addr, const uint8_t* in) {
-    (void)addr;
-    (void)in;
+int cart_write8(Cart* cart, uint16_t addr, const uint8_t* in) {
+    if (cart == NULL)
+        return 0;
+
+    if (addr >= CART_PRG_RAM_START && addr <= CART_PRG_RAM_END) {
+        if (cart->prg_ram == NULL)
+            return 0;
 
-    // TODO
+        cart->prg_ram[(addr - CART_PRG_RAM_START) % cart->prg_ram_size] = *in;
+        return 1;
+    }
+
+    // NROM has no registers, so writes to ROM are dropped on the floor
+    if (addr >= CART_ROM_BANK_START)
+        return 1;
+
+    // TODO: expansion area ($4020-$5FFF)
     return 0;
 }
 
-uint16_t cart_entrypoint(Cart* cart) {
-    return mapper_get_start_addr(cart->mapper);
+uint32_t cart_crc32(const uint8_t* buffer, size_t size) {
+    // the header is left out so the hash matches rom databases, which
+    // identify carts by their contents rather than by how they were dumped
+    if (size <= INES_HEADER_SIZE)
+        return 0;
+
+    return crc32(0, buffer + INES_HEADER_SIZE, size - INES_HEADER_SIZE);
+}
+
+static inline int _read_raw(FILE* f, size_t size, Cart* cart) {
+    log_info("reading %zu bytes...", size);
+
+    cart->buffer_size   = size;
+    cart->buffer        = malloc(cart->buffer_size);
+    cart->buffer_owned  = 1;
+
+    const size_t read_bytes = fread(cart->buffer, sizeof(cart->buffer[0]), cart->buffer_size, f);
+    if (cart->buffer_size != read_bytes) {
+        log_error("failed to load cart (expected %zu, got %zu)", cart->buffer_size, read_bytes);
+        return 0;
+    }
+
+    return 1;
+}
+
+static inline int _read_archive(FILE* f, size_t size, ArchiveType type, Cart* cart) {
+    log_info("decompressing %zu bytes...", size);
+
+    // map the archive rather than reading it so inflate can consume it
+    // directly, with the rom decompressed straight into the cart buffer
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (data == MAP_FAILED) {
+        log_error("failed to load cart (%s)", strerror(errno));
+        return 0;
+    }
+
+    const int success = archive_load(type, data, size, &cart->buffer, &cart->buffer_size);
+    cart->buffer_owned = success;
+    munmap(data, size);
+
+    return success;
+}
+
+static inline int _parse(Cart* cart) {
+    const int ines_format = cart->buffer_size >= INES_HEADER_SIZE &&
+                            cart->buffer[0] == 'N' &&
+                            cart->buffer[1] == 'E' &&
+                            cart->buffer[2] == 'S' &&
+                            cart->buffer[3] == 26; // MS-DOS EOF
+    if (! ines_format) {
+        log_error("failed to load cart (unrecognised ROM format)");
+        return 0;
+    }
+
+    cart->crc32 = cart_crc32(cart->buffer, cart->buffer_size);
+
+    const int success = ines_is_ines20(cart->buffer) ? _parse_ines20(cart) : _parse_ines(cart);
+    if (success)
+        _map_prg_pages(cart);
+
+    return success;
 }
 
 static inline int _parse_ines(Cart* cart) {
@@ -116,18 +350,30 @@ static inline int _parse_ines(Cart* cart) {
         goto bail;
     }
 
-    cart->prg_rom_start = ines_prg_rom_start(cart->format_header);
-    cart->prg_rom_size  = ines_prg_rom_size_bytes(cart->format_header);
-    cart->chr_rom_start = ines_chr_rom_start(cart->format_header);
-    cart->chr_rom_size  = ines_chr_rom_size_bytes(cart->format_header);
-    cart->prg_ram_size  = 0; // TODO: implement
+    cart->prg_rom_start     = ines_prg_rom_start(cart->format_header);
+    cart->prg_rom_size      = ines_prg_rom_size_bytes(cart->format_header);
+    cart->chr_rom_start     = ines_chr_rom_start(cart->format_header);
+    cart->chr_rom_size      = ines_chr_rom_size_bytes(cart->format_header);
+    cart->prg_ram_size      = ines_prg_ram_size_bytes(cart->format_header);
+    cart->prg_ram_battery   = ines_has_prg_ram(cart->format_header) != 0;
+    // a horizontal arrangement of nametables is mirrored vertically, and vice versa
+    cart->mirroring         = ines_nametable_arrangement(cart->format_header) == kINESNametableArrangement_Horizontal ? kCARTMIRRORING_VERTICAL : kCARTMIRRORING_HORIZONTAL;
+
+    const size_t rom_end = cart->prg_rom_start + cart->prg_rom_size + cart->chr_rom_size;
+    if (rom_end > cart->buffer_size) {
+        log_error("ROM is truncated (expected %zu bytes, got %zu)", rom_end, cart->buffer_size);
+        success = 0;
+        goto bail;
+    }
 
     log_info("ROM info:");
-    log_info("PRG ROM start: 0x%04X", cart->prg_rom_start);
+    log_info("CRC32: %08X", cart->crc32);
+    log_info("PRG ROM start: 0x%04zX", cart->prg_rom_start);
     log_info("PRG ROM size (bytes): %zu", cart->prg_rom_size);
-    log_info("CHR ROM start: 0x%04X", cart->chr_rom_start);
+    log_info("CHR ROM start: 0x%04zX", cart->chr_rom_start);
     log_info("CHR ROM size (bytes): %zu", cart->chr_rom_size);
     log_info("PRG RAM size (bytes): %zu", cart->prg_ram_size);
+    log_info("PRG RAM battery backed: %s", cart->prg_ram_battery ? "yes" : "no");
 
 bail:
     return success;
@@ -141,3 +387,14 @@ static inline int _parse_ines20(Cart* cart) {
     return 0;
 }
 
+static inline void _map_prg_pages(Cart* cart) {
+    // a page the mapper doesn't place wholly inside PRG ROM, eg. in a rom
+    // smaller than a page, is left for cart_read8 to go through the mapper
+    for (size_t i = 0; i < CART_PRG_PAGE_COUNT; ++i) {
+        const uint16_t addr = CART_ROM_BANK_START + i*CART_PRG_PAGE_SIZE;
+        const size_t offset = cart->prg_rom_size != 0 ? mapper_get_prg_rom_offset(cart->mapper, addr, cart->prg_rom_size) : 0;
+        const int mapped    = cart->prg_rom_size != 0 && offset + CART_PRG_PAGE_SIZE <= cart->prg_rom_size;
+
+        cart->prg_pages[i] = mapped ? cart->buffer + cart->prg_rom_start + offset : NULL;
+    }
+}
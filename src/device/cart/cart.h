@@ -6,32 +6,63 @@
 
 #include "../mapper/mapper.h"
 
+// PRG ROM is mapped into $8000-$FFFF in pages of this size
+#define CART_PRG_PAGE_SHIFT 12
+#define CART_PRG_PAGE_SIZE (1 << CART_PRG_PAGE_SHIFT)
+#define CART_PRG_PAGE_COUNT 8
+
 typedef enum {
     kROMFORMAT_NONE = 0,
     kROMFORMAT_INES,
     kROMFORMAT_INES20,
 } ROMFormat;
 
+// which nametables share VRAM, see https://www.nesdev.org/wiki/Mirroring
+typedef enum {
+    kCARTMIRRORING_HORIZONTAL = 0,
+    kCARTMIRRORING_VERTICAL,
+} CartMirroring;
+
 typedef struct {
     ROMFormat               format;
     void*                   format_header;
     uint8_t*                buffer;
     size_t                  buffer_size;
+    int                     buffer_owned;
+    uint32_t                crc32;
     CartMapper              mapper;
-    uint16_t                prg_rom_start;
+    CartMirroring           mirroring;
+    size_t                  prg_rom_start;
     size_t                  prg_rom_size;
-    uint16_t                chr_rom_start;
+    const uint8_t*          prg_pages[CART_PRG_PAGE_COUNT]; // where each page of $8000-$FFFF is in PRG ROM, or NULL
+    size_t                  chr_rom_start;
     size_t                  chr_rom_size;
     size_t                  prg_ram_size;
+    uint8_t*                prg_ram;
+    int                     prg_ram_battery;
+    int                     save_fd;
+    uint64_t                save_last_sync;
 } Cart;
 
 int cart_load(const char* path, Cart* cart);
+// parses a rom image already in memory without copying it or allocating PRG
+// RAM, for tools which only need to look at a rom. data must outlive the cart
+int cart_inspect(const uint8_t* data, size_t size, Cart* cart);
 void cart_unload(Cart* cart);
+// copies the cart for a second machine, with its own rom and PRG RAM and no save
+// file, so neither sees the other's writes or outlives it
+int cart_clone(const Cart* cart, Cart* out);
+
+// battery backed PRG RAM is persisted by mapping the save file straight over
+// the PRG RAM buffer, so writes land in the page cache as they happen
+int cart_attach_save(Cart* cart, const char* path);
+void cart_update_save(Cart* cart);
+void cart_set_save_sync_interval(uint32_t interval_ms);
 
-int cart_read8(uint16_t addr, uint8_t* out);
-int cart_write8(uint16_t addr, const uint8_t* in);
+int cart_read8(Cart* cart, uint16_t addr, uint8_t* out);
+int cart_write8(Cart* cart, uint16_t addr, const uint8_t* in);
 
-uint16_t cart_entrypoint(Cart* cart);
+uint32_t cart_crc32(const uint8_t* buffer, size_t size);
 
 #endif
 
@@ -2,10 +2,14 @@
 
 #include "log.h"
 
-#define HEADER_SIZE_BYTES 16
 #define TRAINER_SIZE_BYTES 512
 #define PRG_ROM_SIZE_MULTIPLIER 16 * 1024
 #define CHR_ROM_SIZE_MULTIPLIER 8 * 1024
+#define PRG_RAM_SIZE_MULTIPLIER 8 * 1024
+
+int ines_is_ines20(const uint8_t* buffer) {
+    return (buffer[7] & 0x0C) == 0x08;
+}
 
 INESHeader* ines_load(const uint8_t* buffer, size_t size) {
     if (buffer == NULL || size == 0) {
@@ -13,7 +17,7 @@ INESHeader* ines_load(const uint8_t* buffer, size_t size) {
         return NULL;
     }
 
-    if (size < 16) {
+    if (size < INES_HEADER_SIZE) {
         log_error("buffer is too small");
         return NULL;
     }
@@ -27,6 +31,7 @@ INESHeader* ines_load(const uint8_t* buffer, size_t size) {
     header->flags_8         = buffer[8];
     header->flags_9         = buffer[9];
     header->flags_10        = buffer[10];
+    header->flags_12        = buffer[12];
 
     return header;
 }
@@ -39,8 +44,8 @@ size_t ines_prg_rom_size_bytes(const INESHeader* header) {
     return header->prg_rom_blocks * PRG_ROM_SIZE_MULTIPLIER;
 }
 
-uint16_t ines_prg_rom_start(const INESHeader* header) {
-    const uint16_t base_addr    = HEADER_SIZE_BYTES;
+size_t ines_prg_rom_start(const INESHeader* header) {
+    const size_t base_addr      = INES_HEADER_SIZE;
     const size_t trainer_size   = ines_has_trainer(header) ? TRAINER_SIZE_BYTES : 0;
 
     return base_addr + trainer_size;
@@ -50,7 +55,7 @@ size_t ines_chr_rom_size_bytes(const INESHeader* header) {
     return header->chr_rom_blocks * CHR_ROM_SIZE_MULTIPLIER;
 }
 
-uint16_t ines_chr_rom_start(const INESHeader* header) {
+size_t ines_chr_rom_start(const INESHeader* header) {
     const int has_chr_rom = ines_chr_rom_size_bytes(header) != 0;
     if (! has_chr_rom)
         return 0;
@@ -58,6 +63,12 @@ uint16_t ines_chr_rom_start(const INESHeader* header) {
     return ines_prg_rom_start(header) + ines_prg_rom_size_bytes(header);
 }
 
+size_t ines_prg_ram_size_bytes(const INESHeader* header) {
+    // a value of 0 infers 8KB for compatibility, see https://www.nesdev.org/wiki/INES#Flags_8
+    const size_t blocks = header->flags_8 == 0 ? 1 : header->flags_8;
+    return blocks * PRG_RAM_SIZE_MULTIPLIER;
+}
+
 INESNametableArrangement ines_nametable_arrangement(const INESHeader* header) {
     const int arrangement = header->flags_6 & 0x01;
     return arrangement ? kINESNametableArrangement_Horizontal : kINESNametableArrangement_Vertical;
@@ -75,6 +86,21 @@ uint8_t ines_mapper(const INESHeader* header) {
     const uint8_t lower = (header->flags_6 & 0xF0) >> 4;
     const uint8_t upper = header->flags_7 & 0xF0;
 
-    return lower & upper;
+    return lower | upper;
+}
+
+INESTVSystem ines_tv_system(const INESHeader* header) {
+    // NES 2.0 gives the timing in byte 12, iNES only has the (rarely set) bit 0
+    // of flags 9. see https://www.nesdev.org/wiki/NES_2.0#CPU/PPU_Timing
+    if ((header->flags_7 & 0x0C) == 0x08) {
+        switch (header->flags_12 & 0x03) {
+            case 0x00: return kINESTVSystem_NTSC;
+            case 0x01: return kINESTVSystem_PAL;
+            case 0x02: return kINESTVSystem_Multi;
+            case 0x03: return kINESTVSystem_Dendy;
+        }
+    }
+
+    return (header->flags_9 & 0x01) ? kINESTVSystem_PAL : kINESTVSystem_NTSC;
 }
 
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#define INES_HEADER_SIZE 16
+
 typedef struct {
     uint8_t prg_rom_blocks;
     uint8_t chr_rom_blocks;
@@ -12,6 +14,7 @@ typedef struct {
     uint8_t flags_8;
     uint8_t flags_9;
     uint8_t flags_10;
+    uint8_t flags_12;
 } INESHeader;
 
 typedef enum {
@@ -19,17 +22,27 @@ typedef enum {
     kINESNametableArrangement_Vertical,
 } INESNametableArrangement;
 
+typedef enum {
+    kINESTVSystem_NTSC,
+    kINESTVSystem_PAL,
+    kINESTVSystem_Multi,
+    kINESTVSystem_Dendy,
+} INESTVSystem;
+
+int ines_is_ines20(const uint8_t* buffer);
 INESHeader* ines_load(const uint8_t* buffer, size_t size);
 void ines_unload(INESHeader* header);
 
 size_t ines_prg_rom_size_bytes(const INESHeader* header);
-uint16_t ines_prg_rom_start(const INESHeader* header);
+size_t ines_prg_rom_start(const INESHeader* header);
 size_t ines_chr_rom_size_bytes(const INESHeader* header);
-uint16_t ines_chr_rom_start(const INESHeader* header);
+size_t ines_chr_rom_start(const INESHeader* header);
+size_t ines_prg_ram_size_bytes(const INESHeader* header);
 INESNametableArrangement ines_nametable_arrangement(const INESHeader* header);
 int ines_has_prg_ram(const INESHeader* header);
 int ines_has_trainer(const INESHeader* header);
 uint8_t ines_mapper(const INESHeader* header);
+INESTVSystem ines_tv_system(const INESHeader* header);
 
 #endif
 
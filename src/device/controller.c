@@ -0,0 +1,57 @@
+#include "controller.h"
+
+#include "device.h"
+
+#include <string.h>
+
+// the bits above the one the pad drives are open bus, which is almost always
+// the high byte of the address that was read
+#define CONTROLLER_OPEN_BUS 0x40
+
+static _Thread_local struct {
+    uint8_t     strobe;
+    uint8_t     shift[INPUT_PORT_COUNT];
+} s_controllers;
+
+static inline void _latch(void);
+
+void controller_init(void) {
+    memset(&s_controllers, 0, sizeof(s_controllers));
+}
+
+int controller_read8(uint8_t port, uint8_t* out) {
+    // while the strobe is held the pads keep reloading, so only A comes out
+    if (s_controllers.strobe)
+        _latch();
+
+    // official pads shift in 1s once all 8 buttons have been read
+    uint8_t* shift  = &s_controllers.shift[port];
+    *out            = CONTROLLER_OPEN_BUS | (*shift & 0x01);
+    *shift          = (*shift >> 1) | 0x80;
+
+    return 1;
+}
+
+int controller_write8(const uint8_t* in) {
+    s_controllers.strobe = *in & 0x01;
+    if (s_controllers.strobe)
+        _latch();
+
+    return 1;
+}
+
+void* controller_get_state(size_t* size) {
+    *size = sizeof(s_controllers);
+    return &s_controllers;
+}
+
+// pads report A, B, select, start, up, down, left, right, from the low bit
+static inline void _latch(void) {
+    for (uint8_t port = 0; port < INPUT_PORT_COUNT; ++port) {
+        const InputFlags inputs = g_device.inputs[port];
+        s_controllers.shift[port] = ((inputs >> kINPUT_A) & 0x03) |
+                                    (((inputs >> kINPUT_SELECT) & 0x01) << 2) |
+                                    (((inputs >> kINPUT_START) & 0x01) << 3) |
+                                    ((inputs & 0x0F) << 4);
+    }
+}
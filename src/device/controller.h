@@ -0,0 +1,20 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// standard pads on both ports. each latches the inputs the device was given
+// for this frame into a shift register, which the cpu reads out a bit at a
+// time. see https://www.nesdev.org/wiki/Standard_controller
+void controller_init(void);
+
+// $4016 and $4017 reads
+int controller_read8(uint8_t port, uint8_t* out);
+// $4016 writes, whose low bit is the strobe shared by both ports
+int controller_write8(const uint8_t* in);
+
+// raw state for snapshotting
+void* controller_get_state(size_t* size);
+
+#endif
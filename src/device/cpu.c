@@ -1,92 +1,175 @@
 #include "cpu.h"
 
 #include "memory_bus.h"
+#include "memory_map.h"
 #include "cpu_instr_impl.h"
+#include "controller.h"
+#include "apu/apu.h"
+#include "ppu/ppu.h"
+#include "ppu/ppu_reg.h"
 #include "helpers.h"
+#include "log.h"
+
+#include <string.h>
+
+#define REG_OAMDMA  0x4014
+#define REG_JOY1    0x4016
+#define REG_JOY2    0x4017
 
 typedef void (*InstrExecFunc)(const InstrInfo* instr);
 
-static InstrExecFunc s_instr_exec_funcs[kINSTRTYPE_COUNT];
-#define REG_INSTR(_alias, _func) s_instr_exec_funcs[_alias] = _func
+#define REG_INSTR(_alias, _func) [_alias] = _func
+
+static const InstrExecFunc s_instr_exec_funcs[kINSTRTYPE_COUNT] = {
+    REG_INSTR(kINSTRTYPE_UNKNOWN, cpu_instr_unknown),
+
+    REG_INSTR(kINSTRTYPE_ADC, cpu_instr_adc),
+    REG_INSTR(kINSTRTYPE_AND, cpu_instr_and),
+    REG_INSTR(kINSTRTYPE_ASL, cpu_instr_asl),
+    REG_INSTR(kINSTRTYPE_BCC, cpu_instr_bcc),
+    REG_INSTR(kINSTRTYPE_BCS, cpu_instr_bcs),
+    REG_INSTR(kINSTRTYPE_BEQ, cpu_instr_beq),
+    REG_INSTR(kINSTRTYPE_BIT, cpu_instr_bit),
+    REG_INSTR(kINSTRTYPE_BMI, cpu_instr_bmi),
+    REG_INSTR(kINSTRTYPE_BPL, cpu_instr_bpl),
+    REG_INSTR(kINSTRTYPE_BNE, cpu_instr_bne),
+    REG_INSTR(kINSTRTYPE_BRK, cpu_instr_brk),
+    REG_INSTR(kINSTRTYPE_BVC, cpu_instr_bvc),
+    REG_INSTR(kINSTRTYPE_BVS, cpu_instr_bvs),
+    REG_INSTR(kINSTRTYPE_CLC, cpu_instr_clc),
+    REG_INSTR(kINSTRTYPE_CLD, cpu_instr_cld),
+    REG_INSTR(kINSTRTYPE_CLI, cpu_instr_cli),
+    REG_INSTR(kINSTRTYPE_CLV, cpu_instr_clv),
+    REG_INSTR(kINSTRTYPE_CMP, cpu_instr_cmp),
+    REG_INSTR(kINSTRTYPE_CPX, cpu_instr_cpx),
+    REG_INSTR(kINSTRTYPE_CPY, cpu_instr_cpy),
+    REG_INSTR(kINSTRTYPE_DEC, cpu_instr_dec),
+    REG_INSTR(kINSTRTYPE_DEX, cpu_instr_dex),
+    REG_INSTR(kINSTRTYPE_DEY, cpu_instr_dey),
+    REG_INSTR(kINSTRTYPE_EOR, cpu_instr_eor),
+    REG_INSTR(kINSTRTYPE_INC, cpu_instr_inc),
+    REG_INSTR(kINSTRTYPE_INX, cpu_instr_inx),
+    REG_INSTR(kINSTRTYPE_INY, cpu_instr_iny),
+    REG_INSTR(kINSTRTYPE_JMP, cpu_instr_jmp),
+    REG_INSTR(kINSTRTYPE_JSR, cpu_instr_jsr),
+    REG_INSTR(kINSTRTYPE_LDA, cpu_instr_lda),
+    REG_INSTR(kINSTRTYPE_LDX, cpu_instr_ldx),
+    REG_INSTR(kINSTRTYPE_LDY, cpu_instr_ldy),
+    REG_INSTR(kINSTRTYPE_LSR, cpu_instr_lsr),
+    REG_INSTR(kINSTRTYPE_NOP, cpu_instr_nop),
+    REG_INSTR(kINSTRTYPE_ORA, cpu_instr_ora),
+    REG_INSTR(kINSTRTYPE_PHA, cpu_instr_pha),
+    REG_INSTR(kINSTRTYPE_PHP, cpu_instr_php),
+    REG_INSTR(kINSTRTYPE_PLA, cpu_instr_pla),
+    REG_INSTR(kINSTRTYPE_PLP, cpu_instr_plp),
+    REG_INSTR(kINSTRTYPE_ROL, cpu_instr_rol),
+    REG_INSTR(kINSTRTYPE_ROR, cpu_instr_ror),
+    REG_INSTR(kINSTRTYPE_RTI, cpu_instr_rti),
+    REG_INSTR(kINSTRTYPE_RTS, cpu_instr_rts),
+    REG_INSTR(kINSTRTYPE_SBC, cpu_instr_sbc),
+    REG_INSTR(kINSTRTYPE_SEC, cpu_instr_sec),
+    REG_INSTR(kINSTRTYPE_SED, cpu_instr_sed),
+    REG_INSTR(kINSTRTYPE_SEI, cpu_instr_sei),
+    REG_INSTR(kINSTRTYPE_STA, cpu_instr_sta),
+    REG_INSTR(kINSTRTYPE_STX, cpu_instr_stx),
+    REG_INSTR(kINSTRTYPE_STY, cpu_instr_sty),
+    REG_INSTR(kINSTRTYPE_TAX, cpu_instr_tax),
+    REG_INSTR(kINSTRTYPE_TAY, cpu_instr_tay),
+    REG_INSTR(kINSTRTYPE_TSX, cpu_instr_tsx),
+    REG_INSTR(kINSTRTYPE_TXA, cpu_instr_txa),
+    REG_INSTR(kINSTRTYPE_TXS, cpu_instr_txs),
+    REG_INSTR(kINSTRTYPE_TYA, cpu_instr_tya),
+};
 
 #define STACK_ADDR_MSB 0x0100
-
-static struct {
-    uint16_t    pc;
-    uint8_t     sp;
-    uint8_t     acc;
-    uint8_t     x;
-    uint8_t     y;
-    uint8_t     status;
-} s_regs = {
-    .pc     = 0xFFFC,
-    .sp     = 0xFD,
-    .x      = 0x00,
-    .y      = 0x00,
-    .status = 0x00 & BIT(kCPUSTATUSFLAG_IRQ_DISABLE),
+#define RESET_CYCLES 7
+#define INTERRUPT_CYCLES 7
+#define UNKNOWN_INSTR_CYCLES 2
+
+// a latched nmi shares a byte with the irq sources, above them
+#define INTERRUPT_NMI_BIT 7
+
+// a $4014 write copies a page of cpu memory into OAM, holding the cpu off the
+// bus for 513 cycles, plus one to line up if it starts on an odd cycle
+#define OAM_DMA_SIZE 256
+#define OAM_DMA_CYCLES 513
+
+static _Thread_local CPURegisters s_regs;
+
+static _Thread_local struct {
+    uint8_t pending;    // irq sources holding the line, and a latched nmi
+    uint8_t nmi_line;
+} s_interrupts;
+
+// owed by the instruction which started an oam dma, and always taken before
+// the next one runs, so it's never part of a snapshot
+static _Thread_local uint32_t s_stall;
+
+// base cycle counts per opcode from https://www.nesdev.org/obelisk-6502-guide/reference.html
+// page crossing and taken branch penalties aren't modelled yet. unofficial
+// opcodes are treated as 2 cycle NOPs so execution always makes progress
+static const uint8_t s_opcode_cycles[256] = {
+//  0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+    7, 6, 2, 2, 2, 3, 5, 2, 3, 2, 2, 2, 2, 4, 6, 2, // 0
+    2, 5, 2, 2, 2, 4, 6, 2, 2, 4, 2, 2, 2, 4, 7, 2, // 1
+    6, 6, 2, 2, 3, 3, 5, 2, 4, 2, 2, 2, 4, 4, 6, 2, // 2
+    2, 5, 2, 2, 2, 4, 6, 2, 2, 4, 2, 2, 2, 4, 7, 2, // 3
+    6, 6, 2, 2, 2, 3, 5, 2, 3, 2, 2, 2, 3, 4, 6, 2, // 4
+    2, 5, 2, 2, 2, 4, 6, 2, 2, 4, 2, 2, 2, 4, 7, 2, // 5
+    6, 6, 2, 2, 2, 3, 5, 2, 4, 2, 2, 2, 5, 4, 6, 2, // 6
+    2, 5, 2, 2, 2, 4, 6, 2, 2, 4, 2, 2, 2, 4, 7, 2, // 7
+    2, 6, 2, 2, 3, 3, 3, 2, 2, 2, 2, 2, 4, 4, 4, 2, // 8
+    2, 6, 2, 2, 4, 4, 4, 2, 2, 5, 2, 2, 2, 5, 2, 2, // 9
+    2, 6, 2, 2, 3, 3, 3, 2, 2, 2, 2, 2, 4, 4, 4, 2, // A
+    2, 5, 2, 2, 4, 4, 4, 2, 2, 4, 2, 2, 4, 4, 4, 2, // B
+    2, 6, 2, 2, 3, 3, 5, 2, 2, 2, 2, 2, 4, 4, 6, 2, // C
+    2, 5, 2, 2, 2, 4, 6, 2, 2, 4, 2, 2, 2, 4, 7, 2, // D
+    2, 6, 2, 2, 3, 3, 5, 2, 2, 2, 2, 2, 4, 4, 6, 2, // E
+    2, 5, 2, 2, 2, 4, 6, 2, 2, 4, 2, 2, 2, 4, 7, 2, // F
 };
 
 static inline void _fetch_bytes(void* buf, size_t size);
+static inline uint32_t _take_interrupt(void);
+static inline int _oam_dma(uint8_t page);
+
+
+void cpu_power_on(void) {
+    // initial values based on https://www.nesdev.org/wiki/CPU_power_up_state
+    // sp starts at 0 and the reset sequence which follows brings it to 0xFD
+    s_regs = (CPURegisters) {
+        .pc     = 0x0000,
+        .sp     = 0x00,
+        .acc    = 0x00,
+        .x      = 0x00,
+        .y      = 0x00,
+        .status = BIT(kCPUSTATUSFLAG_IRQ_DISABLE),
+    };
+
+    memset(&s_interrupts, 0, sizeof(s_interrupts));
+}
+
+uint32_t cpu_reset(void) {
+    // the reset sequence runs the interrupt logic with writes suppressed, so
+    // sp drops by 3 without touching the stack, then pc is loaded from the
+    // reset vector. see https://www.nesdev.org/wiki/CPU_interrupts
+    s_regs.sp -= 3;
+    cpu_set_status_flag(kCPUSTATUSFLAG_IRQ_DISABLE, 1);
+
+    // reset takes over from any nmi still waiting to be taken
+    s_interrupts.pending &= ~BIT(INTERRUPT_NMI_BIT);
 
-void cpu_init(void) {
-    REG_INSTR(kINSTRTYPE_UNKNOWN, cpu_instr_unknown);
-
-    REG_INSTR(kINSTRTYPE_ADC, cpu_instr_adc);
-    REG_INSTR(kINSTRTYPE_AND, cpu_instr_and);
-    REG_INSTR(kINSTRTYPE_ASL, cpu_instr_asl);
-    REG_INSTR(kINSTRTYPE_BCC, cpu_instr_bcc);
-    REG_INSTR(kINSTRTYPE_BCS, cpu_instr_bcs);
-    REG_INSTR(kINSTRTYPE_BEQ, cpu_instr_beq);
-    REG_INSTR(kINSTRTYPE_BIT, cpu_instr_bit);
-    REG_INSTR(kINSTRTYPE_BMI, cpu_instr_bmi);
-    REG_INSTR(kINSTRTYPE_BPL, cpu_instr_bpl);
-    REG_INSTR(kINSTRTYPE_BNE, cpu_instr_bne);
-    REG_INSTR(kINSTRTYPE_BRK, cpu_instr_brk);
-    REG_INSTR(kINSTRTYPE_BVC, cpu_instr_bvc);
-    REG_INSTR(kINSTRTYPE_BVS, cpu_instr_bvs);
-    REG_INSTR(kINSTRTYPE_CLC, cpu_instr_clc);
-    REG_INSTR(kINSTRTYPE_CLD, cpu_instr_cld);
-    REG_INSTR(kINSTRTYPE_CLI, cpu_instr_cli);
-    REG_INSTR(kINSTRTYPE_CLV, cpu_instr_clv);
-    REG_INSTR(kINSTRTYPE_CMP, cpu_instr_cmp);
-    REG_INSTR(kINSTRTYPE_CPX, cpu_instr_cpx);
-    REG_INSTR(kINSTRTYPE_CPY, cpu_instr_cpy);
-    REG_INSTR(kINSTRTYPE_DEC, cpu_instr_dec);
-    REG_INSTR(kINSTRTYPE_DEX, cpu_instr_dex);
-    REG_INSTR(kINSTRTYPE_DEY, cpu_instr_dey);
-    REG_INSTR(kINSTRTYPE_EOR, cpu_instr_eor);
-    REG_INSTR(kINSTRTYPE_INC, cpu_instr_inc);
-    REG_INSTR(kINSTRTYPE_INX, cpu_instr_inx);
-    REG_INSTR(kINSTRTYPE_INY, cpu_instr_iny);
-    REG_INSTR(kINSTRTYPE_JMP, cpu_instr_jmp);
-    REG_INSTR(kINSTRTYPE_JSR, cpu_instr_jsr);
-    REG_INSTR(kINSTRTYPE_LDA, cpu_instr_lda);
-    REG_INSTR(kINSTRTYPE_LDX, cpu_instr_ldx);
-    REG_INSTR(kINSTRTYPE_LDY, cpu_instr_ldy);
-    REG_INSTR(kINSTRTYPE_LSR, cpu_instr_lsr);
-    REG_INSTR(kINSTRTYPE_NOP, cpu_instr_nop);
-    REG_INSTR(kINSTRTYPE_ORA, cpu_instr_ora);
-    REG_INSTR(kINSTRTYPE_PHA, cpu_instr_pha);
-    REG_INSTR(kINSTRTYPE_PHP, cpu_instr_php);
-    REG_INSTR(kINSTRTYPE_PLA, cpu_instr_pla);
-    REG_INSTR(kINSTRTYPE_PLP, cpu_instr_plp);
-    REG_INSTR(kINSTRTYPE_ROL, cpu_instr_rol);
-    REG_INSTR(kINSTRTYPE_ROR, cpu_instr_ror);
-    REG_INSTR(kINSTRTYPE_RTI, cpu_instr_rti);
-    REG_INSTR(kINSTRTYPE_RTS, cpu_instr_rts);
-    REG_INSTR(kINSTRTYPE_SBC, cpu_instr_sbc);
-    REG_INSTR(kINSTRTYPE_SEC, cpu_instr_sec);
-    REG_INSTR(kINSTRTYPE_SED, cpu_instr_sed);
-    REG_INSTR(kINSTRTYPE_SEI, cpu_instr_sei);
-    REG_INSTR(kINSTRTYPE_STA, cpu_instr_sta);
-    REG_INSTR(kINSTRTYPE_STX, cpu_instr_stx);
-    REG_INSTR(kINSTRTYPE_STY, cpu_instr_sty);
-    REG_INSTR(kINSTRTYPE_TAX, cpu_instr_tax);
-    REG_INSTR(kINSTRTYPE_TAY, cpu_instr_tay);
-    REG_INSTR(kINSTRTYPE_TSX, cpu_instr_tsx);
-    REG_INSTR(kINSTRTYPE_TXA, cpu_instr_txa);
-    REG_INSTR(kINSTRTYPE_TXS, cpu_instr_txs);
-    REG_INSTR(kINSTRTYPE_TYA, cpu_instr_tya);
+    uint8_t vector[2];
+    if (! memory_bus_read(RESET_VECTOR, vector, sizeof(vector)))
+        log_error("failed to read reset vector");
+
+    s_regs.pc = (vector[1] << 8) | vector[0];
+    log_info("reset, pc=0x%04X", s_regs.pc);
+
+    return RESET_CYCLES;
+}
+
+CPURegisters* cpu_get_registers(void) {
+    return &s_regs;
 }
 
 uint16_t* cpu_get_pc(void) {
@@ -129,11 +212,12 @@ void cpu_stack_push(uint8_t data) {
 }
 
 uint8_t cpu_stack_pop(void) {
+    // sp points at the next free slot, so step back onto the last push first
+    ++s_regs.sp;
     const uint16_t addr = STACK_ADDR_MSB | s_regs.sp;
 
     uint8_t data;
     memory_bus_read(addr, &data, sizeof(data));
-    ++s_regs.sp;
 
     return data;
 }
@@ -145,6 +229,7 @@ InstrInfo cpu_decode(void) {
         .stride     = 1,
     };
     memory_bus_read(s_regs.pc, &instr.opcode, sizeof(instr.opcode));
+    instr.cycles = s_opcode_cycles[instr.opcode];
 
     switch (instr.opcode) {
         // ADC instructions
@@ -1443,27 +1528,131 @@ InstrInfo cpu_decode(void) {
     return instr;
 }
 
-void cpu_exec(const InstrInfo* instr) {
+uint32_t cpu_exec(const InstrInfo* instr) {
+    // move past the instruction before running it, so anything which changes
+    // control flow (jumps, branches, interrupts) has the final say over pc
+    s_regs.pc += instr->stride;
     s_instr_exec_funcs[instr->type](instr);
+
+    return instr->cycles;
+}
+
+uint32_t cpu_take_stall_cycles(void) {
+    const uint32_t stall = s_stall;
+    s_stall = 0;
+
+    return stall;
+}
+
+uint32_t cpu_step(void) {
+    // nmi and every irq source are in the one byte, so the usual case of
+    // nothing pending costs a single test
+    if (s_interrupts.pending != 0) {
+        const uint32_t cycles = _take_interrupt();
+        if (cycles > 0)
+            return cycles;
+    }
+
+    const InstrInfo instr = cpu_decode();
+    return cpu_exec(&instr);
+}
+
+void cpu_set_nmi_line(int active) {
+    if (active && ! s_interrupts.nmi_line)
+        s_interrupts.pending |= BIT(INTERRUPT_NMI_BIT);
+
+    s_interrupts.nmi_line = active != 0;
+}
+
+void cpu_set_irq_line(CPUIRQSource source, int active) {
+    if (source >= kCPUIRQSOURCE_COUNT) {
+        log_error("invalid irq source '%d'", source);
+        return;
+    }
+
+    write_bit(&s_interrupts.pending, source, active);
+}
+
+void cpu_interrupt(uint16_t vector, uint16_t return_addr, uint8_t status) {
+    cpu_stack_push((return_addr & 0xFF00) >> 8);
+    cpu_stack_push(return_addr & 0x00FF);
+    cpu_stack_push(status);
+    cpu_set_status_flag(kCPUSTATUSFLAG_IRQ_DISABLE, 1);
+
+    uint8_t addr[2];
+    if (! memory_bus_read(vector, addr, sizeof(addr)))
+        log_error("failed to read interrupt vector 0x%04X", vector);
+
+    s_regs.pc = (addr[1] << 8) | addr[0];
+}
+
+void* cpu_get_interrupt_state(size_t* size) {
+    *size = sizeof(s_interrupts);
+    return &s_interrupts;
 }
 
 int cpu_apu_io_reg_read8(uint16_t addr, uint8_t* out) {
-    (void)addr;
-    (void)out;
+    switch (addr) {
+        case REG_JOY1:
+        case REG_JOY2:
+            return controller_read8(addr == REG_JOY2, out);
 
-    // TODO
-    return 0;
+        default:
+            return apu_reg_read8(addr, out);
+    }
 }
 
 int cpu_apu_io_reg_write8(uint16_t addr, const uint8_t* in) {
-    (void)addr;
-    (void)in;
-
-    // TODO
-    return 0;
+    switch (addr) {
+        case REG_OAMDMA:
+            return _oam_dma(*in);
+        case REG_JOY1:
+            return controller_write8(in);
+
+        // $4017 reads the second controller, but writes go to the apu's frame counter
+        default:
+            return apu_reg_write8(addr, in);
+    }
 }
 
 static inline void _fetch_bytes(void* buf, size_t size) {
     // +1 offset since pc should point at current instruction opcode
     memory_bus_read(s_regs.pc+1, buf, size);
 }
+
+// returns the cycles taken, or 0 if only a disabled irq was pending
+static inline uint32_t _take_interrupt(void) {
+    // nmi wins if both are pending. it's latched, so it's cleared once taken,
+    // while irq carries on until its sources let go of the line
+    uint16_t vector;
+    if (s_interrupts.pending & BIT(INTERRUPT_NMI_BIT)) {
+        s_interrupts.pending &= ~BIT(INTERRUPT_NMI_BIT);
+        vector = NMI_VECTOR;
+    } else if (! (s_regs.status & BIT(kCPUSTATUSFLAG_IRQ_DISABLE))) {
+        vector = IRQ_VECTOR;
+    } else {
+        return 0;
+    }
+
+    // pc already points at the next instruction, which is where to return to.
+    // unlike brk, the status pushed has the break flag clear
+    cpu_interrupt(vector, s_regs.pc, s_regs.status & ~BIT(kCPUSTATUSFLAG_BREAK_CMD));
+    return INTERRUPT_CYCLES;
+}
+
+static inline int _oam_dma(uint8_t page) {
+    uint8_t data[OAM_DMA_SIZE];
+    if (! memory_bus_read((uint16_t)(page << 8), data, sizeof(data)))
+        return 0;
+
+    // the bytes go through OAMDATA, so the copy starts at OAMADDR and wraps
+    // round to leave it where it was
+    size_t size;
+    uint8_t* oam        = ppu_get_oam_state(&size);
+    const uint8_t start = ppu_get_oam_addr();
+    for (size_t i = 0; i < size; ++i)
+        oam[(uint8_t)(start + i)] = data[i];
+
+    s_stall += OAM_DMA_CYCLES;
+    return 1;
+}
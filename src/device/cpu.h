@@ -51,8 +51,28 @@ typedef struct {
         int8_t      offset;
     }               data;
     uint16_t        stride;
+    uint8_t         cycles;
 } InstrInfo;
 
+typedef struct {
+    uint16_t    pc;
+    uint8_t     sp;
+    uint8_t     acc;
+    uint8_t     x;
+    uint8_t     y;
+    uint8_t     status;
+} CPURegisters;
+
+// everything which can raise the irq line. it stays raised for as long as any
+// of them hold it, so each source sets and clears its own
+typedef enum {
+    kCPUIRQSOURCE_APU_FRAME = 0,
+    kCPUIRQSOURCE_APU_DMC,
+    kCPUIRQSOURCE_MAPPER,
+
+    kCPUIRQSOURCE_COUNT,
+} CPUIRQSource;
+
 typedef enum {
     kCPUSTATUSFLAG_CARRY        = 0,
     kCPUSTATUSFLAG_ZERO         = 1,
@@ -63,7 +83,12 @@ typedef enum {
     kCPUSTATUSFLAG_NEGATIVE     = 6,
 } CPUStatusFlag;
 
-void cpu_init(void);
+void cpu_power_on(void);
+// runs the reset sequence, loading pc from the reset vector. returns the
+// number of cycles it took
+uint32_t cpu_reset(void);
+
+CPURegisters* cpu_get_registers(void);
 
 uint16_t* cpu_get_pc(void);
 uint8_t* cpu_get_sp(void);
@@ -77,7 +102,26 @@ void cpu_stack_push(uint8_t data);
 uint8_t cpu_stack_pop(void);
 
 InstrInfo cpu_decode(void);
-void cpu_exec(const InstrInfo* instr);
+// returns the number of cycles the instruction took
+uint32_t cpu_exec(const InstrInfo* instr);
+// takes a pending interrupt if there is one, otherwise decodes and executes
+// the next instruction. returns the number of cycles either took
+uint32_t cpu_step(void);
+
+// cycles an oam dma has stalled the cpu for since the last call, not counting
+// the one to line up on an odd cycle, which is up to the caller
+uint32_t cpu_take_stall_cycles(void);
+
+// nmi is edge triggered, so it fires once each time the line is raised
+void cpu_set_nmi_line(int active);
+// irq is level triggered, and fires between instructions while any source
+// holds the line and interrupts aren't disabled
+void cpu_set_irq_line(CPUIRQSource source, int active);
+// the sequence brk, nmi and irq share: pushes the return address and status,
+// disables irqs and jumps through the vector
+void cpu_interrupt(uint16_t vector, uint16_t return_addr, uint8_t status);
+// raw interrupt line state for snapshotting
+void* cpu_get_interrupt_state(size_t* size);
 
 int cpu_apu_io_reg_read8(uint16_t addr, uint8_t* out);
 int cpu_apu_io_reg_write8(uint16_t addr, const uint8_t* in);
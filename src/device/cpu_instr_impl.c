@@ -1,12 +1,11 @@
 #include "cpu_instr_impl.h"
 
 #include "memory_bus.h"
+#include "memory_map.h"
 #include "helpers.h"
 
 #include "log.h"
 
-#define IRQ_VECTOR 0xFFFE
-
 static inline void _branch(const InstrInfo* instr);
 
 static inline int _get_data_addr(const InstrInfo* instr, uint16_t* out);
@@ -236,17 +235,11 @@ void cpu_instr_brk(const InstrInfo* instr) {
             break;
     }
 
-    if (cpu_get_status_flag(kCPUSTATUSFLAG_IRQ_DISABLE))
-        return;
-
     cpu_set_status_flag(kCPUSTATUSFLAG_BREAK_CMD, 1);
 
-    uint16_t* pc = cpu_get_pc();
-    cpu_stack_push((*pc & 0xFF00) >> 8);
-    cpu_stack_push((*pc & 0x00FF));
-    cpu_stack_push(*cpu_get_status());
-
-    memory_bus_read(IRQ_VECTOR, pc, sizeof(*pc));
+    // pc already points past the opcode, and BRK skips a padding byte on top
+    // of that, see https://www.nesdev.org/wiki/Visual6502wiki/6502_BRK_and_B_bit
+    cpu_interrupt(IRQ_VECTOR, *cpu_get_pc() + 1, *cpu_get_status());
 }
 
 void cpu_instr_bvc(const InstrInfo* instr) {
@@ -565,8 +558,9 @@ void cpu_instr_jsr(const InstrInfo* instr) {
     uint16_t addr;
     _get_data_addr(instr, &addr);
 
+    // JSR pushes the address of its own last byte, and RTS adds the 1 back
     uint16_t* pc                = cpu_get_pc();
-    const uint16_t return_addr  = *pc + 2;
+    const uint16_t return_addr  = *pc - 1;
 
     cpu_stack_push((return_addr & 0xFF00) >> 8);
     cpu_stack_push(return_addr & 0x00FF);
@@ -839,7 +833,7 @@ void cpu_instr_rts(const InstrInfo* instr) {
     const uint16_t addr_lsb = cpu_stack_pop();
     const uint16_t addr_msb = cpu_stack_pop();
 
-    *cpu_get_pc() = (addr_msb << 8) | addr_lsb;
+    *cpu_get_pc() = ((addr_msb << 8) | addr_lsb) + 1;
 }
 
 void cpu_instr_sbc(const InstrInfo* instr) {
@@ -1168,7 +1162,6 @@ static inline void _set_data(const InstrInfo* instr, uint8_t data) {
             if (! _get_data_addr(instr, &addr))
                 return;
 
-            uint8_t data;
             if (! memory_bus_write(addr, &data, sizeof(data)))
                 log_error("failed to write memory");
         }
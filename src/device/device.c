@@ -1,42 +1,194 @@
 #include "device.h"
 
 #include "cpu.h"
+#include "controller.h"
+#include "apu/apu.h"
 #include "ppu/ppu.h"
+#include "ppu/ppu_reg.h"
+#include "ppu/ppu_memory_bus.h"
 #include "ram.h"
 #include "helpers.h"
+#include "log.h"
 
 #include <string.h>
 
-Device g_device;
+#define PPU_CYCLES_PER_CPU_CYCLE 3
+#define DEFAULT_RAM_PATTERN kRAMPATTERN_RANDOM
+#define DEFAULT_POWER_ON_SEED 0
+
+_Thread_local Device g_device;
+
+typedef void* (*StateGetter)(size_t* size);
+
+static inline void _tick(uint32_t cycles);
+static inline DeviceStateRegion _get_region(uint32_t tag, StateGetter getter);
 
 void device_init(void) {
-    // initial values based on https://www.nesdev.org/wiki/CPU_power_up_state
     g_device = (Device) {
-        .pc     = 0xFFFC,
-        .sp     = 0xFD,
-        .acc    = 0x00,
-        .x      = 0x00,
-        .y      = 0x00,
-        .status = 0x00 & BIT(kCPUSTATUSFLAG_IRQ_DISABLE),
-        .cart   = NULL,
+        .cart           = NULL,
+        .cycles         = 0,
+        .ram_pattern    = DEFAULT_RAM_PATTERN,
+        .power_on_seed  = DEFAULT_POWER_ON_SEED,
+        .outputs        = DEVICE_OUTPUT_ALL,
     };
 
-    cpu_init();
-    ppu_init();
-    ram_init();
+    ppu_set_output_enabled(1);
+    apu_set_output_enabled(1);
 }
 
 void device_load_cart(Cart* cart) {
     g_device.cart = cart;
+    device_power_on();
+}
+
+void device_unload_cart(void) {
+    g_device.cart = NULL;
+}
+
+void device_power_on(void) {
+    g_device.cycles = 0;
+    memset(g_device.inputs, 0, sizeof(g_device.inputs));
+
+    ram_init(g_device.ram_pattern, g_device.power_on_seed);
+    ppu_init();
+    apu_init();
+    controller_init();
+    cpu_power_on();
+
+    device_reset();
+}
+
+void device_reset(void) {
+    apu_reset();
+    _tick(cpu_reset());
+}
+
+void device_set_ram_pattern(RAMPattern pattern) {
+    if (pattern >= kRAMPATTERN_COUNT) {
+        log_error("invalid ram pattern '%d'", pattern);
+        return;
+    }
+
+    g_device.ram_pattern = pattern;
+}
+
+void device_set_power_on_seed(uint64_t seed) {
+    g_device.power_on_seed = seed;
+}
+
+void device_set_inputs(uint8_t port, InputFlags inputs) {
+    if (port >= INPUT_PORT_COUNT) {
+        log_error("invalid controller port '%u'", port);
+        return;
+    }
+
+    g_device.inputs[port] = inputs;
+}
+
+void device_set_outputs(uint32_t outputs) {
+    g_device.outputs = outputs & DEVICE_OUTPUT_ALL;
+
+    ppu_set_output_enabled(g_device.outputs & kDEVICE_OUTPUT_VIDEO);
+    apu_set_output_enabled(g_device.outputs & kDEVICE_OUTPUT_AUDIO);
+}
+
+uint32_t device_get_outputs(void) {
+    return g_device.outputs;
+}
+
+const uint32_t* device_get_frame(uint64_t* frame_id) {
+    return ppu_get_ready_buffer(frame_id);
 }
 
-void device_exec(void) {
-    const InstrInfo instr = cpu_decode();
-    cpu_exec(&instr);
+TripleBuffer* device_get_frames(void) {
+    return ppu_get_frames();
+}
+
+void device_set_frame_tag(uint64_t tag) {
+    ppu_set_frame_tag(tag);
+}
+
+uint64_t device_get_frame_tag(void) {
+    return ppu_get_frame_tag();
+}
+
+void device_set_sample_rate(double rate) {
+    apu_set_sample_rate(rate);
+}
+
+double device_get_sample_rate(void) {
+    return apu_get_sample_rate();
+}
+
+SampleRing* device_get_sample_ring(void) {
+    return apu_get_sample_ring();
+}
+
+uint32_t device_exec(void) {
+    const uint32_t cycles = cpu_step();
+    _tick(cycles);
+
+    // dmc fetches and oam dma hold the cpu off the bus while everything else
+    // carries on. the dma starts on the cycle after the write, and waits one
+    // more if that's an odd one
+    uint32_t stall = apu_take_stall_cycles();
+    const uint32_t dma = cpu_take_stall_cycles();
+    if (dma > 0)
+        stall += dma + (g_device.cycles & 1);
+    if (stall > 0)
+        _tick(stall);
+
+    return cycles + stall;
+}
+
+void device_exec_frame(void) {
+    const uint64_t frame = ppu_get_frame();
+    while (ppu_get_frame() == frame)
+        device_exec();
+
+    apu_end_frame();
+}
+
+size_t device_get_state_regions(DeviceStateRegion* out, size_t max_count) {
+    DeviceStateRegion regions[DEVICE_MAX_STATE_REGIONS];
+    size_t count = 0;
+
+    regions[count++] = (DeviceStateRegion) { DEVICE_STATE_TAG('D','E','V','C'), &g_device.cycles, sizeof(g_device.cycles) };
+    regions[count++] = (DeviceStateRegion) { DEVICE_STATE_TAG('C','P','U','R'), cpu_get_registers(), sizeof(CPURegisters) };
+
+    regions[count++] = _get_region(DEVICE_STATE_TAG('C','P','U','I'), cpu_get_interrupt_state);
+    regions[count++] = _get_region(DEVICE_STATE_TAG('R','A','M','I'), ram_get_state);
+    regions[count++] = _get_region(DEVICE_STATE_TAG('P','P','U','R'), ppu_reg_get_state);
+    regions[count++] = _get_region(DEVICE_STATE_TAG('P','P','U','I'), ppu_reg_get_internal_state);
+    regions[count++] = _get_region(DEVICE_STATE_TAG('O','A','M','S'), ppu_get_oam_state);
+    regions[count++] = _get_region(DEVICE_STATE_TAG('P','P','U','T'), ppu_get_timing_state);
+    regions[count++] = _get_region(DEVICE_STATE_TAG('V','R','A','M'), ppu_memory_bus_get_vram_state);
+    regions[count++] = _get_region(DEVICE_STATE_TAG('P','A','L','R'), ppu_memory_bus_get_palette_state);
+    regions[count++] = _get_region(DEVICE_STATE_TAG('A','P','U','S'), apu_get_state);
+    regions[count++] = _get_region(DEVICE_STATE_TAG('J','O','Y','S'), controller_get_state);
+
+    // TODO: mapper registers go here once a mapper has any. NROM has none
+
+    if (g_device.cart != NULL && g_device.cart->prg_ram != NULL)
+        regions[count++] = (DeviceStateRegion) { DEVICE_STATE_TAG('P','R','G','R'), g_device.cart->prg_ram, g_device.cart->prg_ram_size };
+
+    if (count > max_count)
+        count = max_count;
+
+    memcpy(out, regions, sizeof(regions[0])*count);
+    return count;
+}
+
+static inline void _tick(uint32_t cycles) {
+    g_device.cycles += cycles;
+    ppu_run(cycles*PPU_CYCLES_PER_CPU_CYCLE);
+    apu_run(cycles);
+}
 
-    g_device.pc += instr.stride;
+static inline DeviceStateRegion _get_region(uint32_t tag, StateGetter getter) {
+    DeviceStateRegion region = { .tag = tag };
+    region.data = getter(&region.size);
 
-    for (size_t i = 0; i < 3; ++i)
-        ppu_cycle();
+    return region;
 }
 
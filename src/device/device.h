@@ -1,27 +1,98 @@
 #ifndef DEVICE_H
 #define DEVICE_H
 
+#include "apu/sample_ring.h"
 #include "cart/cart.h"
+#include "input.h"
+#include "ram.h"
+#include "ppu/ppu.h"
 
 #include <stdint.h>
+#include <stdlib.h>
 
-typedef struct {
-    // registers
-    uint16_t    pc;
-    uint8_t     sp;
-    uint8_t     acc;
-    uint8_t     x;
-    uint8_t     y;
-    uint8_t     status;
+// the parts of the machine which only produce output, and can be switched off
+// when nobody is watching or listening. none of them affect emulation
+typedef enum {
+    kDEVICE_OUTPUT_VIDEO    = 1 << 0,   // ppu pixel output
+    kDEVICE_OUTPUT_AUDIO    = 1 << 1,   // apu sample synthesis
+} DeviceOutput;
+
+#define DEVICE_OUTPUT_ALL (kDEVICE_OUTPUT_VIDEO | kDEVICE_OUTPUT_AUDIO)
 
+typedef struct {
     Cart*       cart;
+    uint64_t    cycles;
+    RAMPattern  ram_pattern;
+    uint64_t    power_on_seed;
+    InputFlags  inputs[INPUT_PORT_COUNT];
+    uint32_t    outputs;
 } Device;
 
-extern Device g_device;
+// all machine state, here and in each subsystem, is thread local so every
+// thread has a console of its own. see batch.h
+extern _Thread_local Device g_device;
+
+// a contiguous block of machine state, used for snapshotting. the tag is a
+// fourcc identifying the block so snapshots can be validated on load
+typedef struct {
+    uint32_t    tag;
+    void*       data;
+    size_t      size;
+} DeviceStateRegion;
+
+#define DEVICE_STATE_TAG(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define DEVICE_MAX_STATE_REGIONS 16
 
 void device_init(void);
+// inserts the cart and power cycles the device
 void device_load_cart(Cart* cart);
-void device_exec(void);
+// detaches the cart, which must happen before it is unloaded
+void device_unload_cart(void);
+void device_power_on(void);
+void device_reset(void);
+
+// sets what RAM holds at power on. takes effect on the next power on
+void device_set_ram_pattern(RAMPattern pattern);
+// seeds the power-on contents of RAM when the pattern is kRAMPATTERN_RANDOM,
+// so runs from power-on are repeatable. takes effect on the next power on
+void device_set_power_on_seed(uint64_t seed);
+
+// sets the state of the controller plugged into the port, sampled by the
+// game when it next reads it
+void device_set_inputs(uint8_t port, InputFlags inputs);
+
+// sets which outputs are produced, as a mask of DeviceOutput. can be changed
+// at any time, eg. for fast forwarding or headless runs
+void device_set_outputs(uint32_t outputs);
+uint32_t device_get_outputs(void);
+
+// the most recently completed frame, VIDEO_BUFFER_WIDTH*VIDEO_BUFFER_HEIGHT
+// RGBA pixels. it can be read in place until the next frame completes, and
+// frame_id changes whenever there's a new one
+const uint32_t* device_get_frame(uint64_t* frame_id);
+// where completed frames are published, as VideoFrames. it can be read from
+// one other thread for as long as the calling thread runs
+TripleBuffer* device_get_frames(void);
+// stamped onto each frame as it completes
+void device_set_frame_tag(uint64_t tag);
+uint64_t device_get_frame_tag(void);
+
+// the rate the apu makes samples at, 96kHz by default. it's meant to be set
+// once, with anything finer left to resampling what comes out of the ring
+void device_set_sample_rate(double rate);
+double device_get_sample_rate(void);
+// where the apu's samples go once each frame ends. it can be read from one
+// other thread
+SampleRing* device_get_sample_ring(void);
+
+// executes a single instruction, returning the number of cpu cycles it took
+uint32_t device_exec(void);
+// executes until the ppu reaches the start of the next vblank
+void device_exec_frame(void);
+
+// fills out with the regions making up the current machine state, returning
+// how many were written. the pointers stay valid until the cart is changed
+size_t device_get_state_regions(DeviceStateRegion* out, size_t max_count);
 
 #endif
 
@@ -0,0 +1,121 @@
+#include "fastboot.h"
+
+#include "device.h"
+#include "savestate.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define FASTBOOT_FILE_EXT       ".boot"
+#define FASTBOOT_DIR_NAME       "poNES"
+
+static inline uint32_t _get_key(void);
+static inline char* _get_path(const char* cache_dir, uint32_t key, uint32_t frames);
+static inline int _make_dirs(const char* path);
+
+int fastboot_run(const char* cache_dir, uint32_t frames) {
+    if (g_device.cart == NULL) {
+        log_error("can't fast boot without a cart");
+        return 0;
+    }
+
+    const uint32_t key  = _get_key();
+    char* path          = _get_path(cache_dir, key, frames);
+
+    // the key and frame count are part of the file name, and the save state
+    // itself rejects anything from a different rom or build
+    if (access(path, R_OK) == 0 && savestate_load(path)) {
+        log_info("fast booted from '%s'", path);
+    } else {
+        log_info("no fast boot snapshot, running %u frames", frames);
+
+        // nobody sees or hears the frames being skipped
+        const uint32_t outputs = device_get_outputs();
+        device_set_outputs(0);
+        for (uint32_t i = 0; i < frames; ++i)
+            device_exec_frame();
+        device_set_outputs(outputs);
+
+        // not being able to cache isn't fatal, the device is still booted
+        if (_make_dirs(cache_dir) && savestate_save(path))
+            log_info("cached fast boot snapshot to '%s'", path);
+    }
+
+    free(path);
+    return 1;
+}
+
+char* fastboot_get_default_cache_dir(void) {
+    const char* base    = getenv("XDG_CACHE_HOME");
+    const char* suffix  = "";
+    if (base == NULL || base[0] == '\0') {
+        base    = getenv("HOME");
+        suffix  = "/.cache";
+    }
+
+    if (base == NULL || base[0] == '\0')
+        return NULL;
+
+    const size_t size   = strlen(base) + strlen(suffix) + sizeof("/" FASTBOOT_DIR_NAME);
+    char* dir           = malloc(size);
+    snprintf(dir, size, "%s%s/%s", base, suffix, FASTBOOT_DIR_NAME);
+
+    return dir;
+}
+
+static inline uint32_t _get_key(void) {
+    const Cart* cart = g_device.cart;
+
+    // the power-on RAM contents change what the boot looks like too
+    uint32_t key = cart->crc32;
+    key = crc32(key, (const uint8_t*)&g_device.ram_pattern, sizeof(g_device.ram_pattern));
+    key = crc32(key, (const uint8_t*)&g_device.power_on_seed, sizeof(g_device.power_on_seed));
+    if (cart->prg_ram != NULL)
+        key = crc32(key, cart->prg_ram, cart->prg_ram_size);
+
+    return key;
+}
+
+static inline char* _get_path(const char* cache_dir, uint32_t key, uint32_t frames) {
+    const int size  = snprintf(NULL, 0, "%s/%08X_%u" FASTBOOT_FILE_EXT, cache_dir, key, frames) + 1;
+    char* path      = malloc(size);
+    snprintf(path, size, "%s/%08X_%u" FASTBOOT_FILE_EXT, cache_dir, key, frames);
+
+    return path;
+}
+
+static inline int _make_dirs(const char* path) {
+    const size_t len = strlen(path);
+    if (len == 0)
+        return 0;
+
+    // mkdir -p, creating each parent in turn
+    char* dir   = malloc(len + 1);
+    int success = 1;
+    memcpy(dir, path, len + 1);
+
+    for (char* p = dir + 1; success; ++p) {
+        const char c = *p;
+        if (c != '/' && c != '\0')
+            continue;
+
+        *p = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            log_warn("failed to create directory '%s' (%s)", dir, strerror(errno));
+            success = 0;
+        }
+        *p = c;
+
+        if (c == '\0')
+            break;
+    }
+
+    free(dir);
+    return success;
+}
+
@@ -0,0 +1,19 @@
+#ifndef FASTBOOT_H
+#define FASTBOOT_H
+
+#include <stdint.h>
+
+// fast boot skips the first frames of a rom (logos, ram clears, waiting on the
+// PPU to warm up) by restoring a snapshot of the machine cached by an earlier
+// launch. snapshots are keyed by the rom hash and the cart's power-on PRG RAM,
+// so a battery save changing invalidates them.
+//
+// must be called straight after device_load_cart. on a cache miss the frames
+// are emulated and the result is cached for next time
+int fastboot_run(const char* cache_dir, uint32_t frames);
+
+// $XDG_CACHE_HOME/poNES, falling back to ~/.cache/poNES. caller frees
+char* fastboot_get_default_cache_dir(void);
+
+#endif
+
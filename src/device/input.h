@@ -0,0 +1,23 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+
+typedef enum {
+    kINPUT_UP      = 0,
+    kINPUT_DOWN    = 1,
+    kINPUT_LEFT    = 2,
+    kINPUT_RIGHT   = 3,
+    kINPUT_A       = 4,
+    kINPUT_B       = 5,
+    kINPUT_START   = 6,
+    kINPUT_SELECT  = 7,
+    kINPUT_SIZE,
+} Input;
+
+typedef uint8_t InputFlags;
+
+#define INPUT_PORT_COUNT 2
+
+#endif
+
@@ -1,5 +1,6 @@
 #include "mapper.h"
 
+#include "device/memory_map.h"
 #include "log.h"
 
 CartMapper mapper_get_type(uint16_t mapper_num) {
@@ -13,9 +14,12 @@ CartMapper mapper_get_type(uint16_t mapper_num) {
     }
 }
 
-uint16_t mapper_get_start_addr(CartMapper mapper) {
+size_t mapper_get_prg_rom_offset(CartMapper mapper, uint16_t addr, size_t prg_rom_size) {
     switch (mapper) {
-        case kCARTMAPPER_NROM:      return 0x8000;
+        // 16KB carts are mirrored into $C000-$FFFF
+        case kCARTMAPPER_NROM:      return (addr - CART_ROM_BANK_START) % prg_rom_size;
         case kCARTMAPPER_UNKNOWN:   return 0;
     }
+
+    return 0;
 }
@@ -2,6 +2,7 @@
 #define MAPPER_H
 
 #include <stdint.h>
+#include <stdlib.h>
 
 typedef enum {
     kCARTMAPPER_NROM        = 0,
@@ -9,7 +10,8 @@ typedef enum {
 } CartMapper;
 
 CartMapper mapper_get_type(uint16_t mapper_num);
-uint16_t mapper_get_start_addr(CartMapper mapper);
+// translates a cpu address in $8000-$FFFF into an offset within PRG ROM
+size_t mapper_get_prg_rom_offset(CartMapper mapper, uint16_t addr, size_t prg_rom_size);
 
 #endif
 
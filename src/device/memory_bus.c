@@ -5,6 +5,7 @@
 #include "ppu/ppu_reg.h"
 #include "cpu.h"
 #include "cart/cart.h"
+#include "device.h"
 
 #include "log.h"
 
@@ -27,20 +28,25 @@ int memory_bus_read(uint16_t addr, void* out, size_t n) {
 
     uint8_t* buf = (uint8_t*)out;
     for (size_t i = 0; i < n; ++i) {
-        const BusLocation location = _get_bus_location(addr);
+        const uint16_t byte_addr    = addr + i;
+        const BusLocation location  = _get_bus_location(byte_addr);
+        int success                 = 0;
         switch (location) {
-            case kBUS_LOCATION_RAM:         return ram_read8(addr, buf+i);
-            case kBUS_LOCATION_PPU_REG:     return ppu_reg_read8(addr, buf+i);
-            case kBUS_LOCATION_APU_IO_REG:  return cpu_apu_io_reg_read8(addr, buf+i);
-            case kBUS_LOCATION_UNMAPPED:    return cart_read8(addr, buf+i);
+            case kBUS_LOCATION_RAM:         success = ram_read8(byte_addr, buf+i); break;
+            case kBUS_LOCATION_PPU_REG:     success = ppu_reg_read8(byte_addr, buf+i); break;
+            case kBUS_LOCATION_APU_IO_REG:  success = cpu_apu_io_reg_read8(byte_addr, buf+i); break;
+            case kBUS_LOCATION_UNMAPPED:    success = cart_read8(g_device.cart, byte_addr, buf+i); break;
 
             default:
-                log_error("attempted to read from memory not mapped in the bus (0x%04X)", addr);
+                log_error("attempted to read from memory not mapped in the bus (0x%04X)", byte_addr);
                 break;
         }
+
+        if (! success)
+            return 0;
     }
 
-    return 0;
+    return 1;
 }
 
 int memory_bus_write(uint16_t addr, const void* in, size_t n) {
@@ -51,20 +57,25 @@ int memory_bus_write(uint16_t addr, const void* in, size_t n) {
 
     const uint8_t* buf = (const uint8_t*)in;
     for (size_t i = 0; i < n; ++i) {
-        const BusLocation location = _get_bus_location(addr);
+        const uint16_t byte_addr    = addr + i;
+        const BusLocation location  = _get_bus_location(byte_addr);
+        int success                 = 0;
         switch (location) {
-            case kBUS_LOCATION_RAM:         return ram_write8(addr, buf+i);
-            case kBUS_LOCATION_PPU_REG:     return ppu_reg_write8(addr, buf+i);
-            case kBUS_LOCATION_APU_IO_REG:  return cpu_apu_io_reg_write8(addr, buf+i);
-            case kBUS_LOCATION_UNMAPPED:    return cart_write8(addr, buf+i);
+            case kBUS_LOCATION_RAM:         success = ram_write8(byte_addr, buf+i); break;
+            case kBUS_LOCATION_PPU_REG:     success = ppu_reg_write8(byte_addr, buf+i); break;
+            case kBUS_LOCATION_APU_IO_REG:  success = cpu_apu_io_reg_write8(byte_addr, buf+i); break;
+            case kBUS_LOCATION_UNMAPPED:    success = cart_write8(g_device.cart, byte_addr, buf+i); break;
 
             default:
-                log_error("attempted to read from memory not mapped in the bus (0x%04X)", addr);
+                log_error("attempted to write to memory not mapped in the bus (0x%04X)", byte_addr);
                 break;
         }
+
+        if (! success)
+            return 0;
     }
 
-    return 0;
+    return 1;
 }
 
 static inline BusLocation _get_bus_location(uint16_t addr) {
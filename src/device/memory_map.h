@@ -1,7 +1,7 @@
 #ifndef MEMORY_MAP_H
 #define MEMORY_MAP_H
 
-#define MEMORY_SIZE                 0xFFFF
+#define MEMORY_SIZE                 0x10000
 
 // memory map from https://www.nesdev.org/wiki/CPU_memory_map
 #define INTERNAL_RAM_START          0x0000
@@ -33,9 +33,18 @@
 #define UNMAPPED_END                0xFFFF
 #define UNMAPPED_SIZE               0xBFE0
 
+#define CART_PRG_RAM_START          0x6000
+#define CART_PRG_RAM_END            0x7FFF
+#define CART_PRG_RAM_SIZE           0x2000
+
 #define CART_ROM_BANK_START         0x8000
 #define CART_ROM_BANK_END           0xFFFF
 #define CART_ROM_BANK_SIZE          0x8000
 
+// interrupt vectors from https://www.nesdev.org/wiki/CPU_memory_map
+#define NMI_VECTOR                  0xFFFA
+#define RESET_VECTOR                0xFFFC
+#define IRQ_VECTOR                  0xFFFE
+
 #endif
 
@@ -0,0 +1,207 @@
+#include "movie.h"
+
+#include "device.h"
+#include "log.h"
+
+#include <errno.h>
+#include <string.h>
+
+#define MOVIE_MAGIC DEVICE_STATE_TAG('P','N','M','V')
+
+typedef struct {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    frame_size;
+    uint32_t    cart_crc32;
+    uint32_t    frame_count;
+    uint64_t    power_on_seed;
+    uint8_t     ram_pattern;
+    uint8_t     padding[7];
+} MovieHeader;
+
+static inline void _power_on(const Movie* movie);
+static inline void _apply_frame(const MovieFrame* frame);
+static inline MovieHeader _make_header(const Movie* movie);
+
+int movie_record(Movie* movie, const char* path) {
+    if (g_device.cart == NULL) {
+        log_error("can't record a movie without a cart");
+        return 0;
+    }
+
+    *movie = (Movie) {
+        .file           = fopen(path, "wb"),
+        .cart_crc32     = g_device.cart->crc32,
+        .ram_pattern    = g_device.ram_pattern,
+        .power_on_seed  = g_device.power_on_seed,
+    };
+
+    if (movie->file == NULL) {
+        log_error("failed to record movie to '%s' (%s)", path, strerror(errno));
+        return 0;
+    }
+
+    // the frame count is filled in on close
+    const MovieHeader header = _make_header(movie);
+    if (fwrite(&header, sizeof(header), 1, movie->file) != 1) {
+        log_error("failed to record movie to '%s' (failed to write header)", path);
+        movie_close(movie);
+        return 0;
+    }
+
+    _power_on(movie);
+
+    log_info("recording movie to '%s'", path);
+    return 1;
+}
+
+void movie_record_frame(Movie* movie, uint8_t events, const InputFlags* inputs) {
+    MovieFrame frame = { .events = events };
+    memcpy(frame.inputs, inputs, sizeof(frame.inputs));
+
+    _apply_frame(&frame);
+
+    if (movie->file != NULL && fwrite(&frame, sizeof(frame), 1, movie->file) == 1)
+        ++movie->frame_count;
+}
+
+int movie_load(Movie* movie, const char* path) {
+    *movie = (Movie) { 0 };
+
+    int success = 0;
+    FILE* f     = fopen(path, "rb");
+    if (f == NULL) {
+        log_error("failed to load movie '%s' (%s)", path, strerror(errno));
+        goto bail;
+    }
+
+    MovieHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != MOVIE_MAGIC) {
+        log_error("failed to load movie '%s' (not a movie)", path);
+        goto bail;
+    }
+
+    if (header.version != MOVIE_VERSION || header.frame_size != sizeof(MovieFrame)) {
+        log_error("failed to load movie '%s' (unsupported version '%u')", path, header.version);
+        goto bail;
+    }
+
+    if (header.ram_pattern >= kRAMPATTERN_COUNT) {
+        log_error("failed to load movie '%s' (unknown ram pattern '%u')", path, header.ram_pattern);
+        goto bail;
+    }
+
+    // a recording which never got closed (eg. the emulator crashed) has no
+    // frame count, so fall back on however many frames made it to disk
+    fseek(f, 0, SEEK_END);
+    const long data_size        = ftell(f) - (long)sizeof(header);
+    const uint32_t stored_count = data_size / sizeof(MovieFrame);
+    fseek(f, sizeof(header), SEEK_SET);
+
+    uint32_t frame_count = header.frame_count;
+    if (frame_count == 0 || frame_count > stored_count) {
+        if (frame_count != 0)
+            log_warn("movie '%s' is truncated (%u of %u frames)", path, stored_count, frame_count);
+
+        frame_count = stored_count;
+    }
+
+    movie->frames = malloc(sizeof(MovieFrame) * (frame_count > 0 ? frame_count : 1));
+    if (fread(movie->frames, sizeof(MovieFrame), frame_count, f) != frame_count) {
+        log_error("failed to load movie '%s' (failed to read frames)", path);
+        goto bail;
+    }
+
+    movie->frame_count      = frame_count;
+    movie->cart_crc32       = header.cart_crc32;
+    movie->ram_pattern      = header.ram_pattern;
+    movie->power_on_seed    = header.power_on_seed;
+    success                 = 1;
+
+bail:
+    if (f != NULL)
+        fclose(f);
+
+    if (! success)
+        movie_close(movie);
+
+    return success;
+}
+
+int movie_play(Movie* movie) {
+    if (g_device.cart == NULL) {
+        log_error("can't play a movie without a cart");
+        return 0;
+    }
+
+    if (g_device.cart->crc32 != movie->cart_crc32) {
+        log_error("movie is for a different rom (%08X, expected %08X)", movie->cart_crc32, g_device.cart->crc32);
+        return 0;
+    }
+
+    movie->frame = 0;
+    _power_on(movie);
+
+    return 1;
+}
+
+int movie_play_frame(Movie* movie) {
+    if (movie->frames == NULL || movie->frame >= movie->frame_count)
+        return 0;
+
+    _apply_frame(movie->frames + movie->frame++);
+    return 1;
+}
+
+void movie_close(Movie* movie) {
+    if (movie->file != NULL) {
+        const MovieHeader header = _make_header(movie);
+        if (fseek(movie->file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, movie->file) != 1)
+            log_error("failed to finish writing movie");
+
+        fclose(movie->file);
+        log_info("recorded %u frames", movie->frame_count);
+    }
+
+    free(movie->frames);
+    *movie = (Movie) { 0 };
+}
+
+static inline void _power_on(const Movie* movie) {
+    // PRG RAM survives a power cycle, so start it from a known state too. a
+    // mapped save file is left alone, but then the run depends on its contents
+    Cart* cart = g_device.cart;
+    if (cart->prg_ram != NULL) {
+        if (cart->save_fd == -1)
+            memset(cart->prg_ram, 0, cart->prg_ram_size);
+        else
+            log_warn("movie uses a save file, so it may not play back the same elsewhere");
+    }
+
+    device_set_ram_pattern(movie->ram_pattern);
+    device_set_power_on_seed(movie->power_on_seed);
+    device_power_on();
+}
+
+static inline void _apply_frame(const MovieFrame* frame) {
+    if (frame->events & kMOVIE_EVENT_POWER)
+        device_power_on();
+    else if (frame->events & kMOVIE_EVENT_RESET)
+        device_reset();
+
+    for (uint8_t i = 0; i < INPUT_PORT_COUNT; ++i)
+        device_set_inputs(i, frame->inputs[i]);
+}
+
+static inline MovieHeader _make_header(const Movie* movie) {
+    return (MovieHeader) {
+        .magic          = MOVIE_MAGIC,
+        .version        = MOVIE_VERSION,
+        .frame_size     = sizeof(MovieFrame),
+        .cart_crc32     = movie->cart_crc32,
+        .frame_count    = movie->frame_count,
+        .power_on_seed  = movie->power_on_seed,
+        .ram_pattern    = movie->ram_pattern,
+    };
+}
+
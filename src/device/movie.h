@@ -0,0 +1,54 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "input.h"
+#include "ram.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// movies record the inputs and reset/power events for every frame from power
+// on, along with the RAM pattern and seed, so playing one back reproduces the run exactly
+#define MOVIE_VERSION 2
+
+typedef enum {
+    kMOVIE_EVENT_RESET  = 1 << 0,
+    kMOVIE_EVENT_POWER  = 1 << 1,
+} MovieEvent;
+
+typedef struct __attribute__((__packed__)) {
+    uint8_t     events;
+    InputFlags  inputs[INPUT_PORT_COUNT];
+} MovieFrame;
+
+typedef struct {
+    FILE*           file;       // only while recording
+    MovieFrame*     frames;     // only while playing back
+    uint32_t        frame_count;
+    uint32_t        frame;
+    uint32_t        cart_crc32;
+    RAMPattern      ram_pattern;
+    uint64_t        power_on_seed;
+} Movie;
+
+// power cycles the device and starts recording to path
+int movie_record(Movie* movie, const char* path);
+// applies the events and inputs to the device and appends them to the movie.
+// call once before each emulated frame
+void movie_record_frame(Movie* movie, uint8_t events, const InputFlags* inputs);
+
+// reads the whole movie into memory, ready for movie_play
+int movie_load(Movie* movie, const char* path);
+// checks the movie was made with the loaded cart and power cycles the device
+// with the movie's seed
+int movie_play(Movie* movie);
+// applies the next frame's events and inputs to the device. call once before
+// each emulated frame, returns 0 once the movie has finished
+int movie_play_frame(Movie* movie);
+
+// finishes writing a recording, and frees everything
+void movie_close(Movie* movie);
+
+#endif
+
@@ -1,6 +1,7 @@
 #include "ppu.h"
 
 #include "ppu_reg.h"
+#include "ppu_memory_bus.h"
 #include "color_palette.h"
 #include "device/memory_map.h"
 #include "helpers.h"
@@ -9,8 +10,6 @@
 
 #include <string.h>
 
-#define VIDEO_BUFFER_SIZE VIDEO_BUFFER_WIDTH*VIDEO_BUFFER_HEIGHT
-
 typedef struct __attribute__((__packed__)) {
     uint8_t pos_y;
     uint8_t tile_idx;
@@ -19,22 +18,165 @@ typedef struct __attribute__((__packed__)) {
 } OAMSprite;
 
 #define OAM_SPRITE_COUNT 64
-static OAMSprite s_oam[OAM_SPRITE_COUNT];
+static _Thread_local OAMSprite s_oam[OAM_SPRITE_COUNT];
+
+// frames are drawn into the triple buffer's back slot, which is published
+// once it's complete. the buffers are thread local, but stay valid for other
+// threads for as long as this one runs, so a frontend on another thread reads
+// them in place. none of this is machine state, so it isn't saved or restored
+#define VIDEO_BUFFER_COUNT 3
+
+static _Thread_local struct {
+    VideoFrame          buffers[VIDEO_BUFFER_COUNT];
+    TripleBuffer        frames;
+    VideoFrame*         back;
+    const VideoFrame*   ready;
+    uint64_t            completed;
+    uint64_t            tag;
+} s_video;
+
+// NTSC frame timing from https://www.nesdev.org/wiki/PPU_rendering
+#define DOTS_PER_SCANLINE       341
+#define SCANLINES_PER_FRAME     262
+#define VBLANK_SCANLINE         241
+#define PRE_RENDER_SCANLINE     261
+#define DOTS_PER_FRAME          (DOTS_PER_SCANLINE*SCANLINES_PER_FRAME)
+
+// the dots ppu_cycle acts on when not rendering, as offsets into the frame
+#define VBLANK_START_DOT        (VBLANK_SCANLINE*DOTS_PER_SCANLINE + 1)
+#define VBLANK_END_DOT          (PRE_RENDER_SCANLINE*DOTS_PER_SCANLINE + 1)
 
-static uint32_t s_video_buffer[VIDEO_BUFFER_SIZE];
+static _Thread_local struct {
+    uint16_t    dot;
+    uint16_t    scanline;
+    uint64_t    frame;
+} s_timing;
+
+static _Thread_local int s_output_enabled = 1;
+
+static inline uint32_t _dots_until_event(uint32_t pos);
+static inline void _complete_frame(void);
 
 void ppu_init(void) {
-    memset(s_video_buffer, 0, sizeof(s_video_buffer[0])*VIDEO_BUFFER_SIZE);
+    // the triple buffer is only set up once per thread, as a consumer could
+    // be holding onto a frame across power cycles
+    if (s_video.back == NULL) {
+        triple_buffer_init(&s_video.frames, &s_video.buffers[0], &s_video.buffers[1], &s_video.buffers[2]);
+        s_video.back    = triple_buffer_get_back(&s_video.frames);
+        s_video.ready   = &s_video.buffers[2];
+    }
+
+    memset(s_video.back, 0, sizeof(*s_video.back));
+    memset(s_oam, 0, sizeof(s_oam));
+    memset(&s_timing, 0, sizeof(s_timing));
 
     ppu_reg_init();
+    ppu_memory_bus_init();
 }
 
 void ppu_cycle(void) {
-    // TODO
+    // TODO: rendering. for now only the vblank timing is emulated, which is
+    // enough for games to get past their boot time PPUSTATUS polling
+    if (s_timing.dot == 1) {
+        if (s_timing.scanline == VBLANK_SCANLINE) {
+            ppu_set_vblank(1);
+            ++s_timing.frame;
+
+            if (s_output_enabled)
+                _complete_frame();
+        } else if (s_timing.scanline == PRE_RENDER_SCANLINE) {
+            ppu_set_vblank(0);
+            ppu_set_sprite_0_hit(0);
+            ppu_set_sprite_overflow(0);
+        }
+    }
+
+    if (++s_timing.dot == DOTS_PER_SCANLINE) {
+        s_timing.dot = 0;
+        if (++s_timing.scanline == SCANLINES_PER_FRAME)
+            s_timing.scanline = 0;
+    }
 }
 
+void ppu_run(uint32_t dots) {
+    if (s_output_enabled) {
+        for (uint32_t i = 0; i < dots; ++i)
+            ppu_cycle();
+        return;
+    }
+
+    while (dots > 0) {
+        const uint32_t pos  = s_timing.scanline*DOTS_PER_SCANLINE + s_timing.dot;
+        const uint32_t skip = _dots_until_event(pos);
+        if (skip >= dots) {
+            // nothing happens in what's left, so just move along
+            const uint32_t next = (pos + dots) % DOTS_PER_FRAME;
+            s_timing.scanline   = next / DOTS_PER_SCANLINE;
+            s_timing.dot        = next % DOTS_PER_SCANLINE;
+            return;
+        }
+
+        const uint32_t next = pos + skip;
+        s_timing.scanline   = next / DOTS_PER_SCANLINE;
+        s_timing.dot        = next % DOTS_PER_SCANLINE;
+
+        ppu_cycle();
+        dots -= skip + 1;
+    }
+}
+
+void ppu_set_output_enabled(int enabled) {
+    s_output_enabled = enabled;
+}
+
+uint64_t ppu_get_frame(void) {
+    return s_timing.frame;
+}
 
-const uint32_t* ppu_get_buffer(void) {
-    return s_video_buffer;
+void* ppu_get_oam_state(size_t* size) {
+    *size = sizeof(s_oam);
+    return s_oam;
 }
 
+void* ppu_get_timing_state(size_t* size) {
+    *size = sizeof(s_timing);
+    return &s_timing;
+}
+
+
+const uint32_t* ppu_get_ready_buffer(uint64_t* frame_id) {
+    if (frame_id != NULL)
+        *frame_id = s_video.completed;
+
+    return s_video.ready->pixels;
+}
+
+TripleBuffer* ppu_get_frames(void) {
+    return &s_video.frames;
+}
+
+void ppu_set_frame_tag(uint64_t tag) {
+    s_video.tag = tag;
+}
+
+uint64_t ppu_get_frame_tag(void) {
+    return s_video.tag;
+}
+
+static inline uint32_t _dots_until_event(uint32_t pos) {
+    if (pos <= VBLANK_START_DOT)
+        return VBLANK_START_DOT - pos;
+    if (pos <= VBLANK_END_DOT)
+        return VBLANK_END_DOT - pos;
+
+    return DOTS_PER_FRAME - pos + VBLANK_START_DOT;
+}
+
+static inline void _complete_frame(void) {
+    s_video.back->id    = ++s_video.completed;
+    s_video.back->tag   = s_video.tag;
+    s_video.ready       = s_video.back;
+
+    triple_buffer_publish(&s_video.frames);
+    s_video.back = triple_buffer_get_back(&s_video.frames);
+}
@@ -1,15 +1,47 @@
 #ifndef PPU_H
 #define PPU_H
 
+#include "triple_buffer.h"
+
 #include <stdint.h>
+#include <stdlib.h>
 
 #define VIDEO_BUFFER_WIDTH  256
 #define VIDEO_BUFFER_HEIGHT 240
 
+// a frame as it's drawn and handed over
+typedef struct {
+    uint32_t    pixels[VIDEO_BUFFER_WIDTH*VIDEO_BUFFER_HEIGHT];
+    uint64_t    id;     // counts up with each completed frame
+    uint64_t    tag;    // the frame tag as it was when the frame completed
+} VideoFrame;
+
 void ppu_init(void);
 void ppu_cycle(void);
+// runs the ppu for a number of dots. with output disabled, only the dots where
+// something visible to the cpu happens are stepped, and the rest are skipped
+void ppu_run(uint32_t dots);
+
+// pixel output, on by default. turning it off keeps register and vblank timing
+void ppu_set_output_enabled(int enabled);
+
+// number of frames which have reached vblank since power on
+uint64_t ppu_get_frame(void);
+
+// raw state for snapshotting
+void* ppu_get_oam_state(size_t* size);
+void* ppu_get_timing_state(size_t* size);
 
-const uint32_t* ppu_get_buffer(void);
+// the most recently completed frame, which stays untouched until the next one
+// completes. frame_id changes whenever a new frame completes. frames are only
+// completed while output is enabled
+const uint32_t* ppu_get_ready_buffer(uint64_t* frame_id);
+// frames are drawn straight into the triple buffer's back slot and published
+// as they complete, so another thread can pick them up without a copy
+TripleBuffer* ppu_get_frames(void);
+// stamped onto frames as they complete, eg. to tell which inputs made them
+void ppu_set_frame_tag(uint64_t tag);
+uint64_t ppu_get_frame_tag(void);
 
 #endif
 
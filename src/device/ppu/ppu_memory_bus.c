@@ -1,9 +1,12 @@
 #include "ppu_memory_bus.h"
 
 #include "ppu_memory_map.h"
+#include "device/device.h"
 
 #include "log.h"
 
+#include <string.h>
+
 typedef enum {
     kPPU_BUS_LOCATION_PATTERN_TABLE_0,
     kPPU_BUS_LOCATION_PATTERN_TABLE_1,
@@ -17,7 +20,27 @@ typedef enum {
     kPPU_BUS_LOCATION_UNKNOWN,
 } PPUBusLocation;
 
+static _Thread_local uint8_t s_vram[NAMETABLE_VRAM_SIZE];
+static _Thread_local uint8_t s_palette_ram[PALETTE_RAM_INDICES_SIZE];
+
 static inline PPUBusLocation _get_ppu_bus_location(uint16_t addr);
+static inline uint16_t _get_vram_idx(uint16_t addr);
+static inline uint16_t _get_palette_idx(uint16_t addr);
+
+void ppu_memory_bus_init(void) {
+    memset(s_vram, 0, sizeof(s_vram));
+    memset(s_palette_ram, 0, sizeof(s_palette_ram));
+}
+
+void* ppu_memory_bus_get_vram_state(size_t* size) {
+    *size = sizeof(s_vram);
+    return s_vram;
+}
+
+void* ppu_memory_bus_get_palette_state(size_t* size) {
+    *size = sizeof(s_palette_ram);
+    return s_palette_ram;
+}
 
 int ppu_memory_bus_read(uint16_t addr, void* out, size_t n) {
     if ((PPU_MEMORY_SIZE - n) < addr) {
@@ -27,29 +50,32 @@ int ppu_memory_bus_read(uint16_t addr, void* out, size_t n) {
 
     uint8_t* buf = (uint8_t*)out;
     for (size_t i = 0; i < n; ++i) {
-        const PPUBusLocation location = _get_ppu_bus_location(addr);
+        const uint16_t byte_addr        = addr + i;
+        const PPUBusLocation location   = _get_ppu_bus_location(byte_addr);
         switch (location) {
             // TODO
             case kPPU_BUS_LOCATION_PATTERN_TABLE_0: return 0;
             case kPPU_BUS_LOCATION_PATTERN_TABLE_1: return 0;
-            case kPPU_BUS_LOCATION_NAMETABLE_0:     return 0;
-            case kPPU_BUS_LOCATION_NAMETABLE_1:     return 0;
-            case kPPU_BUS_LOCATION_NAMETABLE_2:     return 0;
-            case kPPU_BUS_LOCATION_NAMETABLE_3:     return 0;
+            case kPPU_BUS_LOCATION_NAMETABLE_0:
+            case kPPU_BUS_LOCATION_NAMETABLE_1:
+            case kPPU_BUS_LOCATION_NAMETABLE_2:
+            case kPPU_BUS_LOCATION_NAMETABLE_3:
+                buf[i] = s_vram[_get_vram_idx(byte_addr)];
+                break;
             case kPPU_BUS_LOCATION_UNUSED:
-            {
                 buf[i] = 0;
-                return 1;
-            }
-            case kPPU_BUS_LOCATION_PALETTE_RAM:     return 0;
+                break;
+            case kPPU_BUS_LOCATION_PALETTE_RAM:
+                buf[i] = s_palette_ram[_get_palette_idx(byte_addr)];
+                break;
 
             default:
-                log_error("attempted to read from memory not mapped in the PPU bus (0x%04X)", addr);
-                break;
+                log_error("attempted to read from memory not mapped in the PPU bus (0x%04X)", byte_addr);
+                return 0;
         }
     }
 
-    return 0;
+    return 1;
 }
 
 int ppu_memory_bus_write(uint16_t addr, const void* in, size_t n) {
@@ -60,25 +86,31 @@ int ppu_memory_bus_write(uint16_t addr, const void* in, size_t n) {
 
     const uint8_t* buf = (uint8_t*)in;
     for (size_t i = 0; i < n; ++i) {
-        const PPUBusLocation location = _get_ppu_bus_location(addr);
+        const uint16_t byte_addr        = addr + i;
+        const PPUBusLocation location   = _get_ppu_bus_location(byte_addr);
         switch (location) {
             // TODO
             case kPPU_BUS_LOCATION_PATTERN_TABLE_0: return 0;
             case kPPU_BUS_LOCATION_PATTERN_TABLE_1: return 0;
-            case kPPU_BUS_LOCATION_NAMETABLE_0:     return 0;
-            case kPPU_BUS_LOCATION_NAMETABLE_1:     return 0;
-            case kPPU_BUS_LOCATION_NAMETABLE_2:     return 0;
-            case kPPU_BUS_LOCATION_NAMETABLE_3:     return 0;
-            case kPPU_BUS_LOCATION_UNUSED:          return 1;
-            case kPPU_BUS_LOCATION_PALETTE_RAM:     return 0;
+            case kPPU_BUS_LOCATION_NAMETABLE_0:
+            case kPPU_BUS_LOCATION_NAMETABLE_1:
+            case kPPU_BUS_LOCATION_NAMETABLE_2:
+            case kPPU_BUS_LOCATION_NAMETABLE_3:
+                s_vram[_get_vram_idx(byte_addr)] = buf[i];
+                break;
+            case kPPU_BUS_LOCATION_UNUSED:
+                break;
+            case kPPU_BUS_LOCATION_PALETTE_RAM:
+                s_palette_ram[_get_palette_idx(byte_addr)] = buf[i];
+                break;
 
             default:
-                log_error("attempted to write to memory not mapped in the PPU bus (0x%04X)", addr);
-                break;
+                log_error("attempted to write to memory not mapped in the PPU bus (0x%04X)", byte_addr);
+                return 0;
         }
     }
 
-    return 0;
+    return 1;
 }
 
 static inline PPUBusLocation _get_ppu_bus_location(uint16_t addr) {
@@ -103,3 +135,26 @@ static inline PPUBusLocation _get_ppu_bus_location(uint16_t addr) {
 
     return kPPU_BUS_LOCATION_UNKNOWN;
 }
+
+static inline uint16_t _get_vram_idx(uint16_t addr) {
+    const uint16_t offset = (addr - NAMETABLE_0_START) % (NAMETABLE_0_SIZE*4);
+
+    // horizontal mirroring pairs up nametables 0/1 and 2/3, vertical pairs up
+    // 0/2 and 1/3. without a cart, default to horizontal
+    const Cart* cart = g_device.cart;
+    if (cart != NULL && cart->mirroring == kCARTMIRRORING_VERTICAL)
+        return offset % NAMETABLE_VRAM_SIZE;
+
+    return ((offset / (NAMETABLE_0_SIZE*2)) * NAMETABLE_0_SIZE) + (offset % NAMETABLE_0_SIZE);
+}
+
+static inline uint16_t _get_palette_idx(uint16_t addr) {
+    uint16_t idx = (addr - PALETTE_RAM_INDICES_START) % PALETTE_RAM_INDICES_SIZE;
+
+    // the backdrop entries of the sprite palettes ($3F10/$3F14/$3F18/$3F1C)
+    // mirror the ones of the background palettes
+    if ((idx & 0x13) == 0x10)
+        idx &= ~0x10;
+
+    return idx;
+}
@@ -4,8 +4,13 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+void ppu_memory_bus_init(void);
 int ppu_memory_bus_read(uint16_t addr, void* out, size_t n);
 int ppu_memory_bus_write(uint16_t addr, const void* in, size_t n);
 
+// raw state for snapshotting
+void* ppu_memory_bus_get_vram_state(size_t* size);
+void* ppu_memory_bus_get_palette_state(size_t* size);
+
 #endif
 
@@ -13,7 +13,7 @@
 #define PATTERN_TABLE_1_SIZE                0x1000
 
 #define NAMETABLE_0_START                   0x2000
-#define NAMETABLE_0_END                     0x23BF
+#define NAMETABLE_0_END                     0x23FF
 #define NAMETABLE_0_SIZE                    0x0400
 #define NAMETABLE_1_START                   0x2400
 #define NAMETABLE_1_END                     0x27FF
@@ -25,6 +25,10 @@
 #define NAMETABLE_3_END                     0x2FFF
 #define NAMETABLE_3_SIZE                    0x0400
 
+// the console only has 2KB of VRAM for nametables, so two of the four are
+// always mirrors depending on how the cart is wired
+#define NAMETABLE_VRAM_SIZE                 0x0800
+
 #define UNUSED_START                        0x3000
 #define UNUSED_END                          0x3EFF
 #define UNUSED_SIZE                         0x0F00
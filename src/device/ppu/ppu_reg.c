@@ -1,5 +1,6 @@
 #include "ppu_reg.h"
 
+#include "device/cpu.h"
 #include "device/memory_map.h"
 #include "helpers.h"
 
@@ -46,7 +47,7 @@ typedef enum {
     kPPUSTATUS_VBLANK             = 7,
 } PPUSTATUSFlag;
 
-static struct {
+static _Thread_local struct {
     uint8_t     ppu_ctrl;
     uint8_t     ppu_mask;
     uint8_t     ppu_status;
@@ -57,7 +58,7 @@ static struct {
     uint16_t    ppu_addr;
 } s_regs;
 
-static struct {
+static _Thread_local struct {
     unsigned vram_addr      : 15;
     unsigned temp_vram_addr : 15;
     unsigned fine_x_scroll  : 3;
@@ -70,6 +71,12 @@ static inline uint16_t _transform_addr(uint16_t addr) {
     return PPU_REG_START + addr;
 }
 
+// the ppu holds the cpu's nmi line for as long as it's in vblank with nmi
+// enabled, so turning nmi on partway through vblank fires one straight away
+static inline void _update_nmi(void) {
+    cpu_set_nmi_line(read_bit(s_regs.ppu_ctrl, kPPUCTRL_VBLANK_NMI) && read_bit(s_regs.ppu_status, kPPUSTATUS_VBLANK));
+}
+
 void ppu_reg_init(void) {
     s_regs.ppu_ctrl     = 0;
     s_regs.ppu_mask     = 0;
@@ -82,6 +89,16 @@ void ppu_reg_init(void) {
     s_internal_regs.write_latch = 0;
 }
 
+void* ppu_reg_get_state(size_t* size) {
+    *size = sizeof(s_regs);
+    return &s_regs;
+}
+
+void* ppu_reg_get_internal_state(size_t* size) {
+    *size = sizeof(s_internal_regs);
+    return &s_internal_regs;
+}
+
 int ppu_reg_read8(uint16_t addr, uint8_t* out) {
     (void)out;
     switch (_transform_addr(addr)) {
@@ -126,6 +143,7 @@ int ppu_reg_write8(uint16_t addr, const uint8_t* in) {
     switch (_transform_addr(addr)) {
         case REG_PPUCTRL:
             s_regs.ppu_ctrl = *in;
+            _update_nmi();
             break;
         case REG_PPUMASK:
             s_regs.ppu_mask = *in;
@@ -271,6 +289,7 @@ void ppu_set_sprite_0_hit(int value) {
 
 void ppu_set_vblank(int value) {
     write_bit(&s_regs.ppu_status, kPPUSTATUS_VBLANK, value);
+    _update_nmi();
 }
 
 uint8_t ppu_get_oam_addr(void) {
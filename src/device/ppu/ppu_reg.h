@@ -2,6 +2,7 @@
 #define PPU_REG_H
 
 #include <stdint.h>
+#include <stdlib.h>
 
 typedef enum {
     kSPRITE_SIZE_8x8,
@@ -17,6 +18,10 @@ void ppu_reg_init(void);
 int ppu_reg_read8(uint16_t addr, uint8_t* out);
 int ppu_reg_write8(uint16_t addr, const uint8_t* in);
 
+// raw state for snapshotting
+void* ppu_reg_get_state(size_t* size);
+void* ppu_reg_get_internal_state(size_t* size);
+
 // PPUCTRL
 uint16_t ppu_get_base_nametable_addr(void);
 uint16_t ppu_get_vram_addr_increment(void);
@@ -0,0 +1,38 @@
+#include "triple_buffer.h"
+
+#include <string.h>
+
+#define TRIPLE_BUFFER_FRESH 0x4u
+#define TRIPLE_BUFFER_INDEX_MASK 0x3u
+
+void triple_buffer_init(TripleBuffer* tb, void* a, void* b, void* c) {
+    memset(tb, 0, sizeof(*tb));
+
+    tb->buffers[0]  = a;
+    tb->buffers[1]  = b;
+    tb->buffers[2]  = c;
+    tb->back        = 0;
+    tb->front       = 2;
+    atomic_init(&tb->middle, 1);
+}
+
+void* triple_buffer_get_back(TripleBuffer* tb) {
+    return tb->buffers[tb->back];
+}
+
+void triple_buffer_publish(TripleBuffer* tb) {
+    // release makes the frame visible along with the index, acquire makes sure
+    // the consumer is done with the buffer we take back
+    const unsigned prev = atomic_exchange_explicit(&tb->middle, tb->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+    tb->back = prev & TRIPLE_BUFFER_INDEX_MASK;
+}
+
+const void* triple_buffer_acquire(TripleBuffer* tb) {
+    if (! (atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH))
+        return NULL;
+
+    const unsigned prev = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+    tb->front = prev & TRIPLE_BUFFER_INDEX_MASK;
+
+    return tb->buffers[tb->front];
+}
@@ -0,0 +1,30 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// lock-free hand off of frames from one producer thread to one consumer thread.
+// the producer always has a buffer of its own to write into and the consumer
+// always has the newest published one, so neither side ever waits on the other.
+// frames the consumer is too slow to pick up are overwritten
+typedef struct {
+    void*       buffers[3];
+    atomic_uint middle; // index of the buffer between the two sides, flagged when it holds a new frame
+    unsigned    back;   // producer only
+    unsigned    front;  // consumer only
+} TripleBuffer;
+
+// lays the triple buffer over three buffers owned by the caller, which have
+// to outlive it
+void triple_buffer_init(TripleBuffer* tb, void* a, void* b, void* c);
+
+// producer: the buffer to write the next frame into, then hand it over
+void* triple_buffer_get_back(TripleBuffer* tb);
+void triple_buffer_publish(TripleBuffer* tb);
+
+// consumer: the newest published frame, or NULL if nothing has been published
+// since the last call. stays valid until the next call
+const void* triple_buffer_acquire(TripleBuffer* tb);
+
+#endif
@@ -2,13 +2,41 @@
 
 #include "memory_map.h"
 #include "helpers.h"
+#include "log.h"
 
-static uint8_t s_ram[INTERNAL_RAM_SIZE];
+#include <string.h>
+
+static _Thread_local uint8_t s_ram[INTERNAL_RAM_SIZE];
+
+static const char* s_pattern_names[kRAMPATTERN_COUNT] = {
+    [kRAMPATTERN_ZERO]      = "zero",
+    [kRAMPATTERN_ONES]      = "ff",
+    [kRAMPATTERN_FCEUX]     = "fceux",
+    [kRAMPATTERN_RANDOM]    = "random",
+};
 
 static inline uint16_t _transform_addr(uint16_t addr);
 
-void ram_init(void) {
-    randomise_buffer(s_ram, INTERNAL_RAM_SIZE);
+void ram_init(RAMPattern pattern, uint64_t seed) {
+    switch (pattern) {
+        case kRAMPATTERN_ZERO:
+            memset(s_ram, 0x00, INTERNAL_RAM_SIZE);
+            break;
+        case kRAMPATTERN_ONES:
+            memset(s_ram, 0xFF, INTERNAL_RAM_SIZE);
+            break;
+        case kRAMPATTERN_FCEUX:
+            for (size_t i = 0; i < INTERNAL_RAM_SIZE; ++i)
+                s_ram[i] = (i & 0x04) ? 0xFF : 0x00;
+            break;
+        case kRAMPATTERN_RANDOM:
+            randomise_buffer(s_ram, INTERNAL_RAM_SIZE, seed);
+            break;
+
+        default:
+            log_error("unknown ram pattern '%d'", pattern);
+            break;
+    }
 }
 
 int ram_read8(uint16_t addr, uint8_t* out) {
@@ -25,6 +53,29 @@ int ram_write8(uint16_t addr, const uint8_t* in) {
     return 1;
 }
 
+void* ram_get_state(size_t* size) {
+    *size = sizeof(s_ram);
+    return s_ram;
+}
+
+const char* ram_pattern_name(RAMPattern pattern) {
+    if (pattern >= kRAMPATTERN_COUNT)
+        return "unknown";
+
+    return s_pattern_names[pattern];
+}
+
+int ram_pattern_from_name(const char* name, RAMPattern* out) {
+    for (int i = 0; i < kRAMPATTERN_COUNT; ++i) {
+        if (strcmp(name, s_pattern_names[i]) == 0) {
+            *out = (RAMPattern)i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 static inline uint16_t _transform_addr(uint16_t addr) {
     addr -= INTERNAL_RAM_START;
     return addr % INTERNAL_RAM_SIZE;
@@ -4,9 +4,27 @@
 #include <stdint.h>
 #include <stdlib.h>
 
-void ram_init(void);
+// what RAM holds at power on. real hardware is somewhere between all of these,
+// and games that read RAM before writing it behave differently on each
+typedef enum {
+    kRAMPATTERN_ZERO = 0,
+    kRAMPATTERN_ONES,   // all 0xFF
+    kRAMPATTERN_FCEUX,  // 4 bytes of 0x00 then 4 of 0xFF, repeating
+    kRAMPATTERN_RANDOM, // seeded, so still repeatable
+    kRAMPATTERN_COUNT,
+} RAMPattern;
+
+// seed is only used by kRAMPATTERN_RANDOM
+void ram_init(RAMPattern pattern, uint64_t seed);
 int ram_read8(uint16_t addr, uint8_t* out);
 int ram_write8(uint16_t addr, const uint8_t* in);
 
+// raw state for snapshotting
+void* ram_get_state(size_t* size);
+
+const char* ram_pattern_name(RAMPattern pattern);
+// parses a pattern name as given by ram_pattern_name, returning 0 if unknown
+int ram_pattern_from_name(const char* name, RAMPattern* out);
+
 #endif
 
@@ -0,0 +1,271 @@
+#include "rewind.h"
+
+#include "savestate.h"
+#include "log.h"
+
+#include <string.h>
+
+// bounds the number of snapshots in the ring, regardless of how well they
+// compress, so the entry table stays a fraction of the buffer size
+#define MIN_ENTRY_SIZE 32
+
+typedef struct {
+    uint32_t    offset;
+    uint32_t    size;
+} RewindEntry;
+
+typedef struct {
+    uint8_t*        buffer;
+    size_t          capacity;
+    size_t          used;
+    RewindEntry*    entries;
+    size_t          max_entries;
+    size_t          head;           // index of the oldest entry
+    size_t          count;
+    uint32_t        interval;
+    uint32_t        frame;
+
+    // the raw state of the newest entry, which every delta is unwound from
+    uint8_t*        prev_state;
+    uint8_t*        cur_state;
+    uint8_t*        scratch;
+    size_t          state_size;
+} RewindState;
+
+static RewindState s_rewind;
+
+static inline size_t _encode(const uint8_t* a, const uint8_t* b, size_t size, uint8_t* out);
+static inline int _decode_xor(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_size);
+static inline size_t _write_varint(uint8_t* out, size_t value);
+static inline size_t _read_varint(const uint8_t* in, size_t in_size, size_t* value);
+static inline int _push(const uint8_t* data, size_t size);
+static inline void _drop_oldest(void);
+
+int rewind_init(size_t capacity, uint32_t interval_frames) {
+    if (capacity < MIN_ENTRY_SIZE || capacity > UINT32_MAX || interval_frames == 0) {
+        log_error("failed to init rewind (invalid capacity/interval)");
+        return 0;
+    }
+
+    s_rewind = (RewindState) {
+        .buffer         = malloc(capacity),
+        .capacity       = capacity,
+        .max_entries    = capacity / MIN_ENTRY_SIZE,
+        .interval       = interval_frames,
+    };
+    s_rewind.entries = malloc(sizeof(s_rewind.entries[0])*s_rewind.max_entries);
+
+    rewind_reset();
+    return 1;
+}
+
+void rewind_cleanup(void) {
+    free(s_rewind.buffer);
+    free(s_rewind.entries);
+    free(s_rewind.prev_state);
+    free(s_rewind.cur_state);
+    free(s_rewind.scratch);
+
+    memset(&s_rewind, 0, sizeof(s_rewind));
+}
+
+void rewind_reset(void) {
+    if (s_rewind.buffer == NULL)
+        return;
+
+    s_rewind.used   = 0;
+    s_rewind.head   = 0;
+    s_rewind.count  = 0;
+    s_rewind.frame  = 0;
+
+    const size_t state_size = savestate_get_size();
+    if (state_size != s_rewind.state_size) {
+        // worst case encoding is a literal run per byte pair, plus varints
+        s_rewind.state_size = state_size;
+        s_rewind.prev_state = realloc(s_rewind.prev_state, state_size);
+        s_rewind.cur_state  = realloc(s_rewind.cur_state, state_size);
+        s_rewind.scratch    = realloc(s_rewind.scratch, state_size*2 + 16);
+    }
+
+    memset(s_rewind.prev_state, 0, state_size);
+}
+
+void rewind_on_frame(void) {
+    if (s_rewind.buffer == NULL || ++s_rewind.frame < s_rewind.interval)
+        return;
+
+    s_rewind.frame = 0;
+    if (! savestate_write(s_rewind.cur_state, s_rewind.state_size))
+        return;
+
+    // the first entry is diffed against zeros, so it's effectively a keyframe
+    const size_t size = _encode(s_rewind.cur_state, s_rewind.prev_state, s_rewind.state_size, s_rewind.scratch);
+    if (! _push(s_rewind.scratch, size))
+        return;
+
+    uint8_t* tmp            = s_rewind.prev_state;
+    s_rewind.prev_state     = s_rewind.cur_state;
+    s_rewind.cur_state      = tmp;
+}
+
+int rewind_step_back(void) {
+    if (s_rewind.count == 0)
+        return 0;
+
+    if (! savestate_read(s_rewind.prev_state, s_rewind.state_size))
+        return 0;
+
+    // unwind the newest delta to get back to the state before it
+    const size_t newest         = (s_rewind.head + s_rewind.count - 1) % s_rewind.max_entries;
+    const RewindEntry* entry    = s_rewind.entries + newest;
+    if (! _decode_xor(s_rewind.buffer + entry->offset, entry->size, s_rewind.prev_state, s_rewind.state_size)) {
+        log_error("rewind history is corrupt, dropping it");
+        rewind_reset();
+        return 0;
+    }
+
+    s_rewind.used -= entry->size;
+    --s_rewind.count;
+    s_rewind.frame = 0;
+
+    return 1;
+}
+
+size_t rewind_get_snapshot_count(void) {
+    return s_rewind.count;
+}
+
+size_t rewind_get_used_bytes(void) {
+    return s_rewind.used;
+}
+
+static inline size_t _encode(const uint8_t* a, const uint8_t* b, size_t size, uint8_t* out) {
+    // XOR delta as alternating (zero run, literal run) pairs of varint lengths,
+    // with the literal bytes inlined after each pair
+    size_t out_size = 0;
+    size_t i        = 0;
+    while (i < size) {
+        const size_t zero_start = i;
+        while (i + sizeof(uint64_t) <= size) {
+            uint64_t x, y;
+            memcpy(&x, a + i, sizeof(x));
+            memcpy(&y, b + i, sizeof(y));
+            if (x != y)
+                break;
+
+            i += sizeof(uint64_t);
+        }
+
+        while (i < size && a[i] == b[i])
+            ++i;
+
+        const size_t zero_run       = i - zero_start;
+        const size_t literal_start  = i;
+
+        // a single matching byte isn't worth ending the literal run for
+        while (i < size && (a[i] != b[i] || (i + 1 < size && a[i+1] != b[i+1])))
+            ++i;
+
+        const size_t literal_run = i - literal_start;
+        out_size += _write_varint(out + out_size, zero_run);
+        out_size += _write_varint(out + out_size, literal_run);
+        for (size_t j = 0; j < literal_run; ++j)
+            out[out_size + j] = a[literal_start + j] ^ b[literal_start + j];
+
+        out_size += literal_run;
+    }
+
+    return out_size;
+}
+
+static inline int _decode_xor(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_size) {
+    size_t in_offset    = 0;
+    size_t out_offset   = 0;
+    while (in_offset < in_size) {
+        size_t zero_run, literal_run;
+        const size_t zero_len       = _read_varint(in + in_offset, in_size - in_offset, &zero_run);
+        const size_t literal_len    = zero_len ? _read_varint(in + in_offset + zero_len, in_size - in_offset - zero_len, &literal_run) : 0;
+        if (literal_len == 0)
+            return 0;
+
+        in_offset   += zero_len + literal_len;
+        out_offset  += zero_run;
+        if (out_offset > out_size || literal_run > out_size - out_offset || literal_run > in_size - in_offset)
+            return 0;
+
+        for (size_t j = 0; j < literal_run; ++j)
+            out[out_offset + j] ^= in[in_offset + j];
+
+        in_offset   += literal_run;
+        out_offset  += literal_run;
+    }
+
+    return out_offset == out_size;
+}
+
+static inline size_t _write_varint(uint8_t* out, size_t value) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    out[size++] = value;
+    return size;
+}
+
+static inline size_t _read_varint(const uint8_t* in, size_t in_size, size_t* value) {
+    *value = 0;
+    for (size_t i = 0; i < in_size && i < sizeof(size_t)*8/7 + 1; ++i) {
+        *value |= (size_t)(in[i] & 0x7F) << (7*i);
+        if (! (in[i] & 0x80))
+            return i + 1;
+    }
+
+    return 0;
+}
+
+static inline int _push(const uint8_t* data, size_t size) {
+    if (size > s_rewind.capacity) {
+        log_warn("rewind snapshot doesn't fit in the buffer (%zu bytes)", size);
+        return 0;
+    }
+
+    // entries are contiguous, so wrap back to the start of the buffer when
+    // the space after the newest entry runs out
+    size_t offset = 0;
+    if (s_rewind.count > 0) {
+        const RewindEntry* newest = s_rewind.entries + (s_rewind.head + s_rewind.count - 1) % s_rewind.max_entries;
+        offset = newest->offset + newest->size;
+        if (offset + size > s_rewind.capacity)
+            offset = 0;
+    }
+
+    // evict the oldest entries until the new one doesn't overlap them
+    while (s_rewind.count > 0) {
+        const RewindEntry* oldest   = s_rewind.entries + s_rewind.head;
+        const int overlaps          = offset < oldest->offset + oldest->size && oldest->offset < offset + size;
+        if (! overlaps && s_rewind.count < s_rewind.max_entries)
+            break;
+
+        _drop_oldest();
+    }
+
+    memcpy(s_rewind.buffer + offset, data, size);
+
+    s_rewind.entries[(s_rewind.head + s_rewind.count) % s_rewind.max_entries] = (RewindEntry) {
+        .offset = offset,
+        .size   = size,
+    };
+    s_rewind.used += size;
+    ++s_rewind.count;
+
+    return 1;
+}
+
+static inline void _drop_oldest(void) {
+    s_rewind.used -= s_rewind.entries[s_rewind.head].size;
+    s_rewind.head = (s_rewind.head + 1) % s_rewind.max_entries;
+    --s_rewind.count;
+}
+
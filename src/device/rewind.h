@@ -0,0 +1,29 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// rewind keeps a ring of save states, one every interval_frames frames, in a
+// fixed budget of capacity bytes. each snapshot is stored as the XOR against
+// the one before it, run length encoded, so frames where little changes cost
+// next to nothing. the oldest snapshots are dropped once the budget is full
+int rewind_init(size_t capacity, uint32_t interval_frames);
+void rewind_cleanup(void);
+
+// drops all history. must be called when the cart changes, since the size
+// of the machine state changes with it
+void rewind_reset(void);
+
+// call once per emulated frame
+void rewind_on_frame(void);
+
+// restores the most recent snapshot and removes it from the history, so
+// calling this repeatedly walks backwards. returns 0 once history runs out
+int rewind_step_back(void);
+
+size_t rewind_get_snapshot_count(void);
+size_t rewind_get_used_bytes(void);
+
+#endif
+
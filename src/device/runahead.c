@@ -0,0 +1,250 @@
+#include "runahead.h"
+
+#include "device.h"
+#include "savestate.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t        frames;
+    int             threaded;
+    uint8_t*        state;
+    size_t          state_size;
+
+    // the second machine when threaded. state doubles as the mailbox, written
+    // by the caller and read by the worker with the lock held, and the worker
+    // only ever runs the newest job it's handed
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             running;
+    int             quitting;
+    int             has_job;
+    int             has_cart;
+    int             cart_ready;     // the worker has a cart and can take jobs
+    Cart            next_cart;      // handed over to the worker, which owns it once taken
+    InputFlags      inputs[INPUT_PORT_COUNT];
+    uint64_t        tag;
+    TripleBuffer*   shown;
+} RunAheadState;
+
+static RunAheadState s_runahead;
+
+static void* _worker(void* arg);
+static inline void _post_job(void);
+
+int runahead_init(uint32_t frames, int threaded) {
+    if (frames > RUNAHEAD_MAX_FRAMES) {
+        log_error("failed to init run-ahead (at most %d frames, got %u)", RUNAHEAD_MAX_FRAMES, frames);
+        return 0;
+    }
+
+    runahead_cleanup();
+    s_runahead.frames   = frames;
+    s_runahead.threaded = threaded && frames > 0;
+
+    if (s_runahead.threaded) {
+        pthread_mutex_init(&s_runahead.lock, NULL);
+        pthread_cond_init(&s_runahead.cond, NULL);
+        if (pthread_create(&s_runahead.thread, NULL, _worker, NULL) != 0) {
+            log_error("failed to start run-ahead thread, running ahead on this one");
+            pthread_cond_destroy(&s_runahead.cond);
+            pthread_mutex_destroy(&s_runahead.lock);
+            s_runahead.threaded = 0;
+        } else {
+            s_runahead.running = 1;
+        }
+    }
+
+    runahead_reset();
+    return 1;
+}
+
+void runahead_cleanup(void) {
+    if (s_runahead.running) {
+        pthread_mutex_lock(&s_runahead.lock);
+        s_runahead.quitting = 1;
+        pthread_cond_broadcast(&s_runahead.cond);
+        pthread_mutex_unlock(&s_runahead.lock);
+        pthread_join(s_runahead.thread, NULL);
+
+        pthread_cond_destroy(&s_runahead.cond);
+        pthread_mutex_destroy(&s_runahead.lock);
+    }
+
+    free(s_runahead.state);
+    memset(&s_runahead, 0, sizeof(s_runahead));
+}
+
+void runahead_reset(void) {
+    if (s_runahead.frames == 0)
+        return;
+
+    if (! s_runahead.threaded) {
+        const size_t state_size = savestate_get_size();
+        if (state_size != s_runahead.state_size) {
+            s_runahead.state_size   = state_size;
+            s_runahead.state        = realloc(s_runahead.state, state_size);
+        }
+        return;
+    }
+
+    // the worker gets its own copy of the cart, so the caller's can be swapped
+    // out from under it, and a save file is never written by a speculative frame
+    Cart cart;
+    const int cloned = g_device.cart != NULL && cart_clone(g_device.cart, &cart);
+
+    pthread_mutex_lock(&s_runahead.lock);
+
+    // any job waiting is for the old cart
+    s_runahead.has_job      = 0;
+    s_runahead.cart_ready   = 0;
+
+    const size_t state_size = savestate_get_size();
+    if (state_size != s_runahead.state_size) {
+        s_runahead.state_size   = state_size;
+        s_runahead.state        = realloc(s_runahead.state, state_size);
+    }
+
+    // waits for the worker to be running the new cart, as its frames are only
+    // set up once it's powered on
+    if (cloned) {
+        s_runahead.next_cart    = cart;
+        s_runahead.has_cart     = 1;
+        pthread_cond_broadcast(&s_runahead.cond);
+
+        while (! s_runahead.cart_ready)
+            pthread_cond_wait(&s_runahead.cond, &s_runahead.lock);
+    }
+
+    pthread_mutex_unlock(&s_runahead.lock);
+}
+
+void runahead_exec_frame(void) {
+    // frames are published as they complete, so when running ahead only the
+    // speculative frame is drawn, or the real one would be shown first
+    const uint32_t outputs = device_get_outputs();
+    if (s_runahead.frames > 0)
+        device_set_outputs(outputs & ~kDEVICE_OUTPUT_VIDEO);
+
+    device_exec_frame();
+
+    if (s_runahead.threaded) {
+        device_set_outputs(outputs);
+        _post_job();
+        return;
+    }
+
+    // if the state can't be saved there's nothing to run ahead from, and this
+    // frame goes without being shown
+    if (s_runahead.frames == 0 || ! savestate_write(s_runahead.state, s_runahead.state_size)) {
+        device_set_outputs(outputs);
+        return;
+    }
+
+    // only the frame being shown needs drawing, and none of them are heard, as
+    // the real frame has already made this frame's audio
+    device_set_outputs(outputs & ~(kDEVICE_OUTPUT_VIDEO | kDEVICE_OUTPUT_AUDIO));
+    for (uint32_t i = 1; i < s_runahead.frames; ++i)
+        device_exec_frame();
+
+    device_set_outputs(outputs & ~kDEVICE_OUTPUT_AUDIO);
+    device_exec_frame();
+
+    // nothing the speculative frames did is kept, including PRG RAM writes
+    if (! savestate_read(s_runahead.state, s_runahead.state_size))
+        log_error("failed to restore after running ahead");
+
+    device_set_outputs(outputs);
+}
+
+uint32_t runahead_get_frames(void) {
+    return s_runahead.frames;
+}
+
+TripleBuffer* runahead_get_shown_frames(void) {
+    if (! s_runahead.threaded)
+        return device_get_frames();
+
+    pthread_mutex_lock(&s_runahead.lock);
+    TripleBuffer* shown = s_runahead.shown;
+    pthread_mutex_unlock(&s_runahead.lock);
+
+    return shown;
+}
+
+// owns the second machine, which like the first is thread local
+static void* _worker(void* arg) {
+    (void)arg;
+
+    Cart cart;
+    memset(&cart, 0, sizeof(cart));
+    cart.save_fd = -1;
+
+    device_init();
+
+    pthread_mutex_lock(&s_runahead.lock);
+    for (;;) {
+        while (! s_runahead.has_job && ! s_runahead.has_cart && ! s_runahead.quitting)
+            pthread_cond_wait(&s_runahead.cond, &s_runahead.lock);
+        if (s_runahead.quitting)
+            break;
+
+        if (s_runahead.has_cart) {
+            device_unload_cart();
+            cart_unload(&cart);
+
+            cart                    = s_runahead.next_cart;
+            s_runahead.has_cart     = 0;
+            device_load_cart(&cart);
+
+            s_runahead.shown        = device_get_frames();
+            s_runahead.cart_ready   = 1;
+            pthread_cond_broadcast(&s_runahead.cond);
+            continue;
+        }
+
+        // the state is copied out with the lock held, then the frames are run
+        // without it so the caller can post the next job meanwhile
+        s_runahead.has_job  = 0;
+        const int restored  = savestate_read(s_runahead.state, s_runahead.state_size);
+        for (uint8_t i = 0; i < INPUT_PORT_COUNT; ++i)
+            device_set_inputs(i, s_runahead.inputs[i]);
+        device_set_frame_tag(s_runahead.tag);
+        pthread_mutex_unlock(&s_runahead.lock);
+
+        if (restored) {
+            device_set_outputs(0);
+            for (uint32_t i = 1; i < s_runahead.frames; ++i)
+                device_exec_frame();
+
+            device_set_outputs(kDEVICE_OUTPUT_VIDEO);
+            device_exec_frame();
+        }
+
+        pthread_mutex_lock(&s_runahead.lock);
+    }
+    pthread_mutex_unlock(&s_runahead.lock);
+
+    device_unload_cart();
+    cart_unload(&cart);
+
+    return NULL;
+}
+
+static inline void _post_job(void) {
+    pthread_mutex_lock(&s_runahead.lock);
+
+    // a job the worker hasn't started on yet is stale by now, so it's replaced
+    // rather than queued behind
+    if (s_runahead.cart_ready && savestate_write(s_runahead.state, s_runahead.state_size)) {
+        memcpy(s_runahead.inputs, g_device.inputs, sizeof(s_runahead.inputs));
+        s_runahead.tag      = device_get_frame_tag();
+        s_runahead.has_job  = 1;
+        pthread_cond_broadcast(&s_runahead.cond);
+    }
+
+    pthread_mutex_unlock(&s_runahead.lock);
+}
@@ -0,0 +1,34 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include "ppu/triple_buffer.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// run-ahead hides the frames of lag games have between reading the pad and
+// showing the result. after each real frame the machine is saved, run on for
+// a few frames with the same inputs, shown, then restored, so what's on screen
+// is where the game will be once the inputs have worked their way through
+#define RUNAHEAD_MAX_FRAMES 4
+
+// when threaded, the speculative frames run on a second machine with its own
+// thread, seeded from each real frame's state, so the caller only pays for the
+// real frame and the one shown arrives while the next real frame runs
+int runahead_init(uint32_t frames, int threaded);
+void runahead_cleanup(void);
+
+// must be called when the cart changes, since the size of the machine state
+// changes with it
+void runahead_reset(void);
+
+// emulates one real frame, then the speculative ones if run-ahead is enabled.
+// only the frame to show is drawn, so it's the one the ppu publishes
+void runahead_exec_frame(void);
+
+uint32_t runahead_get_frames(void);
+// where the frames to show are published. when threaded that's the second
+// machine's, which is set up by the first runahead_reset with a cart in
+TripleBuffer* runahead_get_shown_frames(void);
+
+#endif
@@ -0,0 +1,282 @@
+#include "savestate.h"
+
+#include "device.h"
+#include "helpers.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define SAVESTATE_MAGIC     DEVICE_STATE_TAG('P','N','S','S')
+#define SAVESTATE_MAX_IOV   (1 + DEVICE_MAX_STATE_REGIONS*2)
+
+typedef struct {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    chunk_count;
+    uint32_t    cart_crc32;
+    uint32_t    size;
+} SaveStateHeader;
+
+typedef struct {
+    uint32_t    tag;
+    uint32_t    size;
+} SaveStateChunkHeader;
+
+static inline SaveStateHeader _make_header(size_t region_count);
+static inline int _validate_header(const SaveStateHeader* header, size_t region_count);
+static inline int _validate_chunk(const SaveStateChunkHeader* chunk, const DeviceStateRegion* region);
+
+size_t savestate_get_size(void) {
+    DeviceStateRegion regions[DEVICE_MAX_STATE_REGIONS];
+    const size_t region_count = device_get_state_regions(regions, DEVICE_MAX_STATE_REGIONS);
+
+    size_t size = sizeof(SaveStateHeader);
+    for (size_t i = 0; i < region_count; ++i)
+        size += sizeof(SaveStateChunkHeader) + regions[i].size;
+
+    return size;
+}
+
+int savestate_write(uint8_t* out, size_t size) {
+    if (size < savestate_get_size()) {
+        log_error("failed to write save state (buffer is too small)");
+        return 0;
+    }
+
+    DeviceStateRegion regions[DEVICE_MAX_STATE_REGIONS];
+    const size_t region_count = device_get_state_regions(regions, DEVICE_MAX_STATE_REGIONS);
+
+    const SaveStateHeader header = _make_header(region_count);
+    memcpy(out, &header, sizeof(header));
+
+    size_t offset = sizeof(header);
+    for (size_t i = 0; i < region_count; ++i) {
+        const SaveStateChunkHeader chunk = { regions[i].tag, regions[i].size };
+        memcpy(out + offset, &chunk, sizeof(chunk));
+        offset += sizeof(chunk);
+
+        memcpy(out + offset, regions[i].data, regions[i].size);
+        offset += regions[i].size;
+    }
+
+    return 1;
+}
+
+int savestate_read(const uint8_t* in, size_t size) {
+    DeviceStateRegion regions[DEVICE_MAX_STATE_REGIONS];
+    const size_t region_count = device_get_state_regions(regions, DEVICE_MAX_STATE_REGIONS);
+
+    // the chunk walk below trusts the layout, so the buffer has to be exactly
+    // the size of a state for this device before any of it is read
+    if (size != savestate_get_size()) {
+        log_error("failed to read save state (size mismatch)");
+        return 0;
+    }
+
+    SaveStateHeader header;
+
+    memcpy(&header, in, sizeof(header));
+    if (! _validate_header(&header, region_count) || header.size != size) {
+        log_error("failed to read save state (bad header)");
+        return 0;
+    }
+
+    // validate every chunk before restoring any, so a bad state can't leave
+    // the device half restored
+    size_t offset = sizeof(header);
+    for (size_t i = 0; i < region_count; ++i) {
+        SaveStateChunkHeader chunk;
+        memcpy(&chunk, in + offset, sizeof(chunk));
+        if (! _validate_chunk(&chunk, regions + i))
+            return 0;
+
+        offset += sizeof(chunk) + chunk.size;
+    }
+
+    offset = sizeof(header);
+    for (size_t i = 0; i < region_count; ++i) {
+        offset += sizeof(SaveStateChunkHeader);
+        memcpy(regions[i].data, in + offset, regions[i].size);
+        offset += regions[i].size;
+    }
+
+    return 1;
+}
+
+int savestate_save(const char* path) {
+    const uint64_t start = get_time_ns();
+
+    DeviceStateRegion regions[DEVICE_MAX_STATE_REGIONS];
+    const size_t region_count = device_get_state_regions(regions, DEVICE_MAX_STATE_REGIONS);
+
+    // gather the header, chunk headers and the live state regions so the
+    // whole state goes out in one writev, with no intermediate copy
+    SaveStateHeader header = _make_header(region_count);
+    SaveStateChunkHeader chunks[DEVICE_MAX_STATE_REGIONS];
+    struct iovec iov[SAVESTATE_MAX_IOV];
+    int iov_count = 0;
+
+    iov[iov_count++] = (struct iovec) { &header, sizeof(header) };
+    for (size_t i = 0; i < region_count; ++i) {
+        chunks[i] = (SaveStateChunkHeader) { regions[i].tag, regions[i].size };
+        iov[iov_count++] = (struct iovec) { chunks + i, sizeof(chunks[i]) };
+        iov[iov_count++] = (struct iovec) { regions[i].data, regions[i].size };
+    }
+
+    // write to a temp file and rename it into place, so a crash mid save
+    // never clobbers the previous state
+    const size_t tmp_size   = strlen(path) + sizeof(".tmp");
+    char* tmp_path          = malloc(tmp_size);
+    snprintf(tmp_path, tmp_size, "%s.tmp", path);
+
+    int success = 0;
+    const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        log_error("failed to save state to '%s' (%s)", path, strerror(errno));
+        goto bail;
+    }
+
+    const ssize_t written = writev(fd, iov, iov_count);
+    const int closed = close(fd) == 0;
+    if (written != (ssize_t)header.size || ! closed) {
+        log_error("failed to save state to '%s' (%s)", path, written == -1 ? strerror(errno) : "short write");
+        unlink(tmp_path);
+        goto bail;
+    }
+
+    if (rename(tmp_path, path) != 0) {
+        log_error("failed to save state to '%s' (%s)", path, strerror(errno));
+        unlink(tmp_path);
+        goto bail;
+    }
+
+    log_info("saved state to '%s' (%u bytes in %.3fms)", path, header.size, (get_time_ns() - start) / 1e6);
+    success = 1;
+
+bail:
+    free(tmp_path);
+    return success;
+}
+
+int savestate_load(const char* path) {
+    const uint64_t start = get_time_ns();
+
+    DeviceStateRegion regions[DEVICE_MAX_STATE_REGIONS];
+    const size_t region_count = device_get_state_regions(regions, DEVICE_MAX_STATE_REGIONS);
+    const size_t size = savestate_get_size();
+
+    int success         = 0;
+    uint8_t* staging    = NULL;
+    const int fd        = open(path, O_RDONLY);
+    if (fd == -1) {
+        log_error("failed to load state from '%s' (%s)", path, strerror(errno));
+        goto bail;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != size) {
+        log_error("failed to load state from '%s' (size mismatch)", path);
+        goto bail;
+    }
+
+    // scatter the headers into place and the region data into a staging
+    // buffer with one readv, which is only copied over the live regions once
+    // everything has been validated
+    SaveStateHeader header;
+    SaveStateChunkHeader chunks[DEVICE_MAX_STATE_REGIONS];
+    struct iovec iov[SAVESTATE_MAX_IOV];
+    int iov_count = 0;
+
+    staging = malloc(size);
+    size_t offset = 0;
+
+    iov[iov_count++] = (struct iovec) { &header, sizeof(header) };
+    for (size_t i = 0; i < region_count; ++i) {
+        iov[iov_count++] = (struct iovec) { chunks + i, sizeof(chunks[i]) };
+        iov[iov_count++] = (struct iovec) { staging + offset, regions[i].size };
+        offset += regions[i].size;
+    }
+
+    if (readv(fd, iov, iov_count) != (ssize_t)size) {
+        log_error("failed to load state from '%s' (short read)", path);
+        goto bail;
+    }
+
+    if (! _validate_header(&header, region_count)) {
+        log_error("failed to load state from '%s' (bad header)", path);
+        goto bail;
+    }
+
+    for (size_t i = 0; i < region_count; ++i) {
+        if (! _validate_chunk(chunks + i, regions + i))
+            goto bail;
+    }
+
+    offset = 0;
+    for (size_t i = 0; i < region_count; ++i) {
+        memcpy(regions[i].data, staging + offset, regions[i].size);
+        offset += regions[i].size;
+    }
+
+    log_info("loaded state from '%s' (%zu bytes in %.3fms)", path, size, (get_time_ns() - start) / 1e6);
+    success = 1;
+
+bail:
+    free(staging);
+    if (fd != -1)
+        close(fd);
+
+    return success;
+}
+
+static inline SaveStateHeader _make_header(size_t region_count) {
+    return (SaveStateHeader) {
+        .magic          = SAVESTATE_MAGIC,
+        .version        = SAVESTATE_VERSION,
+        .chunk_count    = region_count,
+        .cart_crc32     = g_device.cart != NULL ? g_device.cart->crc32 : 0,
+        .size           = savestate_get_size(),
+    };
+}
+
+static inline int _validate_header(const SaveStateHeader* header, size_t region_count) {
+    if (header->magic != SAVESTATE_MAGIC) {
+        log_error("not a save state");
+        return 0;
+    }
+
+    if (header->version != SAVESTATE_VERSION) {
+        log_error("unsupported save state version '%u' (expected %u)", header->version, SAVESTATE_VERSION);
+        return 0;
+    }
+
+    const uint32_t cart_crc32 = g_device.cart != NULL ? g_device.cart->crc32 : 0;
+    if (header->cart_crc32 != cart_crc32) {
+        log_error("save state is for a different rom (%08X, expected %08X)", header->cart_crc32, cart_crc32);
+        return 0;
+    }
+
+    if (header->chunk_count != region_count) {
+        log_error("save state has %u chunks (expected %zu)", header->chunk_count, region_count);
+        return 0;
+    }
+
+    return 1;
+}
+
+static inline int _validate_chunk(const SaveStateChunkHeader* chunk, const DeviceStateRegion* region) {
+    if (chunk->tag != region->tag || chunk->size != region->size) {
+        log_error("save state chunk '%.4s' (%u bytes) doesn't match '%.4s' (%zu bytes)",
+            (const char*)&chunk->tag, chunk->size, (const char*)&region->tag, region->size);
+        return 0;
+    }
+
+    return 1;
+}
+
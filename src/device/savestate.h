@@ -0,0 +1,24 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// save states are a small header followed by one chunk per device state
+// region, each tagged with its fourcc and size. states are tied to the rom
+// they were made with, and to the version of the format
+#define SAVESTATE_VERSION 5
+
+// size in bytes of a save state for the currently loaded cart
+size_t savestate_get_size(void);
+
+// in memory save states, for callers which keep their own history
+int savestate_write(uint8_t* out, size_t size);
+int savestate_read(const uint8_t* in, size_t size);
+
+// file backed save states. nothing is restored unless the whole file is valid
+int savestate_save(const char* path);
+int savestate_load(const char* path);
+
+#endif
+
@@ -1,7 +1,11 @@
 #include "helpers.h"
 
+#include <string.h>
 #include <time.h>
 
+static inline uint64_t _splitmix64(uint64_t* state);
+static inline uint64_t _rotl64(uint64_t x, int k);
+
 void write_bit(uint8_t* bitset, uint8_t idx, int value) {
     if (value)
         *bitset |= 1 << idx;
@@ -13,18 +17,47 @@ int read_bit(uint8_t bitset, uint8_t idx) {
     return (bitset >> idx) & 1;
 }
 
-void randomise_buffer(void* buf, size_t n) {
-    if (n == 0)
-        return;
+void randomise_buffer(void* buf, size_t n, uint64_t seed) {
+    // xoshiro256**, seeded through splitmix64 as its authors recommend so that
+    // similar seeds still give unrelated streams. see https://prng.di.unimi.it
+    uint64_t s[4];
+    for (int i = 0; i < 4; ++i)
+        s[i] = _splitmix64(&seed);
+
+    uint8_t* bytes = (uint8_t*)buf;
+    for (size_t i = 0; i < n; i += sizeof(uint64_t)) {
+        const uint64_t result   = _rotl64(s[1] * 5, 7) * 9;
+        const uint64_t t        = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3]  = _rotl64(s[3], 45);
 
-    static int init = 0;
-    if (! init) {
-        srand(time(NULL));
-        init = 1;
+        // 64 bits at a time, with whatever's left over taken from the last one
+        const size_t count = n - i < sizeof(result) ? n - i : sizeof(result);
+        memcpy(bytes + i, &result, count);
     }
+}
 
-    uint8_t* bytes = (uint8_t*)buf;
-    for (size_t i = 0; i < n; ++i)
-        bytes[i] = rand();
+
+uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t _splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+
+    return z ^ (z >> 31);
 }
 
+static inline uint64_t _rotl64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
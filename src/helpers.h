@@ -9,7 +9,12 @@
 void write_bit(uint8_t* bitset, uint8_t idx, int value);
 int read_bit(uint8_t bitset, uint8_t idx);
 
-void randomise_buffer(void* buf, size_t n);
+// fills the buffer with pseudo random bytes seeded with seed, so the same seed
+// always gives the same contents
+void randomise_buffer(void* buf, size_t n, uint64_t seed);
+
+// monotonic clock, only useful for measuring intervals
+uint64_t get_time_ns(void);
 
 #endif
 
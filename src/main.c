@@ -1,51 +1,600 @@
 #include "device/device.h"
+#include "device/fastboot.h"
+#include "device/savestate.h"
+#include "device/rewind.h"
+#include "device/runahead.h"
+#include "device/movie.h"
+#include "device/apu/apu.h"
+#include "device/apu/resampler.h"
 #include "device/cart/cart.h"
-#include "device/ppu/ppu.h"
 #include "device/ppu/color_palette.h"
+#include "platform/audio.h"
 #include "platform/platform.h"
+#include "helpers.h"
 #include "log.h"
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-#define MIN_EXPECTED_ARG_COUNT 2
-#define MAX_EXPECTED_ARG_COUNT 3
+#define MIN_EXPECTED_ARG_COUNT 1
+#define MAX_EXPECTED_ARG_COUNT 2
+
+#define SAVE_FILE_EXT ".sav"
+#define STATE_FILE_EXT ".state"
+#define PLAYLIST_COMMENT '#'
+
+#define DEFAULT_REWIND_BUFFER_MB 32
+#define REWIND_INTERVAL_FRAMES 2
+#define FAST_FORWARD_FRAMES 8
+
+#define NTSC_FRAME_RATE 60.0988
+#define AUDIO_CHUNK_SAMPLES 1024
+// room for a chunk resampled up to 4x
+#define RESAMPLED_CHUNK_SAMPLES (AUDIO_CHUNK_SAMPLES*4)
+
+#define ACTION_QUEUE_SIZE 8
+
+typedef enum {
+    kMOVIE_MODE_NONE = 0,
+    kMOVIE_MODE_RECORD,
+    kMOVIE_MODE_PLAY,
+} MovieMode;
+
+// everything the emulation thread needs to bring the device up
+typedef struct {
+    Cart        cart;
+    char**      roms;
+    size_t      rom_count;
+    long        rewind_mb;
+    long        runahead_frames;
+    int         runahead_threaded;
+    const char* movie_path;
+    int         has_ram_pattern;
+    RAMPattern  ram_pattern;
+    int         has_seed;
+    uint64_t    seed;
+} EmuOptions;
+
+typedef struct {
+    PlatformAction  action;
+    char*           path;
+} QueuedAction;
+
+// how long inputs take from arriving to the first frame made with them being
+// presented, only measured and used on the platform thread
+typedef struct {
+    uint64_t    count;
+    uint64_t    total_ns;
+    uint64_t    worst_ns;
+} InputLatency;
+
+static long s_fast_boot_frames  = 0;
+static char* s_cache_dir        = NULL;
+static char* s_rom_path         = NULL;
+static MovieMode s_movie_mode   = kMOVIE_MODE_NONE;
+static Movie s_movie;
+
+// shared between the platform and emulation threads. frames are the
+// emulation thread's ppu's, tagged with when the newest input they were
+// emulated with arrived
+static _Atomic(TripleBuffer*) s_frames  = NULL;
+static Resampler s_resampler;
+static atomic_int s_emulating           = 0;
+static pthread_mutex_t s_action_lock    = PTHREAD_MUTEX_INITIALIZER;
+static QueuedAction s_actions[ACTION_QUEUE_SIZE];
+static size_t s_action_count            = 0;
+
+// swaps the rom's extension out for another, eg. roms/game.nes -> roms/game.sav
+static char* _get_rom_sibling_path(const char* rom_path, const char* new_ext) {
+    const char* ext         = strrchr(rom_path, '.');
+    const char* last_sep    = strrchr(rom_path, '/');
+    const size_t stem_len   = (ext != NULL && (last_sep == NULL || ext > last_sep)) ? (size_t)(ext - rom_path) : strlen(rom_path);
+    const size_t ext_size   = strlen(new_ext) + 1;
+
+    char* path = malloc(stem_len + ext_size);
+    memcpy(path, rom_path, stem_len);
+    memcpy(path + stem_len, new_ext, ext_size);
+
+    return path;
+}
+
+static void _print_usage(const char* exe) {
+    fprintf(stderr, "usage: %s [-a runahead_frames] [-b fast_boot_frames] [-c cache_dir] [-i bindings_path] [-l playlist_path] [-r rewind_mb] [-m zero|ff|fceux|random] [-o audio_path] [-s seed] [-t] [-w movie_path | -p movie_path] <rom_path> [palette_path]\n", exe);
+}
+
+// reads one rom path per line, skipping blank lines and # comments
+static int _load_playlist(const char* path, char*** roms, size_t* rom_count) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        log_error("failed to open playlist '%s'", path);
+        return 0;
+    }
+
+    char* line      = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, f)) != -1) {
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = '\0';
+
+        if (len == 0 || line[0] == PLAYLIST_COMMENT)
+            continue;
+
+        *roms = realloc(*roms, sizeof(**roms) * (*rom_count + 1));
+        (*roms)[(*rom_count)++] = strdup(line);
+    }
+
+    free(line);
+    fclose(f);
+
+    return 1;
+}
+
+// loads the rom into cart, attaching its save file if it has one and attach_save
+// is set
+static int _load_cart(const char* path, Cart* cart, int attach_save) {
+    if (! cart_load(path, cart))
+        return 0;
+
+    if (cart->prg_ram_battery && attach_save) {
+        char* save_path = _get_rom_sibling_path(path, SAVE_FILE_EXT);
+        cart_attach_save(cart, save_path);
+        free(save_path);
+    }
+
+    return 1;
+}
+
+// power cycles the device with the cart inserted, fast booting if enabled
+static void _boot_cart(Cart* cart, const char* path) {
+    free(s_rom_path);
+    s_rom_path = strdup(path);
+
+    device_load_cart(cart);
+    rewind_reset();
+    runahead_reset();
+
+    if (s_fast_boot_frames > 0) {
+        if (s_cache_dir != NULL)
+            fastboot_run(s_cache_dir, s_fast_boot_frames);
+        else
+            log_warn("no cache directory for fast boot, pass one with -c");
+    }
+}
+
+static void _stop_movie(void) {
+    if (s_movie_mode == kMOVIE_MODE_NONE)
+        return;
+
+    movie_close(&s_movie);
+    s_movie_mode = kMOVIE_MODE_NONE;
+}
+
+// applies this frame's events and inputs, either live or through the movie
+static void _apply_frame_inputs(uint8_t events, const InputFlags* inputs) {
+    switch (s_movie_mode) {
+        case kMOVIE_MODE_RECORD:
+            movie_record_frame(&s_movie, events, inputs);
+            return;
+        case kMOVIE_MODE_PLAY:
+            if (movie_play_frame(&s_movie))
+                return;
+
+            log_info("movie finished after %u frames", s_movie.frame_count);
+            _stop_movie();
+            break;
+
+        default:
+            break;
+    }
+
+    if (events & kMOVIE_EVENT_POWER)
+        device_power_on();
+    else if (events & kMOVIE_EVENT_RESET)
+        device_reset();
+
+    for (uint8_t i = 0; i < INPUT_PORT_COUNT; ++i)
+        device_set_inputs(i, inputs[i]);
+}
+
+// swaps the running cart out for the rom at path, leaving the window and GL
+// state alone so only the device is reset. the new rom is loaded before the
+// old one is unloaded, so a bad rom leaves the current one running
+static int _swap_cart(const char* path, Cart* cart) {
+    log_info("swapping to '%s'", path);
+
+    // any movie stops once the swap goes through, so the next rom always gets
+    // its save file
+    Cart next;
+    if (! _load_cart(path, &next, 1)) {
+        log_error("failed to swap to '%s', keeping the current rom", path);
+        return 0;
+    }
+
+    _stop_movie();
+    device_unload_cart();
+    cart_unload(cart);
+
+    *cart = next;
+    _boot_cart(cart, path);
+
+    return 1;
+}
+
+// queued by the platform thread, run by the emulation thread between frames
+static void _post_action(PlatformAction action, const char* path) {
+    pthread_mutex_lock(&s_action_lock);
+
+    if (s_action_count < ACTION_QUEUE_SIZE) {
+        s_actions[s_action_count++] = (QueuedAction){
+            .action = action,
+            .path   = path != NULL ? strdup(path) : NULL,
+        };
+    } else {
+        log_warn("dropping action %d, the emulation thread isn't keeping up", action);
+    }
+
+    pthread_mutex_unlock(&s_action_lock);
+}
+
+// the caller owns the returned path
+static PlatformAction _take_action(char** path) {
+    PlatformAction action = kPLATFORM_ACTION_NONE;
+    *path = NULL;
+
+    pthread_mutex_lock(&s_action_lock);
+
+    if (s_action_count > 0) {
+        action  = s_actions[0].action;
+        *path   = s_actions[0].path;
+        memmove(s_actions, s_actions + 1, sizeof(*s_actions) * --s_action_count);
+    }
+
+    pthread_mutex_unlock(&s_action_lock);
+
+    return action;
+}
+
+static void _record_input_latency(InputLatency* latency, uint64_t ns) {
+    ++latency->count;
+    latency->total_ns += ns;
+    if (ns > latency->worst_ns)
+        latency->worst_ns = ns;
+}
+
+// resamples the frame's samples to the sink's rate and hands them over, then
+// waits for the sink to catch up, which is what paces emulation. when there
+// are none, eg. while rewinding, a frame of silence keeps the pace instead
+static void _output_audio(void) {
+    static int16_t samples[AUDIO_CHUNK_SAMPLES];
+    static int16_t resampled[RESAMPLED_CHUNK_SAMPLES];
+
+    // output just fast or slow enough to keep the queue where it should be
+    resampler_set_ratio(&s_resampler, audio_get_rate_ratio());
+
+    SampleRing* ring    = device_get_sample_ring();
+    size_t read         = 0;
+    size_t count;
+    while ((count = sample_ring_read(ring, samples, AUDIO_CHUNK_SAMPLES)) > 0) {
+        audio_write(resampled, resampler_process(&s_resampler, samples, count, resampled));
+        read += count;
+    }
+
+    if (read == 0) {
+        memset(resampled, 0, sizeof(resampled));
+
+        size_t silence = audio_get_sample_rate() / NTSC_FRAME_RATE;
+        while (silence > 0) {
+            count = silence < RESAMPLED_CHUNK_SAMPLES ? silence : RESAMPLED_CHUNK_SAMPLES;
+            audio_write(resampled, count);
+            silence -= count;
+        }
+    }
+
+    audio_wait();
+}
+
+// owns the device for its whole life, as the machine state is thread local.
+// the platform thread only hands inputs and actions over and picks up frames
+static void* _emulate(void* arg) {
+    EmuOptions* opts = arg;
+
+    device_init();
+    if (opts->has_ram_pattern)
+        device_set_ram_pattern(opts->ram_pattern);
+    if (opts->has_seed)
+        device_set_power_on_seed(opts->seed);
+
+    if (opts->rewind_mb > 0)
+        rewind_init(opts->rewind_mb * 1024 * 1024, REWIND_INTERVAL_FRAMES);
+    if (opts->runahead_frames > 0)
+        runahead_init(opts->runahead_frames, opts->runahead_threaded);
+
+    _boot_cart(&opts->cart, opts->roms[0]);
+
+    // the ppu's frames are only set up once it's powered on, and when running
+    // ahead on a second thread they're that machine's
+    atomic_store_explicit(&s_frames, runahead_get_shown_frames(), memory_order_release);
+
+    if (s_movie_mode == kMOVIE_MODE_RECORD && ! movie_record(&s_movie, opts->movie_path))
+        s_movie_mode = kMOVIE_MODE_NONE;
+    else if (s_movie_mode == kMOVIE_MODE_PLAY && (! movie_load(&s_movie, opts->movie_path) || ! movie_play(&s_movie)))
+        _stop_movie();
+
+    size_t rom_idx = 0;
+    while (atomic_load_explicit(&s_emulating, memory_order_relaxed)) {
+        uint8_t events = 0;
+
+        char* action_path;
+        const PlatformAction action = _take_action(&action_path);
+        switch (action) {
+            case kPLATFORM_ACTION_NEXT_ROM:
+                rom_idx = (rom_idx + 1) % opts->rom_count;
+                _swap_cart(opts->roms[rom_idx], &opts->cart);
+                break;
+            case kPLATFORM_ACTION_PREV_ROM:
+                rom_idx = (rom_idx + opts->rom_count - 1) % opts->rom_count;
+                _swap_cart(opts->roms[rom_idx], &opts->cart);
+                break;
+            case kPLATFORM_ACTION_LOAD_ROM:
+                _swap_cart(action_path, &opts->cart);
+                break;
+            case kPLATFORM_ACTION_RESET:
+                events |= kMOVIE_EVENT_RESET;
+                break;
+            case kPLATFORM_ACTION_POWER_CYCLE:
+                events |= kMOVIE_EVENT_POWER;
+                break;
+            case kPLATFORM_ACTION_LOAD_STATE:
+                if (s_movie_mode != kMOVIE_MODE_NONE) {
+                    log_warn("can't load a state while a movie is running");
+                    break;
+                }
+                // fallthrough
+            case kPLATFORM_ACTION_SAVE_STATE:
+            {
+                char* state_path = _get_rom_sibling_path(s_rom_path, STATE_FILE_EXT);
+                if (action == kPLATFORM_ACTION_SAVE_STATE)
+                    savestate_save(state_path);
+                else
+                    savestate_load(state_path);
+
+                free(state_path);
+                break;
+            }
+
+            default:
+                break;
+        }
+        free(action_path);
+
+        const PlatformInputState input = platform_get_input_state();
+        device_set_frame_tag(input.changed_ns);
+
+        // holding rewind steps back a snapshot per frame instead of emulating.
+        // movies can't be rewound, as that would break them
+        const int rewinding = input.rewind_held && s_movie_mode == kMOVIE_MODE_NONE;
+        if (! rewinding || ! rewind_step_back()) {
+            // fast forwarding runs extra frames which are never shown, so
+            // they're run with every output off
+            const uint32_t frames = input.fast_forward_held ? FAST_FORWARD_FRAMES : 1;
+            for (uint32_t i = 0; i < frames; ++i) {
+                const int hidden = i + 1 < frames;
+                device_set_outputs(hidden ? 0 : DEVICE_OUTPUT_ALL);
+                _apply_frame_inputs(i == 0 ? events : 0, input.inputs);
+
+                // frames are handed over as they complete, and when running
+                // ahead only the speculative one is drawn, so that's what's shown
+                if (hidden)
+                    device_exec_frame();
+                else
+                    runahead_exec_frame();
+
+                rewind_on_frame();
+            }
+        }
+
+        cart_update_save(&opts->cart);
+
+        _output_audio();
+    }
+
+    _stop_movie();
+    runahead_cleanup();
+    rewind_cleanup();
+    device_unload_cart();
+
+    return NULL;
+}
 
 int main(int argc, char* argv[]) {
     log_set_level(LOG_TRACE);
 
-    if (argc < MIN_EXPECTED_ARG_COUNT || argc > MAX_EXPECTED_ARG_COUNT) {
-        log_error("incorrect arg count. expected between %d and %d (got %d)\n", MIN_EXPECTED_ARG_COUNT, MAX_EXPECTED_ARG_COUNT, argc);
-        return 1;
+    const char* cache_dir       = NULL;
+    const char* playlist_path   = NULL;
+    const char* audio_path      = NULL;
+    const char* bindings_path   = NULL;
+    EmuOptions opts             = {
+        .ram_pattern    = kRAMPATTERN_RANDOM,
+        .rewind_mb      = DEFAULT_REWIND_BUFFER_MB,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:b:c:i:l:m:o:r:s:tw:p:")) != -1) {
+        switch (opt) {
+            case 'a':
+                opts.runahead_frames = strtol(optarg, NULL, 10);
+                if (opts.runahead_frames < 0 || opts.runahead_frames > RUNAHEAD_MAX_FRAMES) {
+                    log_error("run-ahead frames must be between 0 and %d (got '%s')", RUNAHEAD_MAX_FRAMES, optarg);
+                    return 1;
+                }
+                break;
+            case 'b':
+                s_fast_boot_frames = strtol(optarg, NULL, 10);
+                if (s_fast_boot_frames <= 0) {
+                    log_error("fast boot frames must be positive (got '%s')", optarg);
+                    return 1;
+                }
+                break;
+            case 'c':
+                cache_dir = optarg;
+                break;
+            case 'i':
+                bindings_path = optarg;
+                break;
+            case 'l':
+                playlist_path = optarg;
+                break;
+            case 'o':
+                audio_path = optarg;
+                break;
+            case 'r':
+                opts.rewind_mb = strtol(optarg, NULL, 10);
+                if (opts.rewind_mb < 0) {
+                    log_error("rewind buffer size can't be negative (got '%s')", optarg);
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (! ram_pattern_from_name(optarg, &opts.ram_pattern)) {
+                    log_error("unknown ram pattern '%s'", optarg);
+                    return 1;
+                }
+                opts.has_ram_pattern = 1;
+                break;
+            case 's':
+                opts.has_seed   = 1;
+                opts.seed       = strtoull(optarg, NULL, 0);
+                break;
+            case 't':
+                opts.runahead_threaded = 1;
+                break;
+            case 'w':
+            case 'p':
+                if (s_movie_mode != kMOVIE_MODE_NONE) {
+                    log_error("can't record and play a movie at the same time");
+                    return 1;
+                }
+
+                opts.movie_path = optarg;
+                s_movie_mode    = opt == 'w' ? kMOVIE_MODE_RECORD : kMOVIE_MODE_PLAY;
+                break;
+
+            default:
+                _print_usage(argv[0]);
+                return 1;
+        }
     }
 
-    Cart cart;
-    if (! cart_load(argv[1], &cart))
+    const int arg_count = argc - optind;
+    if (arg_count < MIN_EXPECTED_ARG_COUNT || arg_count > MAX_EXPECTED_ARG_COUNT) {
+        log_error("incorrect arg count. expected between %d and %d (got %d)", MIN_EXPECTED_ARG_COUNT, MAX_EXPECTED_ARG_COUNT, arg_count);
+        _print_usage(argv[0]);
         return 1;
+    }
+
+    const char* palette_path = arg_count == 2 ? argv[optind+1] : NULL;
+
+    // the rom given on the command line is always first in the playlist, so
+    // cycling through it wraps back around to where we started
+    opts.roms       = malloc(sizeof(*opts.roms));
+    opts.rom_count  = 1;
+    opts.roms[0]    = strdup(argv[optind]);
+
+    int success = 0;
+    pthread_t emu_thread;
+    if (playlist_path != NULL && ! _load_playlist(playlist_path, &opts.roms, &opts.rom_count))
+        goto bail_roms;
+
+    if (s_fast_boot_frames > 0)
+        s_cache_dir = cache_dir != NULL ? strdup(cache_dir) : fastboot_get_default_cache_dir();
+
+    // movies start from a blank PRG RAM, so leave the save file alone
+    if (! _load_cart(opts.roms[0], &opts.cart, s_movie_mode == kMOVIE_MODE_NONE))
+        goto bail_roms;
+
+    if (! audio_init(audio_path != NULL ? kAUDIO_SINK_FILE : kAUDIO_SINK_NULL, audio_path, AUDIO_DEFAULT_SAMPLE_RATE))
+        goto bail_cart;
+
+    // the apu always synthesizes at its default rate, so this needn't wait
+    // for the emulation thread
+    if (! resampler_init(&s_resampler, APU_DEFAULT_SAMPLE_RATE, audio_get_sample_rate()))
+        goto bail_audio;
+    if (resampler_get_max_output(&s_resampler, AUDIO_CHUNK_SAMPLES) > RESAMPLED_CHUNK_SAMPLES) {
+        log_error("can't resample audio up to %uHz", audio_get_sample_rate());
+        goto bail_audio;
+    }
 
     platform_init();
-    device_init();
-    device_load_cart(&cart);
+    if (bindings_path != NULL && ! platform_load_bindings(bindings_path))
+        goto bail_platform;
 
-    const char* palette_path = argc == 3 ? argv[2] : NULL;
     color_palette_from_file(palette_path);
 
-    uint32_t buffer[VIDEO_BUFFER_WIDTH*VIDEO_BUFFER_HEIGHT];
-    size_t pixel = 0;
+    atomic_store(&s_emulating, 1);
+    if (pthread_create(&emu_thread, NULL, _emulate, &opts) != 0) {
+        log_error("failed to start the emulation thread");
+        goto bail_platform;
+    }
+
+    // this thread only polls and presents, so a stall waiting on vsync never
+    // holds up emulation
+    // inputs reach the emulation thread as their events arrive, so all this
+    // thread does with them is time how long they take to show up
+    InputLatency latency    = { 0 };
+    uint64_t shown_input_ns = 0;
     while (platform_is_running()) {
         platform_poll_events();
 
-        memset(buffer, 0, sizeof(buffer[0])*VIDEO_BUFFER_WIDTH*VIDEO_BUFFER_HEIGHT);
-        pixel = (pixel+1) % (VIDEO_BUFFER_WIDTH*VIDEO_BUFFER_HEIGHT);
-        buffer[pixel] = 0xFFFFFFFF;
-        platform_update_frame_buffer(buffer);
+        const PlatformAction action = platform_pop_action();
+        if (action != kPLATFORM_ACTION_NONE)
+            _post_action(action, action == kPLATFORM_ACTION_LOAD_ROM ? platform_get_dropped_path() : NULL);
+
+        // frames are read in place out of the ppu's buffers, which the
+        // emulation thread leaves alone until this one moves on to a newer one
+        TripleBuffer* frames    = atomic_load_explicit(&s_frames, memory_order_acquire);
+        const VideoFrame* frame = frames != NULL ? triple_buffer_acquire(frames) : NULL;
+        if (frame != NULL)
+            platform_update_frame_buffer(frame->pixels);
 
-        device_exec();
         platform_draw();
+
+        if (frame != NULL && frame->tag != shown_input_ns) {
+            shown_input_ns = frame->tag;
+            _record_input_latency(&latency, get_time_ns() - frame->tag);
+        }
     }
 
-    cart_unload(&cart);
+    atomic_store(&s_emulating, 0);
+    pthread_join(emu_thread, NULL);
+    success = 1;
+
+    if (latency.count > 0)
+        log_info("input to present latency: %.1fms average, %.1fms worst over %llu inputs", latency.total_ns / 1e6 / latency.count, latency.worst_ns / 1e6, (unsigned long long)latency.count);
+
+bail_platform:
     platform_cleanup();
 
-    return 0;
+    char* path;
+    while (_take_action(&path) != kPLATFORM_ACTION_NONE)
+        free(path);
+
+bail_audio:
+    audio_cleanup();
+
+bail_cart:
+    cart_unload(&opts.cart);
+
+bail_roms:
+    for (size_t i = 0; i < opts.rom_count; ++i)
+        free(opts.roms[i]);
+    free(opts.roms);
+    free(s_cache_dir);
+    free(s_rom_path);
+
+    return success ? 0 : 1;
 }
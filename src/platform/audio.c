@@ -0,0 +1,119 @@
+#include "audio.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "device/audio_file.h"
+#include "helpers.h"
+#include "log.h"
+
+// how far ahead of playback emulation runs. the queue is kept around here,
+// so it's also the audio latency
+#define TARGET_LATENCY_MS 40
+#define MAX_RATE_DELTA 0.005
+
+typedef struct {
+    AudioSink   sink;
+    AudioFile*  file;
+    uint32_t    sample_rate;
+    size_t      target_queued;
+    uint64_t    clock_start_ns; // when the first sample written since the last underrun started playing
+    uint64_t    written;        // samples written since clock_start_ns
+    uint64_t    underruns;
+} Audio;
+
+static Audio s_audio;
+
+static uint64_t _get_played(void) {
+    const uint64_t elapsed_ns = get_time_ns() - s_audio.clock_start_ns;
+    return (uint64_t)((double)elapsed_ns * s_audio.sample_rate / 1e9);
+}
+
+int audio_init(AudioSink sink, const char* path, uint32_t sample_rate) {
+    memset(&s_audio, 0, sizeof(s_audio));
+
+    if (sample_rate == 0) {
+        log_error("audio sample rate can't be 0");
+        return 0;
+    }
+
+    switch (sink) {
+        case kAUDIO_SINK_NULL:
+            break;
+        case kAUDIO_SINK_FILE:
+            s_audio.file = audio_file_open(path, kAUDIO_FILE_FORMAT_RAW_S16, sample_rate);
+            if (s_audio.file == NULL)
+                return 0;
+            break;
+    }
+
+    s_audio.sink            = sink;
+    s_audio.sample_rate     = sample_rate;
+    s_audio.target_queued   = (size_t)sample_rate * TARGET_LATENCY_MS / 1000;
+    s_audio.clock_start_ns  = get_time_ns();
+
+    log_info("audio output at %uHz, %dms latency", sample_rate, TARGET_LATENCY_MS);
+
+    return 1;
+}
+
+void audio_cleanup(void) {
+    if (s_audio.file != NULL)
+        audio_file_close(s_audio.file);
+
+    if (s_audio.underruns > 0)
+        log_warn("audio ran dry %llu times", (unsigned long long)s_audio.underruns);
+
+    memset(&s_audio, 0, sizeof(s_audio));
+}
+
+uint32_t audio_get_sample_rate(void) {
+    return s_audio.sample_rate;
+}
+
+void audio_write(const int16_t* samples, size_t count) {
+    // once the queue has run dry playback restarts from whatever comes next
+    if (audio_get_queued() == 0) {
+        if (s_audio.written > 0)
+            ++s_audio.underruns;
+
+        s_audio.clock_start_ns  = get_time_ns();
+        s_audio.written         = 0;
+    }
+
+    if (s_audio.sink == kAUDIO_SINK_FILE)
+        audio_file_write(s_audio.file, samples, count);
+
+    s_audio.written += count;
+}
+
+size_t audio_get_queued(void) {
+    const uint64_t played = _get_played();
+    return played < s_audio.written ? s_audio.written - played : 0;
+}
+
+double audio_get_rate_ratio(void) {
+    // the queue sits halfway through its range at the target, so anything
+    // below that speeds up to refill it and anything above slows down
+    const double fill   = (double)audio_get_queued() / (2 * s_audio.target_queued);
+    double ratio        = 1.0 + MAX_RATE_DELTA * (1.0 - 2.0 * fill);
+    if (ratio < 1.0 - MAX_RATE_DELTA)
+        ratio = 1.0 - MAX_RATE_DELTA;
+
+    return ratio;
+}
+
+void audio_wait(void) {
+    const size_t queued = audio_get_queued();
+    if (queued <= s_audio.target_queued)
+        return;
+
+    const uint64_t wait_ns = (uint64_t)(queued - s_audio.target_queued) * 1000000000 / s_audio.sample_rate;
+    struct timespec ts = {
+        .tv_sec     = wait_ns / 1000000000,
+        .tv_nsec    = wait_ns % 1000000000,
+    };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
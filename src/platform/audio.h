@@ -0,0 +1,34 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define AUDIO_DEFAULT_SAMPLE_RATE 48000
+
+// where samples go. every sink plays its queue back against the wall clock at
+// the sample rate, so pacing behaves the same whichever one is in use and can
+// be exercised without a sound device
+typedef enum {
+    kAUDIO_SINK_NULL = 0,   // discards samples
+    kAUDIO_SINK_FILE,       // writes samples to a file as raw signed 16 bit mono, off this thread
+} AudioSink;
+
+// path is only used by the file sink
+int audio_init(AudioSink sink, const char* path, uint32_t sample_rate);
+void audio_cleanup(void);
+uint32_t audio_get_sample_rate(void);
+
+// queues mono samples for playback
+void audio_write(const int16_t* samples, size_t count);
+// samples queued but not yet played
+size_t audio_get_queued(void);
+
+// how many samples to produce per emulated sample, nudged within +/-0.5% to
+// keep the queue at its target latency without under or overrunning
+double audio_get_rate_ratio(void);
+// sleeps until the queue has drained down to its target latency. this is what
+// paces emulation
+void audio_wait(void);
+
+#endif
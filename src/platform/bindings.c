@@ -0,0 +1,315 @@
+#include "bindings.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define BINDINGS_COMMENT '#'
+// how far a stick or trigger has to move before it counts as pressed
+#define AXIS_THRESHOLD 0.5f
+
+typedef struct {
+    const char* name;
+    int         value;
+} NamedValue;
+
+typedef enum {
+    kAXIS_DIRECTION_NEG = 0,
+    kAXIS_DIRECTION_POS,
+} AxisDirection;
+
+static const NamedValue s_input_names[] = {
+    { "up",     kINPUT_UP },
+    { "down",   kINPUT_DOWN },
+    { "left",   kINPUT_LEFT },
+    { "right",  kINPUT_RIGHT },
+    { "a",      kINPUT_A },
+    { "b",      kINPUT_B },
+    { "start",  kINPUT_START },
+    { "select", kINPUT_SELECT },
+};
+
+// letters, digits, f1-f12 and kp0-kp9 are worked out rather than listed
+static const NamedValue s_key_names[] = {
+    { "space",          GLFW_KEY_SPACE },
+    { "apostrophe",     GLFW_KEY_APOSTROPHE },
+    { "comma",          GLFW_KEY_COMMA },
+    { "minus",          GLFW_KEY_MINUS },
+    { "period",         GLFW_KEY_PERIOD },
+    { "slash",          GLFW_KEY_SLASH },
+    { "semicolon",      GLFW_KEY_SEMICOLON },
+    { "equal",          GLFW_KEY_EQUAL },
+    { "left_bracket",   GLFW_KEY_LEFT_BRACKET },
+    { "backslash",      GLFW_KEY_BACKSLASH },
+    { "right_bracket",  GLFW_KEY_RIGHT_BRACKET },
+    { "grave",          GLFW_KEY_GRAVE_ACCENT },
+    { "enter",          GLFW_KEY_ENTER },
+    { "insert",         GLFW_KEY_INSERT },
+    { "delete",         GLFW_KEY_DELETE },
+    { "home",           GLFW_KEY_HOME },
+    { "end",            GLFW_KEY_END },
+    { "up",             GLFW_KEY_UP },
+    { "down",           GLFW_KEY_DOWN },
+    { "left",           GLFW_KEY_LEFT },
+    { "right",          GLFW_KEY_RIGHT },
+    { "left_shift",     GLFW_KEY_LEFT_SHIFT },
+    { "left_control",   GLFW_KEY_LEFT_CONTROL },
+    { "left_alt",       GLFW_KEY_LEFT_ALT },
+    { "right_shift",    GLFW_KEY_RIGHT_SHIFT },
+    { "right_control",  GLFW_KEY_RIGHT_CONTROL },
+    { "right_alt",      GLFW_KEY_RIGHT_ALT },
+};
+
+static const NamedValue s_button_names[] = {
+    { "a",              GLFW_GAMEPAD_BUTTON_A },
+    { "b",              GLFW_GAMEPAD_BUTTON_B },
+    { "x",              GLFW_GAMEPAD_BUTTON_X },
+    { "y",              GLFW_GAMEPAD_BUTTON_Y },
+    { "left_bumper",    GLFW_GAMEPAD_BUTTON_LEFT_BUMPER },
+    { "right_bumper",   GLFW_GAMEPAD_BUTTON_RIGHT_BUMPER },
+    { "back",           GLFW_GAMEPAD_BUTTON_BACK },
+    { "start",          GLFW_GAMEPAD_BUTTON_START },
+    { "guide",          GLFW_GAMEPAD_BUTTON_GUIDE },
+    { "left_thumb",     GLFW_GAMEPAD_BUTTON_LEFT_THUMB },
+    { "right_thumb",    GLFW_GAMEPAD_BUTTON_RIGHT_THUMB },
+    { "dpad_up",        GLFW_GAMEPAD_BUTTON_DPAD_UP },
+    { "dpad_right",     GLFW_GAMEPAD_BUTTON_DPAD_RIGHT },
+    { "dpad_down",      GLFW_GAMEPAD_BUTTON_DPAD_DOWN },
+    { "dpad_left",      GLFW_GAMEPAD_BUTTON_DPAD_LEFT },
+};
+
+// sticks read negative up and left. triggers rest at -1, so only count when pulled
+static const NamedValue s_axis_names[] = {
+    { "left_x",         GLFW_GAMEPAD_AXIS_LEFT_X },
+    { "left_y",         GLFW_GAMEPAD_AXIS_LEFT_Y },
+    { "right_x",        GLFW_GAMEPAD_AXIS_RIGHT_X },
+    { "right_y",        GLFW_GAMEPAD_AXIS_RIGHT_Y },
+};
+
+static const NamedValue s_trigger_names[] = {
+    { "left_trigger",   GLFW_GAMEPAD_AXIS_LEFT_TRIGGER },
+    { "right_trigger",  GLFW_GAMEPAD_AXIS_RIGHT_TRIGGER },
+};
+
+#define NAMED_VALUE_COUNT(names) (sizeof(names) / sizeof((names)[0]))
+
+static const int s_reserved_keys[] = {
+    EXIT_KEY, NEXT_ROM_KEY, PREV_ROM_KEY, SAVE_STATE_KEY, LOAD_STATE_KEY, REWIND_KEY, FAST_FORWARD_KEY, RESET_KEY, POWER_KEY,
+};
+
+static int _find_name(const NamedValue* names, size_t count, const char* name, int* out);
+static int _is_reserved_key(int key);
+static int _parse_key(const char* name, int* out);
+static int _parse_pad(const char* name, BindingMask** table, Bindings* bindings, uint8_t player);
+
+void bindings_set_defaults(Bindings* bindings) {
+    memset(bindings, 0, sizeof(*bindings));
+
+    bindings->keys[GLFW_KEY_UP]     = BINDING_MASK(0, kINPUT_UP);
+    bindings->keys[GLFW_KEY_DOWN]   = BINDING_MASK(0, kINPUT_DOWN);
+    bindings->keys[GLFW_KEY_LEFT]   = BINDING_MASK(0, kINPUT_LEFT);
+    bindings->keys[GLFW_KEY_RIGHT]  = BINDING_MASK(0, kINPUT_RIGHT);
+    bindings->keys[GLFW_KEY_Z]      = BINDING_MASK(0, kINPUT_A);
+    bindings->keys[GLFW_KEY_X]      = BINDING_MASK(0, kINPUT_B);
+    bindings->keys[GLFW_KEY_A]      = BINDING_MASK(0, kINPUT_SELECT);
+    bindings->keys[GLFW_KEY_S]      = BINDING_MASK(0, kINPUT_START);
+
+    // the pad's right face button is A, like on the NES, and the left stick
+    // works as well as the d-pad
+    for (uint8_t player = 0; player < INPUT_PORT_COUNT; ++player) {
+        BindingMask* buttons    = bindings->buttons[player];
+        BindingMask* axes_neg   = bindings->axes_neg[player];
+        BindingMask* axes_pos   = bindings->axes_pos[player];
+
+        buttons[GLFW_GAMEPAD_BUTTON_DPAD_UP]    = BINDING_MASK(player, kINPUT_UP);
+        buttons[GLFW_GAMEPAD_BUTTON_DPAD_DOWN]  = BINDING_MASK(player, kINPUT_DOWN);
+        buttons[GLFW_GAMEPAD_BUTTON_DPAD_LEFT]  = BINDING_MASK(player, kINPUT_LEFT);
+        buttons[GLFW_GAMEPAD_BUTTON_DPAD_RIGHT] = BINDING_MASK(player, kINPUT_RIGHT);
+        buttons[GLFW_GAMEPAD_BUTTON_B]          = BINDING_MASK(player, kINPUT_A);
+        buttons[GLFW_GAMEPAD_BUTTON_A]          = BINDING_MASK(player, kINPUT_B);
+        buttons[GLFW_GAMEPAD_BUTTON_BACK]       = BINDING_MASK(player, kINPUT_SELECT);
+        buttons[GLFW_GAMEPAD_BUTTON_START]      = BINDING_MASK(player, kINPUT_START);
+
+        axes_neg[GLFW_GAMEPAD_AXIS_LEFT_Y]      = BINDING_MASK(player, kINPUT_UP);
+        axes_pos[GLFW_GAMEPAD_AXIS_LEFT_Y]      = BINDING_MASK(player, kINPUT_DOWN);
+        axes_neg[GLFW_GAMEPAD_AXIS_LEFT_X]      = BINDING_MASK(player, kINPUT_LEFT);
+        axes_pos[GLFW_GAMEPAD_AXIS_LEFT_X]      = BINDING_MASK(player, kINPUT_RIGHT);
+    }
+}
+
+int bindings_load(Bindings* bindings, const char* path) {
+    log_info("loading bindings from '%s'...", path);
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        log_error("failed to open bindings '%s': %s", path, strerror(errno));
+        return 0;
+    }
+
+    // parsed into a copy so a bad file leaves the current bindings alone
+    Bindings* loaded = calloc(1, sizeof(*loaded));
+    if (loaded == NULL) {
+        log_error("failed to allocate bindings");
+        fclose(f);
+        return 0;
+    }
+
+    int success         = 1;
+    size_t line_num     = 0;
+    size_t count        = 0;
+    char* line          = NULL;
+    size_t line_cap     = 0;
+    while (getline(&line, &line_cap, f) != -1) {
+        ++line_num;
+
+        // each line is '<player> <button> key|pad <name>', eg. '1 a key z'
+        unsigned player;
+        char button[16], source[8], name[32];
+        const char* start = line + strspn(line, " \t");
+        if (*start == BINDINGS_COMMENT || *start == '\n' || *start == '\r' || *start == '\0')
+            continue;
+
+        int input;
+        if (sscanf(start, "%u %15s %7s %31s", &player, button, source, name) != 4 || player < 1 || player > INPUT_PORT_COUNT ||
+            ! _find_name(s_input_names, NAMED_VALUE_COUNT(s_input_names), button, &input)) {
+            log_error("%s:%zu: expected '<player 1-%d> <up|down|left|right|a|b|start|select> key|pad <name>'", path, line_num, INPUT_PORT_COUNT);
+            success = 0;
+            break;
+        }
+
+        const BindingMask mask = BINDING_MASK(player - 1, input);
+        if (strcmp(source, "key") == 0) {
+            int key;
+            if (! _parse_key(name, &key)) {
+                log_error("%s:%zu: unknown key '%s'", path, line_num, name);
+                success = 0;
+                break;
+            }
+            if (_is_reserved_key(key)) {
+                log_error("%s:%zu: key '%s' is used by the frontend and can't be bound", path, line_num, name);
+                success = 0;
+                break;
+            }
+
+            loaded->keys[key] |= mask;
+        } else if (strcmp(source, "pad") == 0) {
+            BindingMask* table;
+            if (! _parse_pad(name, &table, loaded, player - 1)) {
+                log_error("%s:%zu: unknown gamepad button or axis '%s'", path, line_num, name);
+                success = 0;
+                break;
+            }
+
+            *table |= mask;
+        } else {
+            log_error("%s:%zu: unknown source '%s', expected key or pad", path, line_num, source);
+            success = 0;
+            break;
+        }
+
+        ++count;
+    }
+
+    free(line);
+    fclose(f);
+
+    if (success) {
+        *bindings = *loaded;
+        log_info("loaded %zu bindings", count);
+    }
+
+    free(loaded);
+    return success;
+}
+
+BindingMask bindings_translate_gamepad(const Bindings* bindings, uint8_t player, const GLFWgamepadstate* state) {
+    // every button and axis is folded in whether it's bound or not, as masking
+    // is cheaper than branching on each
+    BindingMask mask = 0;
+    for (size_t i = 0; i <= GLFW_GAMEPAD_BUTTON_LAST; ++i)
+        mask |= bindings->buttons[player][i] & -(BindingMask)(state->buttons[i] == GLFW_PRESS);
+
+    for (size_t i = 0; i <= GLFW_GAMEPAD_AXIS_LAST; ++i) {
+        mask |= bindings->axes_neg[player][i] & -(BindingMask)(state->axes[i] < -AXIS_THRESHOLD);
+        mask |= bindings->axes_pos[player][i] & -(BindingMask)(state->axes[i] > AXIS_THRESHOLD);
+    }
+
+    return mask;
+}
+
+static int _find_name(const NamedValue* names, size_t count, const char* name, int* out) {
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(names[i].name, name) == 0) {
+            *out = names[i].value;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int _is_reserved_key(int key) {
+    for (size_t i = 0; i < sizeof(s_reserved_keys)/sizeof(s_reserved_keys[0]); ++i) {
+        if (s_reserved_keys[i] == key)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int _parse_key(const char* name, int* out) {
+    const size_t len = strlen(name);
+    if (len == 1 && name[0] >= 'a' && name[0] <= 'z') {
+        *out = GLFW_KEY_A + (name[0] - 'a');
+        return 1;
+    }
+    if (len == 1 && name[0] >= '0' && name[0] <= '9') {
+        *out = GLFW_KEY_0 + (name[0] - '0');
+        return 1;
+    }
+
+    char* end;
+    if (name[0] == 'f' && len > 1) {
+        const long n = strtol(name + 1, &end, 10);
+        if (*end == '\0' && n >= 1 && n <= 12) {
+            *out = GLFW_KEY_F1 + (int)(n - 1);
+            return 1;
+        }
+    }
+    if (strncmp(name, "kp", 2) == 0 && len == 3 && name[2] >= '0' && name[2] <= '9') {
+        *out = GLFW_KEY_KP_0 + (name[2] - '0');
+        return 1;
+    }
+
+    return _find_name(s_key_names, NAMED_VALUE_COUNT(s_key_names), name, out);
+}
+
+// buttons by name, sticks as eg. 'left_x-' or 'left_y+' and triggers by name
+static int _parse_pad(const char* name, BindingMask** table, Bindings* bindings, uint8_t player) {
+    int value;
+    if (_find_name(s_button_names, NAMED_VALUE_COUNT(s_button_names), name, &value)) {
+        *table = &bindings->buttons[player][value];
+        return 1;
+    }
+    if (_find_name(s_trigger_names, NAMED_VALUE_COUNT(s_trigger_names), name, &value)) {
+        *table = &bindings->axes_pos[player][value];
+        return 1;
+    }
+
+    const size_t len = strlen(name);
+    if (len < 2 || (name[len-1] != '-' && name[len-1] != '+'))
+        return 0;
+
+    char axis[32];
+    memcpy(axis, name, len - 1);
+    axis[len - 1] = '\0';
+    if (! _find_name(s_axis_names, NAMED_VALUE_COUNT(s_axis_names), axis, &value))
+        return 0;
+
+    const AxisDirection direction = name[len-1] == '+' ? kAXIS_DIRECTION_POS : kAXIS_DIRECTION_NEG;
+    *table = direction == kAXIS_DIRECTION_POS ? &bindings->axes_pos[player][value] : &bindings->axes_neg[player][value];
+    return 1;
+}
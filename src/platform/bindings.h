@@ -0,0 +1,44 @@
+#ifndef BINDINGS_H
+#define BINDINGS_H
+
+#include "device/input.h"
+
+#include <GLFW/glfw3.h>
+
+#include <stdint.h>
+
+// a set of both players' inputs, player 1's in the low byte
+typedef uint16_t BindingMask;
+
+#define BINDING_MASK(player, input) ((BindingMask)(1u << ((player)*kINPUT_SIZE + (input))))
+
+// keys the frontend handles itself, which can't be bound
+#define EXIT_KEY         GLFW_KEY_ESCAPE
+#define NEXT_ROM_KEY     GLFW_KEY_PAGE_DOWN
+#define PREV_ROM_KEY     GLFW_KEY_PAGE_UP
+#define SAVE_STATE_KEY   GLFW_KEY_F5
+#define LOAD_STATE_KEY   GLFW_KEY_F7
+#define REWIND_KEY       GLFW_KEY_BACKSPACE
+#define FAST_FORWARD_KEY GLFW_KEY_TAB
+#define RESET_KEY        GLFW_KEY_F1
+#define POWER_KEY        GLFW_KEY_F2
+
+// every binding compiled down into flat tables, indexed by key, or by player
+// and gamepad button or axis, of what each one presses
+typedef struct {
+    BindingMask keys[GLFW_KEY_LAST + 1];
+    BindingMask buttons[INPUT_PORT_COUNT][GLFW_GAMEPAD_BUTTON_LAST + 1];
+    BindingMask axes_neg[INPUT_PORT_COUNT][GLFW_GAMEPAD_AXIS_LAST + 1];
+    BindingMask axes_pos[INPUT_PORT_COUNT][GLFW_GAMEPAD_AXIS_LAST + 1];
+} Bindings;
+
+// arrows, Z, X, A and S for player 1, and a gamepad each for both players
+void bindings_set_defaults(Bindings* bindings);
+// replaces every binding with those in the file, or leaves them alone if it
+// doesn't parse. see bindings.cfg for the format
+int bindings_load(Bindings* bindings, const char* path);
+
+// what a player's gamepad is pressing
+BindingMask bindings_translate_gamepad(const Bindings* bindings, uint8_t player, const GLFWgamepadstate* state);
+
+#endif
@@ -3,9 +3,12 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
-// TODO: add a function to device.h which allows the retrieval of the
-// frame buffer so we can stop relying on the ppu here
-#include "device/ppu/ppu.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bindings.h"
+#include "device/device.h"
 #include "helpers.h"
 #include "log.h"
 
@@ -17,18 +20,71 @@
 #define GL_VERSION_MAJOR 3
 #define GL_VERSION_MINOR 2
 
+// frames are streamed to the texture through a ring of pixel buffer objects,
+// so the upload is an asynchronous copy on the gpu's side rather than the
+// driver copying out of client memory and stalling. with ARB_buffer_storage
+// the buffers stay mapped for good, otherwise each upload orphans its buffer
+#define PBO_COUNT 3
+#define FRAME_BUFFER_SIZE (VIDEO_BUFFER_WIDTH*VIDEO_BUFFER_HEIGHT*sizeof(uint32_t))
+
+// neither sync objects (GL 3.2) nor ARB_buffer_storage are in the GL 3.1
+// loader, so they're loaded by hand
+#define GL_SYNC_GPU_COMMANDS_COMPLETE   0x9117
+#define GL_ALREADY_SIGNALED             0x911A
+#define GL_CONDITION_SATISFIED          0x911C
+#define GL_MAP_PERSISTENT_BIT           0x0040
+#define GL_MAP_COHERENT_BIT             0x0080
+
+typedef GLsync (APIENTRYP PFNGLFENCESYNCPROC)(GLenum condition, GLbitfield flags);
+typedef GLenum (APIENTRYP PFNGLCLIENTWAITSYNCPROC)(GLsync sync, GLbitfield flags, GLuint64 timeout);
+typedef void (APIENTRYP PFNGLDELETESYNCPROC)(GLsync sync);
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+static struct {
+    GLuint                      pbos[PBO_COUNT];
+    GLsync                      fences[PBO_COUNT];
+    uint8_t*                    mapped[PBO_COUNT];  // only when persistent
+    size_t                      next;
+    int                         persistent;
+
+    PFNGLFENCESYNCPROC          fence_sync;
+    PFNGLCLIENTWAITSYNCPROC     client_wait_sync;
+    PFNGLDELETESYNCPROC         delete_sync;
+    PFNGLBUFFERSTORAGEPROC      buffer_storage;
+} s_stream;
+
 static GLFWwindow* s_window = NULL;
 static GLuint s_vao;
 static GLuint s_tex;
 static GLuint s_program;
 
-static int s_keymap[kINPUT_SIZE] = {0};
+static Bindings s_bindings;
+
+// what the key callback and gamepad polling have seen so far. only touched on
+// the platform thread, which publishes each change below. every key bound to
+// an input is counted, so letting go of one doesn't release another held down
+#define PAD_INPUT_COUNT (INPUT_PORT_COUNT*kINPUT_SIZE)
 
-#define ASSIGN_KEYMAP(i, k) s_keymap[i] = k
+static uint8_t s_key_holds[PAD_INPUT_COUNT] = {0};
+static BindingMask s_key_inputs = 0;
+static BindingMask s_gamepad_inputs = 0;
+static int s_gamepads[INPUT_PORT_COUNT] = {0};
+static int s_rewind_held = 0;
+static int s_fast_forward_held = 0;
 
-static InputFlags s_input_state = 0;
+// the published input state, behind a sequence lock so the emulation thread
+// can read it without ever holding up the callback. seq is odd mid-update
+#define INPUT_REWIND_BIT        (PAD_INPUT_COUNT + 0)
+#define INPUT_FAST_FORWARD_BIT  (PAD_INPUT_COUNT + 1)
 
-#define EXIT_KEY GLFW_KEY_ESCAPE
+static struct {
+    atomic_uint                 seq;
+    atomic_uint                 state;
+    _Atomic uint64_t            changed_ns;
+} s_published_input;
+
+static PlatformAction s_action = kPLATFORM_ACTION_NONE;
+static char* s_dropped_path = NULL;
 
 static const char* s_vert_shader_src =
     "#version 330\n"
@@ -47,6 +103,12 @@ static const char* s_frag_shader_src =
     "   frag_color = texture(tex, tex_coords);\n"
     "}\n";
 
+static void _publish_input_state(void);
+static void _assign_gamepads(void);
+static void _stream_init(void);
+static int _stream_create_buffers(int persistent);
+static void _stream_cleanup(void);
+
 static void _glfw_error_cb(int error, const char* desc) {
     log_error("glfw error (%d): %s\n", error, desc);
 }
@@ -56,6 +118,12 @@ static void _input_callback(GLFWwindow* window, int key, int scancode, int actio
     (void)scancode;
     (void)mods;
 
+    // the state only changes on press and release, never on repeat
+    if (action == GLFW_REPEAT)
+        return;
+
+    const int pressed = action == GLFW_PRESS;
+
     // platform specific actions
     switch (key)
     {
@@ -63,7 +131,111 @@ static void _input_callback(GLFWwindow* window, int key, int scancode, int actio
             if (action == GLFW_PRESS)
                 glfwSetWindowShouldClose(s_window, 1);
             return;
+        case NEXT_ROM_KEY:
+            if (action == GLFW_PRESS)
+                s_action = kPLATFORM_ACTION_NEXT_ROM;
+            return;
+        case PREV_ROM_KEY:
+            if (action == GLFW_PRESS)
+                s_action = kPLATFORM_ACTION_PREV_ROM;
+            return;
+        case SAVE_STATE_KEY:
+            if (action == GLFW_PRESS)
+                s_action = kPLATFORM_ACTION_SAVE_STATE;
+            return;
+        case LOAD_STATE_KEY:
+            if (action == GLFW_PRESS)
+                s_action = kPLATFORM_ACTION_LOAD_STATE;
+            return;
+        case RESET_KEY:
+            if (action == GLFW_PRESS)
+                s_action = kPLATFORM_ACTION_RESET;
+            return;
+        case POWER_KEY:
+            if (action == GLFW_PRESS)
+                s_action = kPLATFORM_ACTION_POWER_CYCLE;
+            return;
+        case REWIND_KEY:
+            s_rewind_held = pressed;
+            _publish_input_state();
+            return;
+        case FAST_FORWARD_KEY:
+            s_fast_forward_held = pressed;
+            _publish_input_state();
+            return;
     }
+
+    if (key < 0 || key > GLFW_KEY_LAST || s_bindings.keys[key] == 0)
+        return;
+
+    // a key can be bound to several inputs, so every one of them is updated
+    const BindingMask mask = s_bindings.keys[key];
+    const BindingMask prev = s_key_inputs;
+    for (size_t i = 0; i < PAD_INPUT_COUNT; ++i) {
+        if (! (mask & BIT(i)))
+            continue;
+
+        if (pressed)
+            ++s_key_holds[i];
+        else if (s_key_holds[i] > 0)
+            --s_key_holds[i];
+
+        if (s_key_holds[i] > 0)
+            s_key_inputs |= BIT(i);
+        else
+            s_key_inputs &= ~BIT(i);
+    }
+
+    if (s_key_inputs != prev)
+        _publish_input_state();
+}
+
+static void _joystick_callback(int jid, int event) {
+    (void)jid;
+    (void)event;
+
+    _assign_gamepads();
+}
+
+// players get connected gamepads in the order they're found
+static void _assign_gamepads(void) {
+    size_t player = 0;
+    for (int jid = GLFW_JOYSTICK_1; jid <= GLFW_JOYSTICK_LAST && player < INPUT_PORT_COUNT; ++jid) {
+        if (glfwJoystickIsGamepad(jid))
+            s_gamepads[player++] = jid;
+    }
+
+    for (; player < INPUT_PORT_COUNT; ++player)
+        s_gamepads[player] = -1;
+}
+
+static void _publish_input_state(void) {
+    uint32_t state = s_key_inputs | s_gamepad_inputs;
+    if (s_rewind_held)
+        state |= BIT(INPUT_REWIND_BIT);
+    if (s_fast_forward_held)
+        state |= BIT(INPUT_FAST_FORWARD_BIT);
+
+    const unsigned seq = atomic_load_explicit(&s_published_input.seq, memory_order_relaxed);
+    atomic_store_explicit(&s_published_input.seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&s_published_input.state, state, memory_order_relaxed);
+    atomic_store_explicit(&s_published_input.changed_ns, get_time_ns(), memory_order_relaxed);
+
+    atomic_store_explicit(&s_published_input.seq, seq + 2, memory_order_release);
+}
+
+static void _drop_callback(GLFWwindow* window, int count, const char** paths) {
+    (void)window;
+
+    if (count < 1)
+        return;
+
+    // only one rom can run at a time, so take the first if several are dropped
+    free(s_dropped_path);
+    s_dropped_path  = strdup(paths[0]);
+    s_action        = kPLATFORM_ACTION_LOAD_ROM;
 }
 
 int platform_init(void) {
@@ -85,14 +257,10 @@ int platform_init(void) {
     }
 
     glfwSetKeyCallback(s_window, _input_callback);
-    ASSIGN_KEYMAP(kINPUT_UP,        GLFW_KEY_UP);
-    ASSIGN_KEYMAP(kINPUT_DOWN,      GLFW_KEY_DOWN);
-    ASSIGN_KEYMAP(kINPUT_LEFT,      GLFW_KEY_LEFT);
-    ASSIGN_KEYMAP(kINPUT_RIGHT,     GLFW_KEY_RIGHT);
-    ASSIGN_KEYMAP(kINPUT_A,         GLFW_KEY_Z);
-    ASSIGN_KEYMAP(kINPUT_B,         GLFW_KEY_X);
-    ASSIGN_KEYMAP(kINPUT_SELECT,    GLFW_KEY_A);
-    ASSIGN_KEYMAP(kINPUT_START,     GLFW_KEY_S);
+    glfwSetDropCallback(s_window, _drop_callback);
+    glfwSetJoystickCallback(_joystick_callback);
+    bindings_set_defaults(&s_bindings);
+    _assign_gamepads();
 
     glfwMakeContextCurrent(s_window);
     gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
@@ -136,38 +304,128 @@ int platform_init(void) {
     glDeleteShader(vert_shader);
     glDeleteShader(frag_shader);
 
+    _stream_init();
+
     return 1;
 }
 
 void platform_cleanup(void) {
+    _stream_cleanup();
     glDeleteProgram(s_program);
     glDeleteTextures(1, &s_tex);
     glDeleteVertexArrays(1, &s_vao);
     glfwDestroyWindow(s_window);
     glfwTerminate();
+
+    free(s_dropped_path);
+    s_dropped_path = NULL;
+}
+
+int platform_load_bindings(const char* path) {
+    if (! bindings_load(&s_bindings, path))
+        return 0;
+
+    // anything held under the old bindings is let go
+    memset(s_key_holds, 0, sizeof(s_key_holds));
+    s_key_inputs = 0;
+    _publish_input_state();
+
+    return 1;
 }
 
 void platform_poll_events(void) {
     glfwPollEvents();
 
-    for (size_t i = 0; i < kINPUT_SIZE; ++i) {
-        const int key   = s_keymap[i];
-        const int state = glfwGetKey(s_window, key);
+    // gamepads don't raise events, so they're sampled once per poll and only
+    // published when something changed
+    BindingMask gamepad_inputs = 0;
+    for (uint8_t player = 0; player < INPUT_PORT_COUNT; ++player) {
+        GLFWgamepadstate state;
+        if (s_gamepads[player] >= 0 && glfwGetGamepadState(s_gamepads[player], &state))
+            gamepad_inputs |= bindings_translate_gamepad(&s_bindings, player, &state);
+    }
 
-        write_bit(&s_input_state, i, state == GLFW_PRESS);
+    if (gamepad_inputs != s_gamepad_inputs) {
+        s_gamepad_inputs = gamepad_inputs;
+        _publish_input_state();
     }
 }
 
-InputFlags platform_get_inputs(void) {
-    return s_input_state;
+PlatformInputState platform_get_input_state(void) {
+    unsigned seq;
+    uint32_t state;
+    uint64_t changed_ns;
+
+    // retry if an update was in progress or landed while reading
+    do {
+        seq         = atomic_load_explicit(&s_published_input.seq, memory_order_acquire);
+        state       = atomic_load_explicit(&s_published_input.state, memory_order_relaxed);
+        changed_ns  = atomic_load_explicit(&s_published_input.changed_ns, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&s_published_input.seq, memory_order_relaxed));
+
+    return (PlatformInputState) {
+        .inputs             = { (InputFlags)state, (InputFlags)(state >> kINPUT_SIZE) },
+        .rewind_held        = (state & BIT(INPUT_REWIND_BIT)) != 0,
+        .fast_forward_held  = (state & BIT(INPUT_FAST_FORWARD_BIT)) != 0,
+        .changed_ns         = changed_ns,
+    };
+}
+
+PlatformAction platform_pop_action(void) {
+    const PlatformAction action = s_action;
+    s_action = kPLATFORM_ACTION_NONE;
+
+    return action;
+}
+
+const char* platform_get_dropped_path(void) {
+    return s_dropped_path;
 }
 
 int platform_is_running(void) {
     return ! glfwWindowShouldClose(s_window);
 }
 
-void platform_update_frame_buffer(uint32_t* buffer) {
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, VIDEO_BUFFER_WIDTH, VIDEO_BUFFER_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, buffer);
+void platform_update_frame_buffer(const uint32_t* buffer) {
+    const size_t idx = s_stream.next;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s_stream.pbos[idx]);
+
+    if (s_stream.persistent) {
+        // the gpu should be long done with a buffer by the time the ring comes
+        // back around to it. if it isn't, drop the frame rather than wait
+        if (s_stream.fences[idx] != NULL) {
+            const GLenum status = s_stream.client_wait_sync(s_stream.fences[idx], 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                return;
+            }
+
+            s_stream.delete_sync(s_stream.fences[idx]);
+            s_stream.fences[idx] = NULL;
+        }
+
+        memcpy(s_stream.mapped[idx], buffer, FRAME_BUFFER_SIZE);
+    } else {
+        // orphaning hands the old storage back to the driver to free once the
+        // gpu's done with it, so mapping the new storage never waits
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, FRAME_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, FRAME_BUFFER_SIZE, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (mapped != NULL) {
+            memcpy(mapped, buffer, FRAME_BUFFER_SIZE);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
+
+    // with a buffer bound, the pointer is an offset into it and the copy to
+    // the texture happens on the gpu's own time
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, VIDEO_BUFFER_WIDTH, VIDEO_BUFFER_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (s_stream.persistent)
+        s_stream.fences[idx] = s_stream.fence_sync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    s_stream.next = (idx + 1) % PBO_COUNT;
 }
 
 void platform_draw(void) {
@@ -176,3 +434,64 @@ void platform_draw(void) {
     glfwSwapBuffers(s_window);
 }
 
+static void _stream_init(void) {
+    memset(&s_stream, 0, sizeof(s_stream));
+
+    s_stream.fence_sync         = (PFNGLFENCESYNCPROC)glfwGetProcAddress("glFenceSync");
+    s_stream.client_wait_sync   = (PFNGLCLIENTWAITSYNCPROC)glfwGetProcAddress("glClientWaitSync");
+    s_stream.delete_sync        = (PFNGLDELETESYNCPROC)glfwGetProcAddress("glDeleteSync");
+    if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+        s_stream.buffer_storage = (PFNGLBUFFERSTORAGEPROC)glfwGetProcAddress("glBufferStorage");
+
+    s_stream.persistent = s_stream.buffer_storage != NULL && s_stream.fence_sync != NULL
+        && s_stream.client_wait_sync != NULL && s_stream.delete_sync != NULL;
+
+    if (s_stream.persistent && ! _stream_create_buffers(1)) {
+        log_warn("failed to map pixel buffers persistently, falling back on orphaning");
+        _stream_cleanup();
+        s_stream.persistent = 0;
+    }
+
+    if (! s_stream.persistent)
+        _stream_create_buffers(0);
+
+    log_info("streaming frames through %s pixel buffers", s_stream.persistent ? "persistently mapped" : "orphaned");
+}
+
+static int _stream_create_buffers(int persistent) {
+    // coherent, so writes are visible to the gpu without flushing
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    int success = 1;
+    glGenBuffers(PBO_COUNT, s_stream.pbos);
+    for (size_t i = 0; i < PBO_COUNT; ++i) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s_stream.pbos[i]);
+        if (! persistent) {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, FRAME_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+            continue;
+        }
+
+        s_stream.buffer_storage(GL_PIXEL_UNPACK_BUFFER, FRAME_BUFFER_SIZE, NULL, flags);
+        s_stream.mapped[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, FRAME_BUFFER_SIZE, flags);
+        if (s_stream.mapped[i] == NULL)
+            success = 0;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    return success;
+}
+
+static void _stream_cleanup(void) {
+    for (size_t i = 0; i < PBO_COUNT; ++i) {
+        if (s_stream.fences[i] != NULL)
+            s_stream.delete_sync(s_stream.fences[i]);
+
+        // deleting a buffer unmaps it
+        s_stream.fences[i] = NULL;
+        s_stream.mapped[i] = NULL;
+    }
+
+    glDeleteBuffers(PBO_COUNT, s_stream.pbos);
+    memset(s_stream.pbos, 0, sizeof(s_stream.pbos));
+    s_stream.next = 0;
+}
@@ -1,28 +1,46 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include "device/input.h"
+
 #include <stdint.h>
 
-typedef enum {
-    kINPUT_UP      = 0,
-    kINPUT_DOWN    = 1,
-    kINPUT_LEFT    = 2,
-    kINPUT_RIGHT   = 3,
-    kINPUT_A       = 4,
-    kINPUT_B       = 5,
-    kINPUT_START   = 6,
-    kINPUT_SELECT  = 7,
-    kINPUT_SIZE,
-} Input;
+// both pads and the held controls as of the latest key event or gamepad poll
+typedef struct {
+    InputFlags  inputs[INPUT_PORT_COUNT];
+    int         rewind_held;
+    int         fast_forward_held;
+    uint64_t    changed_ns;     // get_time_ns() when the latest change arrived, or 0 before any
+} PlatformInputState;
 
-typedef uint8_t InputFlags;
+// frontend requests which the main loop handles between frames
+typedef enum {
+    kPLATFORM_ACTION_NONE = 0,
+    kPLATFORM_ACTION_NEXT_ROM,
+    kPLATFORM_ACTION_PREV_ROM,
+    kPLATFORM_ACTION_LOAD_ROM, // a file was dropped onto the window
+    kPLATFORM_ACTION_SAVE_STATE,
+    kPLATFORM_ACTION_LOAD_STATE,
+    kPLATFORM_ACTION_RESET,
+    kPLATFORM_ACTION_POWER_CYCLE,
+} PlatformAction;
 
 int platform_init(void);
 void platform_cleanup(void);
+// replaces the default key and gamepad bindings with those in a file
+int platform_load_bindings(const char* path);
+// dispatches pending window and input events, which update the input state
+// and the pending action as they arrive
 void platform_poll_events(void);
-InputFlags platform_get_inputs(void);
+// never blocks, and can be called from any thread
+PlatformInputState platform_get_input_state(void);
+// returns the pending action, if any, and clears it
+PlatformAction platform_pop_action(void);
+// path of the last file dropped onto the window, valid until the next drop
+const char* platform_get_dropped_path(void);
 int platform_is_running(void);
-void platform_update_frame_buffer(uint32_t* buffer);
+// uploads a completed frame. only called from the thread that called platform_init
+void platform_update_frame_buffer(const uint32_t* buffer);
 void platform_draw(void);
 
 #endif
@@ -0,0 +1,113 @@
+// steps a batch of consoles running the same rom for a number of frames,
+// reporting the throughput in console frames per second and the cost of
+// forking a console
+#include "device/batch.h"
+#include "device/cart/cart.h"
+#include "helpers.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MIN_EXPECTED_ARG_COUNT 1
+#define DEFAULT_CONSOLE_COUNT 64
+#define DEFAULT_FRAME_COUNT 600
+#define FORK_COUNT 1000
+
+static void _print_usage(const char* exe) {
+    fprintf(stderr, "usage: %s [-j threads] [-n consoles] [-f frames] [-g] [-d downsample] <rom_path>\n", exe);
+}
+
+int main(int argc, char* argv[]) {
+    log_set_level(LOG_ERROR);
+
+    long thread_count           = sysconf(_SC_NPROCESSORS_ONLN);
+    long console_count          = DEFAULT_CONSOLE_COUNT;
+    long frame_count            = DEFAULT_FRAME_COUNT;
+    BatchFrameOptions options   = { .format = kBATCHFRAME_RGBA, .downsample = 1 };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:n:f:gd:")) != -1) {
+        switch (opt) {
+            case 'j': thread_count          = strtol(optarg, NULL, 10); break;
+            case 'n': console_count         = strtol(optarg, NULL, 10); break;
+            case 'f': frame_count           = strtol(optarg, NULL, 10); break;
+            case 'g': options.format        = kBATCHFRAME_GRAYSCALE;    break;
+            case 'd': options.downsample    = strtol(optarg, NULL, 10); break;
+
+            default:
+                _print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < MIN_EXPECTED_ARG_COUNT || thread_count <= 0 || console_count <= 0 || frame_count <= 0) {
+        _print_usage(argv[0]);
+        return 1;
+    }
+
+    const size_t frame_size = batch_get_frame_size(&options);
+    if (frame_size == 0) {
+        fprintf(stderr, "downsample must be 1, 2 or 4 (got %u)\n", options.downsample);
+        return 1;
+    }
+
+    Cart cart;
+    if (! cart_load(argv[optind], &cart))
+        return 1;
+
+    int success             = 0;
+    Batch* batch            = batch_create(thread_count);
+    BatchConsole** consoles = calloc(console_count, sizeof(*consoles));
+    InputFlags* inputs      = calloc(console_count * INPUT_PORT_COUNT, sizeof(*inputs));
+    uint8_t* frames         = malloc(console_count * frame_size);
+    if (batch == NULL)
+        goto bail;
+
+    for (long i = 0; i < console_count; ++i)
+        consoles[i] = batch_console_create(&cart);
+
+    const uint64_t start = get_time_ns();
+    for (long i = 0; i < frame_count; ++i) {
+        // something different on each console, so they don't run in lockstep
+        for (long j = 0; j < console_count * INPUT_PORT_COUNT; ++j)
+            inputs[j] = (InputFlags)(i * 31 + j * 17);
+
+        if (! batch_step(batch, consoles, inputs, console_count, frames, &options)) {
+            fprintf(stderr, "failed to step batch on frame %ld\n", i);
+            goto bail;
+        }
+    }
+    const uint64_t elapsed = get_time_ns() - start;
+
+    const double seconds = elapsed / 1e9;
+    printf("%ld consoles x %ld frames on %ld threads in %.3fs: %.0f frames/s, %.1fus per step\n",
+        console_count, frame_count, thread_count, seconds, console_count * frame_count / seconds, elapsed / 1e3 / frame_count);
+
+    // forks of a console which has been running for a while, as a search would
+    BatchConsole* forks[FORK_COUNT];
+    const uint64_t fork_start = get_time_ns();
+    for (int i = 0; i < FORK_COUNT; ++i)
+        forks[i] = batch_console_fork(consoles[0]);
+    const uint64_t fork_elapsed = get_time_ns() - fork_start;
+
+    for (int i = 0; i < FORK_COUNT; ++i)
+        batch_console_destroy(forks[i]);
+
+    printf("fork: %.2fus\n", fork_elapsed / 1e3 / FORK_COUNT);
+    success = 1;
+
+bail:
+    for (long i = 0; i < console_count; ++i)
+        batch_console_destroy(consoles[i]);
+    free(consoles);
+    free(inputs);
+    free(frames);
+    batch_destroy(batch);
+    cart_unload(&cart);
+
+    return success ? 0 : 1;
+}
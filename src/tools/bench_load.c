@@ -0,0 +1,81 @@
+// times cart_load/cart_unload for each rom given, so raw and compressed
+// storage formats can be compared on the same machine
+#include "device/cart/cart.h"
+#include "helpers.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define MIN_EXPECTED_ARG_COUNT 3
+
+int main(int argc, char* argv[]) {
+    log_set_level(LOG_ERROR);
+
+    if (argc < MIN_EXPECTED_ARG_COUNT) {
+        fprintf(stderr, "usage: %s <iterations> <rom_path>...\n", argv[0]);
+        return 1;
+    }
+
+    const long iterations = strtol(argv[1], NULL, 10);
+    if (iterations <= 0) {
+        fprintf(stderr, "iterations must be positive (got '%s')\n", argv[1]);
+        return 1;
+    }
+
+    printf("%-40s %12s %12s %10s %10s %10s %10s\n", "rom", "file bytes", "rom bytes", "min ms", "mean ms", "max ms", "MB/s");
+
+    int success = 1;
+    for (int i = 2; i < argc; ++i) {
+        const char* path = argv[i];
+
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            fprintf(stderr, "failed to stat '%s'\n", path);
+            success = 0;
+            continue;
+        }
+
+        uint64_t min_ns     = UINT64_MAX;
+        uint64_t max_ns     = 0;
+        uint64_t total_ns   = 0;
+        size_t rom_size     = 0;
+        int loaded          = 1;
+
+        for (long j = 0; j < iterations; ++j) {
+            Cart cart;
+
+            const uint64_t start = get_time_ns();
+            loaded = cart_load(path, &cart);
+            const uint64_t elapsed = get_time_ns() - start;
+
+            if (! loaded) {
+                fprintf(stderr, "failed to load '%s'\n", path);
+                success = 0;
+                break;
+            }
+
+            rom_size = cart.buffer_size;
+            cart_unload(&cart);
+
+            total_ns += elapsed;
+            if (elapsed < min_ns)
+                min_ns = elapsed;
+            if (elapsed > max_ns)
+                max_ns = elapsed;
+        }
+
+        if (! loaded)
+            continue;
+
+        const double mean_ns    = (double)total_ns / iterations;
+        const double throughput = (double)rom_size / (mean_ns / 1e9) / (1024.0 * 1024.0);
+        printf("%-40s %12lld %12zu %10.3f %10.3f %10.3f %10.1f\n",
+            path, (long long)st.st_size, rom_size, min_ns / 1e6, mean_ns / 1e6, max_ns / 1e6, throughput);
+    }
+
+    return success ? 0 : 1;
+}
+
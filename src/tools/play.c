@@ -0,0 +1,177 @@
+// plays movies back through the headless core as fast as possible, printing a
+// hash of the final machine state for each so runs can be compared bit for bit.
+// optionally also dumps what they sound like, with a hash of that too
+#include "device/audio_file.h"
+#include "device/device.h"
+#include "device/movie.h"
+#include "device/savestate.h"
+#include "device/apu/apu.h"
+#include "device/apu/resampler.h"
+#include "device/cart/cart.h"
+#include "helpers.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define MIN_EXPECTED_ARG_COUNT 2
+#define DEFAULT_SAMPLE_RATE 48000
+#define AUDIO_CHUNK_SAMPLES 1024
+
+static Resampler s_resampler;
+
+static void _print_usage(const char* exe) {
+    fprintf(stderr, "usage: %s [-e expected_crc32] [-o audio_path] [-r sample_rate] [-f wav|s16|f32] <rom_path> <movie_path>...\n", exe);
+}
+
+// moves everything the apu has made into the file, returning the running crc
+// of the samples
+static uint32_t _dump_audio(AudioFile* file, int16_t* resampled, uint32_t crc) {
+    int16_t samples[AUDIO_CHUNK_SAMPLES];
+
+    size_t count;
+    while ((count = sample_ring_read(device_get_sample_ring(), samples, AUDIO_CHUNK_SAMPLES)) > 0) {
+        const size_t n = resampler_process(&s_resampler, samples, count, resampled);
+        audio_file_write(file, resampled, n);
+        crc = crc32(crc, (const uint8_t*)resampled, n * sizeof(*resampled));
+    }
+
+    return crc;
+}
+
+int main(int argc, char* argv[]) {
+    log_set_level(LOG_ERROR);
+
+    int check_expected          = 0;
+    uint32_t expected           = 0;
+    const char* audio_path      = NULL;
+    long sample_rate            = DEFAULT_SAMPLE_RATE;
+    AudioFileFormat format      = kAUDIO_FILE_FORMAT_WAV;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:o:r:f:")) != -1) {
+        switch (opt) {
+            case 'e':
+                check_expected  = 1;
+                expected        = strtoul(optarg, NULL, 16);
+                break;
+            case 'o':
+                audio_path = optarg;
+                break;
+            case 'r':
+                sample_rate = strtol(optarg, NULL, 10);
+                if (sample_rate <= 0 || sample_rate > APU_MAX_SAMPLE_RATE) {
+                    fprintf(stderr, "sample rate must be between 1 and %.0f\n", APU_MAX_SAMPLE_RATE);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "wav") == 0) {
+                    format = kAUDIO_FILE_FORMAT_WAV;
+                } else if (strcmp(optarg, "s16") == 0) {
+                    format = kAUDIO_FILE_FORMAT_RAW_S16;
+                } else if (strcmp(optarg, "f32") == 0) {
+                    format = kAUDIO_FILE_FORMAT_RAW_F32;
+                } else {
+                    _print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+
+            default:
+                _print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < MIN_EXPECTED_ARG_COUNT) {
+        _print_usage(argv[0]);
+        return 1;
+    }
+
+    Cart cart;
+    if (! cart_load(argv[optind], &cart))
+        return 1;
+
+    device_init();
+    device_load_cart(&cart);
+
+    // nothing is shown, and nothing is heard unless it's being dumped, so
+    // only emulate what the cpu can see otherwise
+    device_set_outputs(audio_path != NULL ? kDEVICE_OUTPUT_AUDIO : 0);
+
+    AudioFile* audio_file   = NULL;
+    int16_t* resampled      = NULL;
+    if (audio_path != NULL) {
+        if (! resampler_init(&s_resampler, device_get_sample_rate(), sample_rate))
+            return 1;
+
+        audio_file  = audio_file_open(audio_path, format, sample_rate);
+        resampled   = malloc(resampler_get_max_output(&s_resampler, AUDIO_CHUNK_SAMPLES) * sizeof(*resampled));
+        if (audio_file == NULL || resampled == NULL)
+            return 1;
+    }
+
+    const size_t state_size = savestate_get_size();
+    uint8_t* state          = malloc(state_size);
+    int success             = 1;
+
+    printf("%-40s %10s %10s %12s %10s", "movie", "frames", "ms", "frames/s", "state crc");
+    printf(audio_file != NULL ? " %10s\n" : "\n", "audio crc");
+
+    for (int i = optind + 1; i < argc; ++i) {
+        const char* path = argv[i];
+
+        Movie movie;
+        if (! movie_load(&movie, path) || ! movie_play(&movie)) {
+            fprintf(stderr, "failed to play '%s'\n", path);
+            movie_close(&movie);
+            success = 0;
+            continue;
+        }
+
+        // every movie's audio starts from silence, so each can be compared
+        // on its own whatever was played before it
+        resampler_clear(&s_resampler);
+        uint32_t audio_crc = 0;
+
+        const uint64_t start = get_time_ns();
+        while (movie_play_frame(&movie)) {
+            device_exec_frame();
+            if (audio_file != NULL)
+                audio_crc = _dump_audio(audio_file, resampled, audio_crc);
+        }
+        const uint64_t elapsed = get_time_ns() - start;
+
+        savestate_write(state, state_size);
+        const uint32_t state_crc = crc32(0, state, state_size);
+
+        const double ms = elapsed / 1e6;
+        printf("%-40s %10u %10.1f %12.0f   %08X", path, movie.frame_count, ms, movie.frame_count / (ms / 1e3), state_crc);
+        if (audio_file != NULL)
+            printf("   %08X", audio_crc);
+        printf("\n");
+
+        if (check_expected && state_crc != expected) {
+            fprintf(stderr, "'%s' ended with state %08X, expected %08X\n", path, state_crc, expected);
+            success = 0;
+        }
+
+        movie_close(&movie);
+    }
+
+    free(state);
+    free(resampled);
+    if (audio_file != NULL && ! audio_file_close(audio_file))
+        success = 0;
+
+    device_unload_cart();
+    cart_unload(&cart);
+
+    return success ? 0 : 1;
+}
+
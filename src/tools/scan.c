@@ -0,0 +1,478 @@
+// walks directory trees of roms and reports which ones the cart module can
+// load, along with how each rom is classified. files are spread across a pool
+// of worker threads, each mapping its files and decompressing archives into
+// its own reusable buffer
+
+// for nftw
+#define _GNU_SOURCE
+
+#include "device/cart/cart.h"
+#include "device/cart/ines.h"
+#include "device/cart/archive.h"
+#include "device/mapper/mapper.h"
+#include "helpers.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define MAX_OPEN_DIRS 64
+#define INITIAL_PATH_CAPACITY 1024
+
+typedef enum {
+    kSCANSTATUS_OK = 0,
+    kSCANSTATUS_IO_ERROR,
+    kSCANSTATUS_ARCHIVE_ERROR,
+    kSCANSTATUS_NOT_ROM,
+    kSCANSTATUS_UNSUPPORTED_FORMAT,
+    kSCANSTATUS_UNSUPPORTED_MAPPER,
+    kSCANSTATUS_TRUNCATED,
+    kSCANSTATUS_ERROR,
+
+    kSCANSTATUS_COUNT,
+} ScanStatus;
+
+typedef enum {
+    kREPORTFORMAT_CSV,
+    kREPORTFORMAT_JSON,
+} ReportFormat;
+
+typedef struct {
+    const char*     path;
+    ScanStatus      status;
+    ArchiveType     container;
+    ROMFormat       format;
+    size_t          file_size;
+    size_t          rom_size;
+    uint32_t        crc32;
+    int             has_header;
+    uint8_t         mapper_num;
+    int             mapper_supported;
+    INESTVSystem    tv_system;
+    size_t          prg_rom_size;
+    size_t          chr_rom_size;
+    int             battery;
+} ScanResult;
+
+typedef struct {
+    pthread_t       thread;
+    uint8_t*        buffer;
+    size_t          buffer_size;
+} ScanWorker;
+
+static const char* s_status_names[kSCANSTATUS_COUNT] = {
+    [kSCANSTATUS_OK]                    = "ok",
+    [kSCANSTATUS_IO_ERROR]              = "io_error",
+    [kSCANSTATUS_ARCHIVE_ERROR]         = "archive_error",
+    [kSCANSTATUS_NOT_ROM]               = "not_rom",
+    [kSCANSTATUS_UNSUPPORTED_FORMAT]    = "unsupported_format",
+    [kSCANSTATUS_UNSUPPORTED_MAPPER]    = "unsupported_mapper",
+    [kSCANSTATUS_TRUNCATED]             = "truncated",
+    [kSCANSTATUS_ERROR]                 = "error",
+};
+
+static char** s_paths           = NULL;
+static size_t s_path_count      = 0;
+static size_t s_path_capacity   = 0;
+
+static ScanResult* s_results    = NULL;
+static atomic_size_t s_next_result;
+
+static pthread_mutex_t s_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int _collect_path(const char* path, const struct stat* st, int type, struct FTW* ftw);
+static int _compare_paths(const void* a, const void* b);
+static void* _worker_main(void* arg);
+static void _scan_file(ScanWorker* worker, ScanResult* result);
+static void _classify(const uint8_t* rom, size_t rom_size, ScanResult* result);
+static void _write_csv(FILE* out);
+static void _write_json(FILE* out);
+static void _write_json_string(FILE* out, const char* str);
+static const char* _container_name(ArchiveType type);
+static const char* _format_name(ROMFormat format);
+static const char* _region_name(INESTVSystem tv_system);
+static void _log_lock(bool lock, void* udata);
+
+static void _print_usage(const char* name) {
+    fprintf(stderr, "usage: %s [-j threads] [-f csv|json] [-o out_path] [-v] <path>...\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    long thread_count       = sysconf(_SC_NPROCESSORS_ONLN);
+    ReportFormat format     = kREPORTFORMAT_CSV;
+    const char* out_path    = NULL;
+    int verbose             = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:f:o:vh")) != -1) {
+        switch (opt) {
+            case 'j':
+                thread_count = strtol(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (strcmp(optarg, "csv") == 0) {
+                    format = kREPORTFORMAT_CSV;
+                } else if (strcmp(optarg, "json") == 0) {
+                    format = kREPORTFORMAT_JSON;
+                } else {
+                    fprintf(stderr, "unknown report format '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+
+            default:
+                _print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc || thread_count <= 0) {
+        _print_usage(argv[0]);
+        return 1;
+    }
+
+    // the cart module logs as it parses, which is noise for tens of thousands
+    // of roms unless asked for
+    log_set_level(LOG_TRACE);
+    log_set_quiet(! verbose);
+    log_set_lock(_log_lock, &s_log_mutex);
+
+    const uint64_t start = get_time_ns();
+
+    for (int i = optind; i < argc; ++i) {
+        if (nftw(argv[i], _collect_path, MAX_OPEN_DIRS, FTW_PHYS) != 0) {
+            fprintf(stderr, "failed to walk '%s' (%s)\n", argv[i], strerror(errno));
+            return 1;
+        }
+    }
+
+    // sorted so reports from the same corpus diff cleanly
+    qsort(s_paths, s_path_count, sizeof(s_paths[0]), _compare_paths);
+
+    s_results = calloc(s_path_count, sizeof(s_results[0]));
+    for (size_t i = 0; i < s_path_count; ++i)
+        s_results[i].path = s_paths[i];
+
+    if ((size_t)thread_count > s_path_count)
+        thread_count = s_path_count > 0 ? s_path_count : 1;
+
+    atomic_init(&s_next_result, 0);
+    ScanWorker* workers = calloc(thread_count, sizeof(workers[0]));
+    for (long i = 0; i < thread_count; ++i)
+        pthread_create(&workers[i].thread, NULL, _worker_main, &workers[i]);
+
+    for (long i = 0; i < thread_count; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        free(workers[i].buffer);
+    }
+
+    free(workers);
+
+    const uint64_t elapsed = get_time_ns() - start;
+
+    FILE* out = stdout;
+    if (out_path != NULL) {
+        out = fopen(out_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "failed to open '%s' (%s)\n", out_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    if (format == kREPORTFORMAT_JSON)
+        _write_json(out);
+    else
+        _write_csv(out);
+
+    if (out != stdout)
+        fclose(out);
+
+    size_t status_counts[kSCANSTATUS_COUNT] = {0};
+    size_t total_bytes = 0;
+    for (size_t i = 0; i < s_path_count; ++i) {
+        ++status_counts[s_results[i].status];
+        total_bytes += s_results[i].file_size;
+    }
+
+    const double secs = elapsed / 1e9;
+    fprintf(stderr, "scanned %zu files (%.1f MB) in %.3fs with %ld threads (%.0f files/s, %.1f MB/s)\n",
+        s_path_count, total_bytes / (1024.0 * 1024.0), secs, thread_count,
+        s_path_count / secs, total_bytes / (1024.0 * 1024.0) / secs);
+    for (size_t i = 0; i < kSCANSTATUS_COUNT; ++i) {
+        if (status_counts[i] > 0)
+            fprintf(stderr, "  %-20s %zu\n", s_status_names[i], status_counts[i]);
+    }
+
+    for (size_t i = 0; i < s_path_count; ++i)
+        free(s_paths[i]);
+
+    free(s_paths);
+    free(s_results);
+
+    return 0;
+}
+
+static int _collect_path(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)st;
+    (void)ftw;
+
+    if (type != FTW_F)
+        return 0;
+
+    if (s_path_count == s_path_capacity) {
+        s_path_capacity = s_path_capacity == 0 ? INITIAL_PATH_CAPACITY : s_path_capacity*2;
+        s_paths         = realloc(s_paths, s_path_capacity * sizeof(s_paths[0]));
+    }
+
+    s_paths[s_path_count++] = strdup(path);
+    return 0;
+}
+
+static int _compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void* _worker_main(void* arg) {
+    ScanWorker* worker = (ScanWorker*)arg;
+
+    for (;;) {
+        const size_t idx = atomic_fetch_add_explicit(&s_next_result, 1, memory_order_relaxed);
+        if (idx >= s_path_count)
+            break;
+
+        _scan_file(worker, &s_results[idx]);
+    }
+
+    return NULL;
+}
+
+static void _scan_file(ScanWorker* worker, ScanResult* result) {
+    const int fd = open(result->path, O_RDONLY);
+    if (fd < 0) {
+        result->status = kSCANSTATUS_IO_ERROR;
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        result->status = kSCANSTATUS_IO_ERROR;
+        close(fd);
+        return;
+    }
+
+    result->file_size = st.st_size;
+    if (result->file_size == 0) {
+        result->status = kSCANSTATUS_NOT_ROM;
+        close(fd);
+        return;
+    }
+
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    // fault the whole file in up front rather than a page at a time
+    flags |= MAP_POPULATE;
+#endif
+    uint8_t* data = mmap(NULL, result->file_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        result->status = kSCANSTATUS_IO_ERROR;
+        return;
+    }
+
+    const uint8_t* rom  = data;
+    size_t rom_size     = result->file_size;
+
+    result->container = archive_get_type(data, result->file_size);
+    if (result->container != kARCHIVETYPE_NONE) {
+        if (! archive_get_rom_size(result->container, data, result->file_size, &rom_size)) {
+            result->status = kSCANSTATUS_ARCHIVE_ERROR;
+            goto bail;
+        }
+
+        if (rom_size > worker->buffer_size) {
+            free(worker->buffer);
+            worker->buffer      = malloc(rom_size);
+            worker->buffer_size = rom_size;
+        }
+
+        if (! archive_extract_rom(result->container, data, result->file_size, worker->buffer, rom_size)) {
+            result->status = kSCANSTATUS_ARCHIVE_ERROR;
+            goto bail;
+        }
+
+        rom = worker->buffer;
+    }
+
+    _classify(rom, rom_size, result);
+
+bail:
+    munmap(data, result->file_size);
+}
+
+static void _classify(const uint8_t* rom, size_t rom_size, ScanResult* result) {
+    result->rom_size = rom_size;
+
+    Cart cart;
+    const int loadable  = cart_inspect(rom, rom_size, &cart);
+    result->format      = cart.format;
+    result->crc32       = cart.crc32;
+    cart_unload(&cart);
+
+    if (result->format == kROMFORMAT_NONE) {
+        // nothing to identify it by, so hash the whole thing
+        result->crc32   = crc32(0, rom, rom_size);
+        result->status  = kSCANSTATUS_NOT_ROM;
+        return;
+    }
+
+    INESHeader* header = ines_load(rom, rom_size);
+    if (header == NULL) {
+        result->status = kSCANSTATUS_ERROR;
+        return;
+    }
+
+    result->has_header          = 1;
+    result->mapper_num          = ines_mapper(header);
+    result->mapper_supported    = mapper_get_type(result->mapper_num) != kCARTMAPPER_UNKNOWN;
+    result->tv_system           = ines_tv_system(header);
+    result->prg_rom_size        = ines_prg_rom_size_bytes(header);
+    result->chr_rom_size        = ines_chr_rom_size_bytes(header);
+    result->battery             = ines_has_prg_ram(header) != 0;
+
+    const size_t rom_end = ines_prg_rom_start(header) + result->prg_rom_size + result->chr_rom_size;
+    ines_unload(header);
+
+    if (loadable)
+        result->status = kSCANSTATUS_OK;
+    else if (result->format == kROMFORMAT_INES20)
+        result->status = kSCANSTATUS_UNSUPPORTED_FORMAT;
+    else if (! result->mapper_supported)
+        result->status = kSCANSTATUS_UNSUPPORTED_MAPPER;
+    else if (rom_end > rom_size)
+        result->status = kSCANSTATUS_TRUNCATED;
+    else
+        result->status = kSCANSTATUS_ERROR;
+}
+
+static void _write_csv(FILE* out) {
+    fprintf(out, "path,status,container,format,file_size,rom_size,crc32,mapper,mapper_supported,region,prg_rom_size,chr_rom_size,battery\n");
+
+    for (size_t i = 0; i < s_path_count; ++i) {
+        const ScanResult* r = &s_results[i];
+
+        fputc('"', out);
+        for (const char* c = r->path; *c != '\0'; ++c) {
+            if (*c == '"')
+                fputc('"', out);
+            fputc(*c, out);
+        }
+        fputc('"', out);
+
+        fprintf(out, ",%s,%s,%s,%zu,%zu,%08X,",
+            s_status_names[r->status], _container_name(r->container), _format_name(r->format),
+            r->file_size, r->rom_size, r->crc32);
+
+        if (r->has_header) {
+            fprintf(out, "%u,%d,%s,%zu,%zu,%d\n",
+                r->mapper_num, r->mapper_supported, _region_name(r->tv_system),
+                r->prg_rom_size, r->chr_rom_size, r->battery);
+        } else {
+            fprintf(out, ",,,,,\n");
+        }
+    }
+}
+
+static void _write_json(FILE* out) {
+    fprintf(out, "[\n");
+
+    for (size_t i = 0; i < s_path_count; ++i) {
+        const ScanResult* r = &s_results[i];
+
+        fprintf(out, "  {\"path\": ");
+        _write_json_string(out, r->path);
+        fprintf(out, ", \"status\": \"%s\", \"container\": \"%s\", \"format\": \"%s\", \"file_size\": %zu, \"rom_size\": %zu, \"crc32\": \"%08X\"",
+            s_status_names[r->status], _container_name(r->container), _format_name(r->format),
+            r->file_size, r->rom_size, r->crc32);
+
+        if (r->has_header) {
+            fprintf(out, ", \"mapper\": %u, \"mapper_supported\": %s, \"region\": \"%s\", \"prg_rom_size\": %zu, \"chr_rom_size\": %zu, \"battery\": %s",
+                r->mapper_num, r->mapper_supported ? "true" : "false", _region_name(r->tv_system),
+                r->prg_rom_size, r->chr_rom_size, r->battery ? "true" : "false");
+        }
+
+        fprintf(out, "}%s\n", i + 1 < s_path_count ? "," : "");
+    }
+
+    fprintf(out, "]\n");
+}
+
+static void _write_json_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for (const unsigned char* c = (const unsigned char*)str; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(out, "\\u%04X", *c);
+        else
+            fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static const char* _container_name(ArchiveType type) {
+    switch (type) {
+        case kARCHIVETYPE_NONE: return "raw";
+        case kARCHIVETYPE_GZIP: return "gzip";
+        case kARCHIVETYPE_ZIP:  return "zip";
+    }
+
+    return "unknown";
+}
+
+static const char* _format_name(ROMFormat format) {
+    switch (format) {
+        case kROMFORMAT_NONE:   return "unknown";
+        case kROMFORMAT_INES:   return "ines";
+        case kROMFORMAT_INES20: return "ines20";
+    }
+
+    return "unknown";
+}
+
+static const char* _region_name(INESTVSystem tv_system) {
+    switch (tv_system) {
+        case kINESTVSystem_NTSC:    return "ntsc";
+        case kINESTVSystem_PAL:     return "pal";
+        case kINESTVSystem_Multi:   return "multi";
+        case kINESTVSystem_Dendy:   return "dendy";
+    }
+
+    return "unknown";
+}
+
+static void _log_lock(bool lock, void* udata) {
+    pthread_mutex_t* mutex = (pthread_mutex_t*)udata;
+    if (lock)
+        pthread_mutex_lock(mutex);
+    else
+        pthread_mutex_unlock(mutex);
+}
+